@@ -0,0 +1,456 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// modpro-bench measures how long plugins, built in effects and whole chains
+// take per sample so effects and period sizes can be picked with real
+// numbers. Results go to stdout as JSON or CSV; everything else the
+// processor prints is discarded unless --verbose is given.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+#include "arena.h"
+#include "audio.h"
+#include "backend.h"
+#include "event.h"
+#include "ladspa.h"
+#include "native.h"
+#include "timing.h"
+
+using namespace std;
+using namespace modpro;
+
+using sample_type = backend::sample_type;
+using nframes_type = backend::nframes_type;
+
+static const nframes_type min_buffer_size = 16;
+static const nframes_type max_buffer_size = 4096;
+// enough samples at every buffer size for the mean to settle
+static const size_t warm_samples = 1 << 20;
+static const size_t warm_min_runs = 32;
+static const size_t cold_runs = 16;
+// bigger than the last level cache of anything we run on
+static const size_t cache_flush_bytes = 32 * 1024 * 1024;
+
+struct result {
+    string kind;
+    string name;
+    nframes_type buffer_size;
+    string cache;
+    size_t runs;
+    double mean_ns_per_sample;
+    double min_ns_per_sample;
+};
+
+struct options {
+    string format = "json";
+    nframes_type sample_rate = 48000;
+    bool verbose = false;
+    bool plugins = true;
+    bool chains = true;
+    string conf_path;
+};
+
+static vector<sample_type> make_noise(const size_t count_in)
+{
+    vector<sample_type> retval(count_in);
+    mt19937 generator(1);
+    uniform_real_distribution<sample_type> distribution(-0.5, 0.5);
+
+    for (auto& i : retval) {
+        i = distribution(generator);
+    }
+
+    return retval;
+}
+
+// evicts everything a run left in the caches
+static void flush_cache()
+{
+    static vector<uint8_t> junk(cache_flush_bytes);
+    static uint8_t counter = 0;
+
+    counter++;
+    for (size_t i = 0; i < junk.size(); i += 64) {
+        junk[i] += counter;
+    }
+}
+
+// times run_in() at one buffer size with warm and then cold caches
+template<typename T>
+static void measure(vector<result> & results_in, const string kind_in, const string name_in, const nframes_type buffer_size_in, T run_in)
+{
+    result warm = { kind_in, name_in, buffer_size_in, "warm", 0, 0, INFINITY };
+    result cold = { kind_in, name_in, buffer_size_in, "cold", 0, 0, INFINITY };
+    timing::ns_type total = 0;
+
+    for (size_t i = 0; i < warm_min_runs / 4; i++) {
+        run_in();
+    }
+
+    while(warm.runs < warm_min_runs || warm.runs * buffer_size_in < warm_samples) {
+        auto start = timing::now();
+        run_in();
+        auto elapsed = timing::now() - start;
+
+        total += elapsed;
+        warm.min_ns_per_sample = min(warm.min_ns_per_sample, double(elapsed) / buffer_size_in);
+        warm.runs++;
+    }
+
+    warm.mean_ns_per_sample = double(total) / (warm.runs * buffer_size_in);
+    total = 0;
+
+    for (; cold.runs < cold_runs; cold.runs++) {
+        flush_cache();
+
+        auto start = timing::now();
+        run_in();
+        auto elapsed = timing::now() - start;
+
+        total += elapsed;
+        cold.min_ns_per_sample = min(cold.min_ns_per_sample, double(elapsed) / buffer_size_in);
+    }
+
+    cold.mean_ns_per_sample = double(total) / (cold.runs * buffer_size_in);
+
+    results_in.push_back(warm);
+    results_in.push_back(cold);
+}
+
+// every type in every plugin file, run on its own with default controls
+static void bench_plugins(const options & options_in, vector<result> & results_in)
+{
+    audio::config config(options_in.conf_path);
+    auto plugins = ladspa::make();
+    auto memory = arena::make(arena::default_chunk_size, false);
+    auto input = make_noise(max_buffer_size);
+    vector<sample_type> output(max_buffer_size);
+    vector<vector<sample_type>> outputs;
+
+    for (auto& path : config.get_plugins()) {
+        auto file = plugins->open(path);
+
+        for (auto& i : file->get_types()) {
+            auto type = i.second;
+            auto effect = type->instantiate(options_in.sample_rate, memory);
+
+            cerr << "benchmarking plugin " << type->get_name() << endl;
+
+            for (auto port : type->get_ports()) {
+                if (port->is_audio()) {
+                    // every output gets its own buffer so plugins that can
+                    // not run in place are measured fairly
+                    if (port->is_input()) {
+                        effect->connect(port->number, input.data());
+                    } else {
+                        outputs.push_back(vector<sample_type>(max_buffer_size));
+                        effect->connect(port->number, outputs.back().data());
+                    }
+                } else if (port->is_input()) {
+                    effect->set_control(port->number, port->get_default(options_in.sample_rate));
+                }
+            }
+
+            effect->activate();
+
+            for (auto buffer_size = min_buffer_size; buffer_size <= max_buffer_size; buffer_size *= 2) {
+                measure(results_in, "plugin", type->get_name(), buffer_size, [&]() -> void {
+                    effect->run(buffer_size);
+                });
+            }
+        }
+    }
+}
+
+// every built in effect with default controls so it can be compared with
+// the plugin it replaces
+static void bench_natives(const options & options_in, vector<result> & results_in)
+{
+    auto natives = native::make();
+    auto memory = arena::make(arena::default_chunk_size, false);
+    auto input = make_noise(max_buffer_size);
+    vector<vector<sample_type>> outputs;
+
+    for (auto& name : natives->get_type_names()) {
+        // the network effects need a peer to talk to
+        if (natives->needs_options(name)) {
+            continue;
+        }
+
+        auto effect = natives->instantiate(name, options_in.sample_rate, memory);
+
+        cerr << "benchmarking native " << name << endl;
+
+        for (auto& port : effect->get_ports()) {
+            if (! port.is_audio) {
+                continue;
+            }
+
+            if (port.is_input) {
+                effect->connect(port.name, input.data());
+            } else {
+                outputs.push_back(vector<sample_type>(max_buffer_size));
+                effect->connect(port.name, outputs.back().data());
+            }
+        }
+
+        effect->activate();
+
+        for (auto buffer_size = min_buffer_size; buffer_size <= max_buffer_size; buffer_size *= 2) {
+            measure(results_in, "native", name, buffer_size, [&]() -> void {
+                effect->run(buffer_size);
+            });
+        }
+    }
+}
+
+// a backend that is driven directly by the benchmark one period at a time
+struct bench_backend : public backend {
+    struct audio_port : public backend::audio_port {
+        vector<sample_type> buffer;
+
+        audio_port(const vector<sample_type> buffer_in) : buffer(buffer_in) { }
+        virtual sample_type * get_buffer(const nframes_type nframes_in) override
+        {
+            return buffer.data();
+        }
+    };
+
+    shared_ptr<handlers> handler;
+    const nframes_type sample_rate;
+    const nframes_type buffer_size;
+    vector<sample_type> noise;
+    vector<shared_ptr<audio_port>> ports;
+
+    bench_backend(const nframes_type sample_rate_in, const nframes_type buffer_size_in)
+    : sample_rate(sample_rate_in), buffer_size(buffer_size_in), noise(make_noise(buffer_size_in)) { }
+    virtual void open(shared_ptr<handlers> handler_in) override { handler = handler_in; }
+    virtual void activate() override { }
+    virtual bool is_realtime() override { return false; }
+    virtual nframes_type get_sample_rate() override { return sample_rate; }
+    virtual nframes_type get_buffer_size() override { return buffer_size; }
+    virtual int get_realtime_priority() override { return 0; }
+    virtual float get_dsp_load() override { return 0; }
+    virtual vector<string> get_known_port_names() override { return {}; }
+    virtual int connect_port(const string source_in, const string dest_in) override { return 0; }
+
+    virtual shared_ptr<backend::audio_port> add_audio_input(const string name_in) override
+    {
+        ports.push_back(make_shared<audio_port>(noise));
+        return ports.back();
+    }
+
+    virtual shared_ptr<backend::audio_port> add_audio_output(const string name_in) override
+    {
+        ports.push_back(make_shared<audio_port>(vector<sample_type>(buffer_size)));
+        return ports.back();
+    }
+
+    void run()
+    {
+        handler->handle_process(buffer_size);
+    }
+};
+
+static void bench_config(const options & options_in, vector<result> & results_in, const string name_in, const string conf_path_in)
+{
+    cerr << "benchmarking chain " << name_in << endl;
+
+    for (auto buffer_size = min_buffer_size; buffer_size <= max_buffer_size; buffer_size *= 2) {
+        auto backend = make_shared<bench_backend>(options_in.sample_rate, buffer_size);
+        auto processor = audio::processor::make(conf_path_in, make_shared<event::broker>(), nullptr, backend);
+
+        processor->start();
+
+        measure(results_in, "chain", name_in, buffer_size, [&]() -> void {
+            backend->run();
+        });
+
+        // the handler is a shared_ptr so the processor has to be let go of
+        // by hand
+        backend->handler = nullptr;
+    }
+}
+
+// every chain on its own and then the whole configuration together; the
+// processor runs offline so the PTT sockets, meter block, metrics file and
+// recordings of a running daemon are left alone
+static void bench_chains(const options & options_in, vector<result> & results_in)
+{
+    auto root = YAML::LoadFile(options_in.conf_path);
+    auto natives = native::make();
+    auto all = YAML::Clone(root);
+    char temp_path[] = "/tmp/modpro-bench-XXXXXX";
+    auto temp_fd = mkstemp(temp_path);
+
+    if (temp_fd == -1) {
+        throw runtime_error("could not create a temporary file");
+    }
+
+    close(temp_fd);
+
+    all["chains"] = YAML::Node(YAML::NodeType::Map);
+
+    for (auto i : root["chains"]) {
+        auto chain_name = i.first.as<string>();
+        auto single = YAML::Clone(root);
+        bool uses_network = false;
+
+        // the network effects would send noise to the real station
+        for (auto j : i.second["effects"]) {
+            uses_network = uses_network || natives->needs_options(j["type"].as<string>());
+        }
+
+        if (uses_network) {
+            cerr << "skipping chain " << chain_name << " because it uses the network" << endl;
+            continue;
+        }
+
+        all["chains"][chain_name] = i.second;
+
+        single["chains"] = YAML::Node(YAML::NodeType::Map);
+        single["chains"][chain_name] = i.second;
+        single["routes"] = YAML::Node(YAML::NodeType::Sequence);
+
+        ofstream(temp_path) << single;
+        bench_config(options_in, results_in, chain_name, temp_path);
+    }
+
+    if (all["chains"].size() > 0) {
+        ofstream(temp_path) << all;
+        bench_config(options_in, results_in, "*", temp_path);
+    }
+
+    unlink(temp_path);
+}
+
+static void print_json(const options & options_in, const vector<result> & results_in)
+{
+    printf("{\n  \"sample_rate\": %u,\n  \"results\": [\n", options_in.sample_rate);
+
+    for (size_t i = 0; i < results_in.size(); i++) {
+        auto& result = results_in[i];
+        string name;
+
+        for (auto c : result.name) {
+            if (c == '"' || c == '\\') {
+                name += '\\';
+            }
+
+            name += c;
+        }
+
+        printf("    { \"kind\": \"%s\", \"name\": \"%s\", \"buffer_size\": %u, \"cache\": \"%s\", \"runs\": %zu, \"mean_ns_per_sample\": %.3f, \"min_ns_per_sample\": %.3f }%s\n",
+            result.kind.c_str(), name.c_str(), result.buffer_size, result.cache.c_str(), result.runs,
+            result.mean_ns_per_sample, result.min_ns_per_sample, i + 1 < results_in.size() ? "," : "");
+    }
+
+    printf("  ]\n}\n");
+}
+
+static void print_csv(const options & options_in, const vector<result> & results_in)
+{
+    printf("kind,name,sample_rate,buffer_size,cache,runs,mean_ns_per_sample,min_ns_per_sample\n");
+
+    for (auto& result : results_in) {
+        string name;
+
+        for (auto c : result.name) {
+            name += c;
+
+            if (c == '"') {
+                name += '"';
+            }
+        }
+
+        printf("%s,\"%s\",%u,%u,%s,%zu,%.3f,%.3f\n", result.kind.c_str(), name.c_str(), options_in.sample_rate,
+            result.buffer_size, result.cache.c_str(), result.runs, result.mean_ns_per_sample, result.min_ns_per_sample);
+    }
+}
+
+static void usage()
+{
+    cerr << "usage: modpro-bench [--csv] [--rate N] [--plugins-only | --chains-only] [--verbose] <config.yml>" << endl;
+}
+
+int main(int argc, const char *argv[])
+{
+    options options;
+    int arg_num = 1;
+
+    for (; arg_num < argc && ! strncmp(argv[arg_num], "--", 2); arg_num++) {
+        string arg(argv[arg_num]);
+
+        if (arg == "--csv") {
+            options.format = "csv";
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (arg == "--plugins-only") {
+            options.chains = false;
+        } else if (arg == "--chains-only") {
+            options.plugins = false;
+        } else if (arg == "--rate" && arg_num + 1 < argc) {
+            options.sample_rate = stoul(argv[++arg_num]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (arg_num + 1 != argc) {
+        usage();
+        return 1;
+    }
+
+    options.conf_path = argv[arg_num];
+
+    // the processor is chatty and stdout is for the results
+    ofstream discard("/dev/null");
+    auto cout_buffer = cout.rdbuf();
+    if (! options.verbose) {
+        cout.rdbuf(discard.rdbuf());
+    }
+
+    vector<result> results;
+
+    if (options.plugins) {
+        bench_plugins(options, results);
+        bench_natives(options, results);
+    }
+
+    if (options.chains) {
+        bench_chains(options, results);
+    }
+
+    cout.rdbuf(cout_buffer);
+
+    if (options.format == "csv") {
+        print_csv(options, results);
+    } else {
+        print_json(options, results);
+    }
+
+    return 0;
+}
@@ -1,4 +1,5 @@
 #!/usr/bin/env bash
 
 dbusxx-xml2cpp src/dbus-adaptor.xml --adaptor=src/dbus-adaptor.h
-g++ -g -Wall -std=gnu++17 -o modpro src/*.cxx -ljack -ldl -lpthread -lyaml-cpp $(pkg-config dbus-c++-1 --cflags --libs)
+g++ -g -Wall -std=gnu++17 -o modpro src/*.cxx -ljack -ldl -lpthread -lrt -lyaml-cpp $(pkg-config dbus-c++-1 --cflags --libs)
+g++ -O2 -g -Wall -std=gnu++17 -Isrc -o modpro-bench bench/*.cxx $(ls src/*.cxx | grep -v src/main.cxx) -ljack -ldl -lpthread -lrt -lyaml-cpp $(pkg-config dbus-c++-1 --cflags --libs)
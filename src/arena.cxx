@@ -0,0 +1,187 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+namespace modpro {
+
+std::atomic<size_t> arena::total_bytes(0);
+std::atomic<size_t> arena::total_used_bytes(0);
+std::atomic<size_t> arena::total_locked_bytes(0);
+
+static size_t round_up(const size_t value_in, const size_t multiple_in)
+{
+    return (value_in + multiple_in - 1) / multiple_in * multiple_in;
+}
+
+arena::arena(const size_t chunk_size_in, const bool huge_pages_in)
+: chunk_size(chunk_size_in), huge_pages(huge_pages_in)
+{
+
+}
+
+arena::~arena()
+{
+    for (auto& i : chunks) {
+        if (i.locked) {
+            munlock(i.memory, i.size);
+            total_locked_bytes -= i.size;
+        }
+
+        munmap(i.memory, i.size);
+        total_bytes -= i.size;
+        total_used_bytes -= i.used;
+    }
+}
+
+arena::chunk & arena::add_chunk(const size_t min_size_in)
+{
+    auto page_size = huge_pages ? huge_page_size : sysconf(_SC_PAGESIZE);
+    auto size = round_up(std::max(min_size_in, chunk_size), page_size);
+    void * memory = MAP_FAILED;
+
+    if (huge_pages) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (memory == MAP_FAILED) {
+            std::cout << "could not map huge pages for audio arena: " << strerror(errno) << std::endl;
+        }
+    }
+
+    if (memory == MAP_FAILED) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("could not map memory for audio arena");
+        }
+
+        if (huge_pages) {
+            madvise(memory, size, MADV_HUGEPAGE);
+        }
+    }
+
+    chunks.push_back({ memory, size, 0, false });
+    total_bytes += size;
+
+    if (should_lock) {
+        lock_chunk(chunks.back());
+    }
+
+    return chunks.back();
+}
+
+void arena::lock_chunk(chunk & chunk_in)
+{
+    if (chunk_in.locked) {
+        return;
+    }
+
+    if (mlock(chunk_in.memory, chunk_in.size) == 0) {
+        chunk_in.locked = true;
+        total_locked_bytes += chunk_in.size;
+    } else {
+        std::cout << "could not lock " << chunk_in.size << " bytes of audio arena: " << strerror(errno) << std::endl;
+    }
+
+    // mlock() normally faults everything in but do it by hand as well so
+    // the pages are present even if locking was not allowed
+    auto page_size = sysconf(_SC_PAGESIZE);
+    auto bytes = static_cast<volatile char *>(chunk_in.memory);
+    for (size_t i = 0; i < chunk_in.size; i += page_size) {
+        bytes[i] = bytes[i];
+    }
+}
+
+// outside jack audio thread
+void * arena::allocate(const size_t bytes_in)
+{
+    auto size = round_up(bytes_in > 0 ? bytes_in : 1, alignment);
+    chunk * target = nullptr;
+
+    for (auto& i : chunks) {
+        if (i.size - i.used >= size) {
+            target = &i;
+            break;
+        }
+    }
+
+    if (target == nullptr) {
+        target = &add_chunk(size);
+    }
+
+    // fresh anonymous mappings are already zeroed and memory is never
+    // handed out twice
+    auto retval = static_cast<char *>(target->memory) + target->used;
+    target->used += size;
+    total_used_bytes += size;
+
+    return retval;
+}
+
+void arena::lock()
+{
+    should_lock = true;
+
+    for (auto& i : chunks) {
+        lock_chunk(i);
+    }
+}
+
+size_t arena::get_size()
+{
+    size_t retval = 0;
+
+    for (auto& i : chunks) {
+        retval += i.size;
+    }
+
+    return retval;
+}
+
+size_t arena::get_used()
+{
+    size_t retval = 0;
+
+    for (auto& i : chunks) {
+        retval += i.used;
+    }
+
+    return retval;
+}
+
+size_t arena::get_total_size()
+{
+    return total_bytes.load();
+}
+
+size_t arena::get_total_used()
+{
+    return total_used_bytes.load();
+}
+
+size_t arena::get_total_locked()
+{
+    return total_locked_bytes.load();
+}
+
+}
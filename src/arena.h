@@ -0,0 +1,89 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace modpro {
+
+// Owns memory the jack audio thread reads and writes: wire buffers and
+// control blocks. Allocations are bump allocated out of large mmap()ed
+// chunks, are always 64 byte aligned and zeroed. Once lock() is called
+// every chunk is mlock()ed and every page has been touched so the audio
+// thread never takes a page fault on arena memory. Memory is only given
+// back when the arena is destroyed.
+struct arena : public std::enable_shared_from_this<arena> {
+    static const size_t alignment = 64;
+    static const size_t default_chunk_size = 256 * 1024;
+    static const size_t huge_page_size = 2 * 1024 * 1024;
+
+    const size_t chunk_size;
+    const bool huge_pages;
+
+    private:
+    struct chunk {
+        void * memory;
+        size_t size;
+        size_t used;
+        bool locked;
+    };
+
+    std::vector<chunk> chunks;
+    bool should_lock = false;
+
+    static std::atomic<size_t> total_bytes;
+    static std::atomic<size_t> total_used_bytes;
+    static std::atomic<size_t> total_locked_bytes;
+
+    chunk & add_chunk(const size_t min_size_in);
+    void lock_chunk(chunk & chunk_in);
+
+    public:
+    arena(const size_t chunk_size_in = default_chunk_size, const bool huge_pages_in = false);
+    ~arena();
+    template<typename... Args>
+    static std::shared_ptr<arena> make(Args... args)
+    {
+        return std::make_shared<arena>(args...);
+    }
+
+    // outside jack audio thread
+    void * allocate(const size_t bytes_in);
+    template<typename T>
+    T * allocate_array(const size_t count_in)
+    {
+        auto memory = static_cast<T *>(allocate(sizeof(T) * count_in));
+
+        for (size_t i = 0; i < count_in; i++) {
+            new (&memory[i]) T();
+        }
+
+        return memory;
+    }
+    void lock();
+    size_t get_size();
+    size_t get_used();
+
+    static size_t get_total_size();
+    static size_t get_total_used();
+    static size_t get_total_locked();
+};
+
+}
@@ -13,11 +13,15 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
 #include <functional>
 #include <stdexcept>
 
 #include "audio.h"
+#include "netaudio.h"
 
 namespace modpro {
 
@@ -68,22 +72,113 @@ YAML::Node audio::config::get_routes()
     return root["routes"];
 }
 
-audio::sample_type * audio::make_buffer(const audio::size_type size_in)
+// the workers section is optional
+YAML::Node audio::config::get_workers()
 {
-    assert(size_in > 0);
-    auto new_buffer = calloc(sizeof(audio::sample_type), size_in);
+    return root["workers"];
+}
+
+// the memory section is optional
+YAML::Node audio::config::get_memory()
+{
+    return root["memory"];
+}
+
+// the metrics section is optional
+YAML::Node audio::config::get_metrics()
+{
+    return root["metrics"];
+}
+
+// the dbus section is optional
+YAML::Node audio::config::get_dbus()
+{
+    return root["dbus"];
+}
+
+// the meters section is optional
+YAML::Node audio::config::get_meters()
+{
+    return root["meters"];
+}
+
+// the recorder section is optional
+YAML::Node audio::config::get_recorder()
+{
+    return root["recorder"];
+}
 
-    if (new_buffer == nullptr) {
-        throw std::runtime_error("could not create new buffer because malloc failed");
+// the ptt section is optional
+YAML::Node audio::config::get_ptt()
+{
+    return root["ptt"];
+}
+
+std::string audio::config::get_plugin_cache()
+{
+    if (root["plugin_cache"]) {
+        return root["plugin_cache"].as<std::string>();
     }
 
-    return static_cast<audio::sample_type *>(new_buffer);
+    return plugin_cache::get_default_path();
+}
+
+// dbus_broker_in may be null in which case nothing is put on the bus
+audio::processor::processor(const std::string conf_file_path_in, std::shared_ptr<event::broker> broker_in, std::shared_ptr<dbus> dbus_broker_in, std::shared_ptr<modpro::backend> backend_in)
+: config(std::make_unique<audio::config>(conf_file_path_in)), broker(broker_in), dbus_broker(dbus_broker_in), audio_backend(backend_in)
+{
+
 }
 
-audio::processor::processor(const std::string conf_file_path_in, std::shared_ptr<event::broker> broker_in, std::shared_ptr<dbus> dbus_broker_in)
-: DBus::ObjectAdaptor(dbus_broker_in->connection, MODPRO_DBUS_PROCESSOR_PATH), config(conf_file_path_in), broker(broker_in), dbus_broker(dbus_broker_in)
+// the backend has stopped calling handle_process() by the time the
+// processor goes away so the graphs the audio thread owned are freed here
+audio::processor::~processor()
 {
+    // nothing can change the PTT state once the server is gone
+    ptt_input = nullptr;
+
+    if (reload_thread.joinable()) {
+        reload_thread.join();
+    }
+
+    if (metrics_thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(metrics_mutex);
+            metrics_stop = true;
+        }
+
+        metrics_wakeup.notify_all();
+        metrics_thread.join();
+    }
+
+    if (meter_thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(meter_mutex);
+            meter_stop = true;
+        }
 
+        meter_wakeup.notify_all();
+        meter_thread.join();
+    }
+
+    if (restart_thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(restart_mutex);
+            restart_stop = true;
+        }
+
+        restart_wakeup.notify_all();
+        restart_thread.join();
+    }
+
+    command next_command;
+    while(commands.pop(next_command)) {
+        delete next_command.graph_p;
+    }
+
+    delete unretired_graph;
+    delete active_graph;
+    reap();
 }
 
 void audio::processor::init()
@@ -91,240 +186,1732 @@ void audio::processor::init()
     assert(! initialized);
     assert(! activated);
 
-    init_jack();
+    auto start = timing::now();
+
+    init_backend();
+    // the graph compiled by init_dsp() needs the meter rate
+    init_meters();
+
+    // a render or benchmark runs next to the daemon so it leaves the PTT
+    // sockets, meter block, metrics file and recordings to it
+    if (audio_backend->is_realtime()) {
+        init_recorder();
+        init_ptt();
+    } else if (config->get_recorder() || config->get_ptt() || config->get_metrics() || meter_shm_name != "") {
+        std::cout << "Running offline: ignoring ptt, recorder, metrics and meters shm" << std::endl;
+        meter_shm_name = "";
+    }
+
     init_dsp();
+    init_workers();
+
+    if (audio_backend->is_realtime()) {
+        init_metrics();
+    }
 
     initialized = true;
+
+    std::cout << "Processor initialized in " << (timing::now() - start) / 1000000.0 << " ms" << std::endl;
 }
 
 // outside jack audio thread
-void audio::processor::init_jack()
+void audio::processor::init_backend()
 {
-    std::cout << "Initializing JACK audio" << std::endl;
+    std::cout << "Initializing audio" << std::endl;
 
-    jack = modpro::jackaudio::client::make("ModPro", this->shared_from_this());
-    jack->open();
+    audio_backend->open(this->shared_from_this());
 
-    for (auto i : config.get_routes()) {
+    for (auto i : config->get_routes()) {
         auto source = i[0].as<std::string>();
         auto dest = i[1].as<std::string>();
         std::cout << "  setting auto connect " << source << " -> " << dest << std::endl;
         set_auto_connect(source, dest);
     }
 
-    std::cout << "Jack is initialized" << std::endl;
-    std::cout << "  sample rate = " << jack->get_sample_rate() << std::endl;
-    std::cout << "  max buffer size = " << jack->get_buffer_size() << std::endl;
+    std::cout << "Audio is initialized" << std::endl;
+    std::cout << "  sample rate = " << audio_backend->get_sample_rate() << std::endl;
+    std::cout << "  max buffer size = " << audio_backend->get_buffer_size() << std::endl;
     std::cout << std::endl;
 }
 
 void audio::processor::init_dsp()
 {
+    auto memory_node = config->get_memory();
+
+    if (memory_node) {
+        use_huge_pages = memory_node["huge_pages"].as<bool>(use_huge_pages);
+        lock_memory = memory_node["lock"].as<bool>(lock_memory);
+    }
+
+    if (! audio_backend->is_realtime()) {
+        lock_memory = false;
+    }
+
+    effect_memory = make_arena();
+
     ladspa = modpro::ladspa::make();
-    for (auto i : config.get_plugins()) {
+    native = modpro::native::make();
+
+    auto cache_path = config->get_plugin_cache();
+    if (! cache_path.empty()) {
+        metadata_cache = plugin_cache::make(cache_path);
+        ladspa->set_cache(metadata_cache);
+    }
+
+    open_plugins(*config);
+    validate_chains(*config);
+
+    std::vector<effect_type> new_effects;
+    control_values controls;
+    // there is nothing to reuse the first time
+    control_batch reused_controls;
+
+    chains = build_chains(*config, new_effects, controls, reused_controls);
+    configured_controls = controls;
+    publish_chains(chains);
+
+    initial_graph = compile_graph();
+
+    std::cout << "DSP is initialized" << std::endl;
+    std::cout << std::endl;
+}
+
+// outside jack audio thread
+//
+// Only reads the metadata of each file; a library is loaded the first time
+// one of its types is instantiated so files with nothing in use never are.
+void audio::processor::open_plugins(audio::config & config_in)
+{
+    auto start = timing::now();
+    size_type opened = 0;
+
+    for (auto i : config_in.get_plugins()) {
+        if (plugin_files.count(i) != 0) {
+            continue;
+        }
+
         ladspa->open(i);
+        plugin_files.insert(i);
+        opened++;
+    }
+
+    if (metadata_cache != nullptr) {
+        metadata_cache->save();
+    }
+
+    if (opened > 0) {
+        std::cout << "Plugin metadata for " << opened << " files read in " << (timing::now() - start) / 1000000.0 << " ms" << std::endl;
+        std::cout << std::endl;
+    }
+}
+
+// outside jack audio thread
+//
+// Checks every type, control and port the chains use against the plugin
+// metadata so a mistake is reported before any plugin library is loaded.
+// Built in effects are only checked by name; they are cheap to instantiate
+// and build_chains() checks the rest.
+void audio::processor::validate_chains(audio::config & config_in)
+{
+    // network endpoints and the effect that has each one
+    std::map<std::string, std::string> endpoints;
+
+    for (auto i : config_in.get_chains()) {
+        auto chain_name = i.first.as<std::string>();
+        std::map<std::string, ladspa::type *> types;
+
+        auto check_port = [&](const std::string port_string_in, const bool is_input_in) {
+            auto effect_port = parse_effect_port_string(port_string_in);
+
+            if (types.count(effect_port.first) == 0) {
+                throw std::runtime_error("chain " + chain_name + " has no effect named " + effect_port.first);
+            }
+
+            auto type = types[effect_port.first];
+            if (type == nullptr) {
+                return;
+            }
+
+            if (! type->has_port(effect_port.second)) {
+                throw std::runtime_error(type->get_name() + " has no port named " + effect_port.second);
+            }
+
+            auto port = type->get_port(effect_port.second);
+            if (! port->is_audio() || port->is_input() != is_input_in) {
+                throw std::runtime_error(port_string_in + " is not an audio " + (is_input_in ? "input" : "output"));
+            }
+        };
+
+        for (auto j : i.second["effects"]) {
+            auto effect_name = j["name"].as<std::string>();
+            auto type_name = j["type"].as<std::string>();
+
+            if (native->has_type(type_name)) {
+                types[effect_name] = nullptr;
+
+                if (native->needs_options(type_name) && ! j["options"]) {
+                    throw std::runtime_error(chain_name + "." + effect_name + " needs options");
+                }
+
+                native::options_type options;
+                for (auto k : j["options"]) {
+                    options[k.first.as<std::string>()] = k.second.as<std::string>();
+                }
+
+                auto endpoint = netaudio::get_endpoint(type_name, options);
+                if (endpoint != "" && ! audio_backend->is_realtime()) {
+                    throw std::runtime_error(chain_name + "." + effect_name + " uses " + endpoint + " which is not available offline");
+                } else if (endpoint != "" && endpoints.count(endpoint) != 0) {
+                    throw std::runtime_error(chain_name + "." + effect_name + " uses the same " + endpoint + " as " + endpoints[endpoint]);
+                } else if (endpoint != "") {
+                    endpoints[endpoint] = chain_name + "." + effect_name;
+                }
+
+                continue;
+            }
+
+            if (j["options"]) {
+                throw std::runtime_error(type_name + " does not take options");
+            }
+
+            if (! ladspa->has_type(type_name)) {
+                throw std::runtime_error("unknown effect type for " + chain_name + "." + effect_name + ": " + type_name);
+            }
+
+            auto type = ladspa->get_type(type_name);
+            types[effect_name] = type;
+
+            for (auto k : j["controls"]) {
+                auto control_name = k.first.as<std::string>();
+
+                if (! type->has_port(control_name) || ! type->get_port(control_name)->is_control() || ! type->get_port(control_name)->is_input()) {
+                    throw std::runtime_error(type_name + " has no control input named " + control_name);
+                }
+            }
+        }
+
+        for (auto j : i.second["effects"]) {
+            auto effect_name = j["name"].as<std::string>();
+
+            for (auto k : j["wires"]) {
+                check_port(effect_name + "." + k.first.as<std::string>(), false);
+
+                for (auto l : k.second) {
+                    check_port((l.IsMap() ? l["to"] : l).as<std::string>(), true);
+                }
+            }
+        }
+
+        for (auto j : i.second["inputs"]) {
+            check_port(j.as<std::string>(), true);
+        }
+
+        for (auto j : i.second["outputs"]) {
+            check_port(j.as<std::string>(), false);
+        }
+
+        for (auto j : i.second["meters"]) {
+            auto effect_port = parse_effect_port_string(j.as<std::string>());
+
+            if (types.count(effect_port.first) == 0) {
+                throw std::runtime_error("chain " + chain_name + " has no effect named " + effect_port.first);
+            }
+
+            auto type = types[effect_port.first];
+            if (type != nullptr && ! type->has_port(effect_port.second)) {
+                throw std::runtime_error(type->get_name() + " has no port named " + effect_port.second);
+            }
+        }
     }
+}
+
+// outside jack audio thread
+//
+// Builds a new set of chains from the configuration without touching the
+// running ones. An effect with the same name and type as one in the current
+// chain of the same name is reused so it keeps its DSP state and only the
+// controls the configuration changed are written to it. Every other effect
+// is instantiated and handed back in new_effects_out to be activated.
+std::map<std::string, std::shared_ptr<modpro::chain>> audio::processor::build_chains(audio::config & config_in, std::vector<effect_type> & new_effects_out, control_values & controls_out, control_batch & reused_controls_out)
+{
+    std::map<std::string, std::shared_ptr<modpro::chain>> new_chains;
 
-    for (auto i : config.get_chains()) {
+    for (auto i : config_in.get_chains()) {
         auto chain_name = i.first.as<std::string>();
         auto chain_node = i.second;
         auto inputs_node = chain_node["inputs"];
         auto outputs_node = chain_node["outputs"];
         auto effects_node = chain_node["effects"];
+        std::shared_ptr<modpro::chain> old_chain;
         int port_num;
 
-        if (chains.count(chain_name) != 0) {
+        if (new_chains.count(chain_name) != 0) {
             throw std::runtime_error("attempt to register duplicate chain name: " + chain_name);
         }
 
+        if (chains.count(chain_name) != 0) {
+            old_chain = chains[chain_name];
+        }
+
         std::cout << "Creating new chain: " << chain_name << std::endl;
-        auto new_chain = std::make_shared<modpro::chain>(chain_name, dbus_broker);
-        chains[chain_name] = new_chain;
+        auto new_chain = std::make_shared<modpro::chain>(chain_name);
+        new_chains[chain_name] = new_chain;
+
+        if (chain_node["active_on"]) {
+            new_chain->active_on = modpro::chain::parse_activity(chain_node["active_on"].as<std::string>());
+            new_chain->restart_effects = chain_node["restart_effects"].as<bool>(false);
+            std::cout << "  active on: " << chain_node["active_on"].as<std::string>() << std::endl;
+        }
+
+        if (chain_node["silence"]) {
+            auto silence_node = chain_node["silence"];
+            auto threshold_db = silence_node["threshold"].as<double>(-90);
+
+            new_chain->silence_threshold = pow(10, threshold_db / 20);
+            new_chain->silence_hold = silence_node["hold"].as<double>();
+            std::cout << "  suspended after " << new_chain->silence_hold << " seconds below " << threshold_db << " dBFS" << std::endl;
+        }
+
+        if (chain_node["internal_rate"]) {
+            new_chain->internal_rate = chain_node["internal_rate"].as<size_type>();
+            std::cout << "  internal rate: " << new_chain->internal_rate.load() << std::endl;
+        }
+
+        // throws now if the internal rate does not fit the backend
+        auto chain_rate = audio_backend->get_sample_rate() / new_chain->get_rate_factor(audio_backend->get_sample_rate());
+
+        // effects made for another rate can not be reused
+        if (old_chain != nullptr && old_chain->internal_rate.load() != new_chain->internal_rate.load()) {
+            old_chain = nullptr;
+        }
 
         for (auto j : effects_node) {
             auto effect_name = j["name"].as<std::string>();
             auto effect_type_name = j["type"].as<std::string>();
+            auto dbus_path = make_effect_dbus_path(chain_name, effect_name);
+            auto& effect_controls = controls_out[dbus_path];
+            std::map<std::string, data_type> old_controls;
+            native::options_type effect_options;
+            bool reused = false;
+            effect_type effect;
+
+            for (auto k : j["options"]) {
+                effect_options[k.first.as<std::string>()] = k.second.as<std::string>();
+            }
 
-            std::string dbus_path(modpro::chain::make_dbus_path(chain_name));
-            dbus_path += "/";
-            dbus_path += effect_name;
+            // an effect with different options talks to something else
+            if (old_chain != nullptr && old_chain->effect_instances.count(effect_name) != 0 && old_chain->get_effect(effect_name)->get_name() == effect_type_name && get_effect_options(old_chain->get_effect(effect_name)) == effect_options) {
+                std::cout << "  reusing effect: " << effect_name << " = " << effect_type_name << std::endl;
+                effect = old_chain->get_effect(effect_name);
+                reused = true;
 
-            std::cout << "  creating new effect: " << effect_name << " = " << effect_type_name << std::endl;
-            auto effect = make_effect(effect_type_name, dbus_path, dbus_broker);
+                if (configured_controls.count(dbus_path) != 0) {
+                    old_controls = configured_controls[dbus_path];
+                }
+            } else {
+                std::cout << "  creating new effect: " << effect_name << " = " << effect_type_name << std::endl;
+                effect = make_effect(effect_type_name, chain_rate, effect_options);
+                new_effects_out.push_back(effect);
+            }
 
             for (auto k : j["controls"]) {
                 auto control_name = k.first.as<std::string>();
                 auto control_value = k.second.as<audio::data_type>();
+
+                effect_controls[control_name] = control_value;
+
+                // a control the file did not change keeps any value it was
+                // given over DBus
+                if (old_controls.count(control_name) != 0 && old_controls[control_name] == control_value) {
+                    continue;
+                }
+
                 std::cout << "    setting control: " << control_name << " = " << control_value << std::endl;
-                effect->set_control(control_name, control_value);
+
+                if (! reused) {
+                    effect->set_control(control_name, control_value);
+                } else {
+                    // the effect may be running so the change waits until
+                    // the whole configuration is known to be good
+                    reused_controls_out.entries.push_back({ effect.get(), effect->get_port_id(control_name), control_value });
+                }
+            }
+
+            if (j["tail"]) {
+                new_chain->tails[effect_name] = j["tail"].as<double>();
             }
 
             new_chain->add_effect(effect_name, effect);
         }
 
         port_num = 0;
-        for (auto k : chain_node["inputs"]) {
+        for (auto k : inputs_node) {
             port_num++;
             auto port_name = chain_name + "_in_" + std::to_string(port_num);
-            std::cout << "  creating JACK input port: " << port_name << std::endl;
-            auto new_jack_port = jack->add_audio_input(port_name);
-            new_chain->add_route(k.as<std::string>(), new_jack_port);
+            new_chain->add_route(k.as<std::string>(), get_audio_port(port_name, true), true);
         }
 
         port_num = 0;
-        for (auto k : chain_node["outputs"]) {
+        for (auto k : outputs_node) {
             port_num++;
             auto port_name = chain_name + "_out_" + std::to_string(port_num);
-            std::cout << "  creating JACK output port: " << port_name << std::endl;
-            auto new_jack_port = jack->add_audio_output(port_name);
-            new_chain->add_route(k.as<std::string>(), new_jack_port);
+            new_chain->add_route(k.as<std::string>(), get_audio_port(port_name, false), false);
         }
 
         for (auto j : effects_node) {
             auto effect_name = j["name"].as<std::string>();
-            auto src_effect = new_chain->get_effect(effect_name);
 
             for (auto k : j["wires"]) {
-                auto buf = make_buffer();
                 auto src_port_name = k.first.as<std::string>();
 
-                src_effect->connect(src_port_name, buf);
-
                 for (auto l : k.second) {
-                    auto dest = parse_effect_port_string(l.as<std::string>());
-                    std::cout << "  wiring " << effect_name << "." << src_port_name << " to " << dest.first << "." << dest.second << std::endl;
-                    auto dest_effect = new_chain->get_effect(dest.first);
-                    dest_effect->connect(dest.second, buf);
+                    // either "effect.port" or { to: effect.port, gain: N }
+                    // when the wire is summed into the port with a gain
+                    auto dest_node = l.IsMap() ? l["to"] : l;
+                    auto gain = l.IsMap() && l["gain"] ? l["gain"].as<audio::data_type>() : 1;
+                    auto dest = parse_effect_port_string(dest_node.as<std::string>());
+
+                    std::cout << "  wiring " << effect_name << "." << src_port_name << " to " << dest.first << "." << dest.second;
+                    if (gain != 1) {
+                        std::cout << " with gain " << gain;
+                    }
+                    std::cout << std::endl;
+
+                    new_chain->add_wire(effect_name, src_port_name, dest.first, dest.second, gain);
                 }
             }
         }
 
+        for (auto j : chain_node["meters"]) {
+            std::cout << "  metering " << j.as<std::string>() << std::endl;
+            new_chain->meters.push_back(j.as<std::string>());
+        }
+
+        new_chain->schedule();
+
         std::cout << std::endl;
     }
 
-    std::cout << "DSP is initialized" << std::endl;
-    std::cout << std::endl;
+    return new_chains;
 }
 
-// outside of jack audio thread
-void audio::processor::start()
+// outside jack audio thread
+std::shared_ptr<modpro::backend::audio_port> audio::processor::get_audio_port(const std::string name_in, const bool is_input_in)
 {
-    std::cout << "Starting audio processing" << std::endl;
-    auto jack_lock = jack->get_lock();
-    assert(initialized);
-    assert(! activated);
+    auto existing = audio_ports[name_in].lock();
 
-    for (auto i : chains) {
-        std::cout << "  Activating chain " << i.first << std::endl;
-        i.second->activate();
+    if (existing != nullptr) {
+        return existing;
     }
 
-    activated = true;
-    jack_lock.unlock();
+    std::shared_ptr<modpro::backend::audio_port> new_port;
 
-    jack->activate();
-    check_auto_connect();
+    if (is_input_in) {
+        std::cout << "  creating JACK input port: " << name_in << std::endl;
+        new_port = audio_backend->add_audio_input(name_in);
+    } else {
+        std::cout << "  creating JACK output port: " << name_in << std::endl;
+        new_port = audio_backend->add_audio_output(name_in);
+    }
 
-    broker->send_event(event::name::audio_started);
+    audio_ports[name_in] = new_port;
+    return new_port;
 }
 
-void audio::processor::set_auto_connect(const std::string source_in, const std::string dest_in)
+// outside jack audio thread
+//
+// Points the DBus objects at the given chains and their effects. Objects
+// are kept for every path that still exists so clients holding a path are
+// not disturbed; objects for chains and effects that went away are
+// released which removes them from the bus.
+void audio::processor::publish_chains(const std::map<std::string, std::shared_ptr<modpro::chain>> & chains_in)
 {
-    auto_connect[source_in].push_back(dest_in);
-}
+    if (dbus_broker == nullptr) {
+        return;
+    }
 
-// inside jack audio thread - jack is already locked
-void audio::processor::handle_shutdown()
-{
-    broker->send_event(event::name::audio_stopped);
-}
+    std::map<std::string, std::shared_ptr<modpro::chain_object>> new_chain_objects;
+    std::map<std::string, std::shared_ptr<modpro::effect_object>> new_effect_objects;
 
-void audio::processor::check_auto_connect()
-{
-    for(auto client_port : jack->get_known_port_names()) {
-        if (auto_connect.count(client_port) > 0) {
-            for (auto destination : auto_connect[client_port] ) {
-                std::cout << "Auto connect: " << client_port << " -> " << destination << std::endl;
-                auto result = jack->connect_port(client_port, destination);
-                if (result != 0 && result != EEXIST) {
-                    std::cout << "Error trying to connect ports: " << client_port << " -> " << destination << std::endl;
-                }
+    for (auto& i : chains_in) {
+        auto chain_object = chain_objects.find(i.first);
+
+        if (chain_object != chain_objects.end()) {
+            chain_object->second->set_target(i.second);
+            new_chain_objects[i.first] = chain_object->second;
+        } else {
+            new_chain_objects[i.first] = std::make_shared<modpro::chain_object>(dbus_broker, i.second);
+        }
+
+        for (auto& j : i.second->effect_instances) {
+            auto dbus_path = make_effect_dbus_path(i.first, j.first);
+            auto effect_object = effect_objects.find(dbus_path);
+
+            if (effect_object != effect_objects.end()) {
+                effect_object->second->set_target(j.second);
+                new_effect_objects[dbus_path] = effect_object->second;
+            } else {
+                new_effect_objects[dbus_path] = std::make_shared<modpro::effect_object>(dbus_path, dbus_broker, j.second, [this, dbus_path](const std::string & name_in) -> void {
+                    note_written_control(dbus_path, name_in);
+                });
             }
         }
     }
-}
 
-void audio::processor::handle_client_register(const std::string client_name_in)
-{
-    // broker->send_event(event::name::audio_client_change);
-}
+    chain_objects = new_chain_objects;
+    effect_objects = new_effect_objects;
 
-void audio::processor::handle_client_unregister(const std::string client_name_in)
-{
-    // broker->send_event(event::name::audio_client_change);
+    std::unique_lock<std::mutex> lock(changes_mutex);
+    signal_objects = effect_objects;
 }
 
-void audio::processor::handle_port_register(const uint32_t port_id_in)
+void audio::processor::init_workers()
 {
-    broker->send_event(event::name::audio_client_change);
+    auto workers_node = config->get_workers();
+
+    // workers exist to meet a realtime deadline; offline backends get their
+    // parallelism by running several of them at once instead
+    if (! workers_node || ! audio_backend->is_realtime()) {
+        return;
+    }
+
+    auto num_threads = workers_node["threads"].as<size_t>(0);
+    auto priority = workers_node["priority"].as<int>(audio_backend->get_realtime_priority());
+    std::vector<int> cpus;
+
+    for (auto i : workers_node["cpus"]) {
+        cpus.push_back(i.as<int>());
+    }
+
+    if (num_threads == 0) {
+        return;
+    }
+
+    std::cout << "Creating " << num_threads << " realtime worker threads with priority " << priority << std::endl;
+    workers = std::make_unique<modpro::worker_pool>(num_threads, cpus, priority);
+    std::cout << std::endl;
 }
 
-void audio::processor::handle_port_unregister(const uint32_t port_id_in)
+void audio::processor::init_metrics()
 {
-    // broker->send_event(event::name::audio_client_change);
+    auto metrics_node = config->get_metrics();
+
+    if (! metrics_node) {
+        return;
+    }
+
+    metrics_path = metrics_node["file"].as<std::string>("");
+    metrics_interval = metrics_node["interval"].as<double>(metrics_interval);
+
+    if (metrics_interval <= 0) {
+        throw std::runtime_error("metrics interval must be greater than 0");
+    }
 }
 
-// inside jack audio thread - jack is already locked
-void audio::processor::handle_process(modpro::jackaudio::nframes_type nframes)
+void audio::processor::init_meters()
 {
-    assert(initialized);
-    assert(activated);
+    auto meters_node = config->get_meters();
 
-    for(auto chain_entry : chains) {
-        auto chain = chain_entry.second;
-        for(auto i : chain->get_routes()) {
-            auto effect_port = parse_effect_port_string(i.first);
-            auto effect = chain->get_effect(effect_port.first);
-            effect->connect(effect_port.second, i.second->get_buffer(nframes));
-        }
+    if (! meters_node) {
+        return;
+    }
 
-        chain->run(nframes);
+    meter_rate = meters_node["rate"].as<double>(meter_rate);
+    meter_shm_name = meters_node["shm"].as<std::string>("");
 
-        // JACK does not gurantee buffers wont change between calls to the
-        // process handler
-        for(auto i : chain->get_routes()) {
-            auto effect_port = parse_effect_port_string(i.first);
-            auto effect = chain->get_effect(effect_port.first);
-            effect->disconnect(effect_port.second);
-        }
+    if (meter_rate <= 0) {
+        throw std::runtime_error("meter rate must be greater than 0");
     }
 
-    broker->send_event(event::name::audio_processed);
+    if (meter_shm_name != "" && audio_backend->is_realtime()) {
+        meter_block = meter_shm::make(meter_shm_name);
+    }
 }
 
-// inside jack audio thread - jack is already locked
-void audio::processor::handle_sample_rate_change(modpro::jackaudio::nframes_type sample_rate_in)
+void audio::processor::init_recorder()
 {
-    throw std::runtime_error("unable to handle sample rate change");
-}
+    auto recorder_node = config->get_recorder();
 
-// inside jack audio thread - jack is already locked
-void audio::processor::handle_buffer_size_change(modpro::jackaudio::nframes_type buffer_size_in)
-{
-    throw std::runtime_error("unable to change maximum buffer size");
-}
+    if (! recorder_node) {
+        return;
+    }
 
-audio::processor::effect_type audio::processor::make_effect(const std::string name_in, const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in)
-{
-    auto new_effect = ladspa->instantiate(name_in, jack->get_sample_rate(), dbus_path_in, dbus_broker);
-    return new_effect;
+    auto directory = recorder_node["directory"].as<std::string>();
+    auto format = recorder::parse_format(recorder_node["format"].as<std::string>("wav"));
+    auto rotate_seconds = recorder_node["rotate"].as<double>(0);
+    auto direct_io = recorder_node["direct_io"].as<bool>(true);
+    auto buffer_seconds = recorder_node["buffer"].as<double>(2);
+
+    rotate_on_ptt = recorder_node["rotate_on_ptt"].as<bool>(false);
+
+    disk_recorder = recorder::make(directory, format, rotate_seconds, direct_io, buffer_seconds);
+
+    // every recording has its own stream with a single writer and its own
+    // files so a name can only be used once
+    std::set<std::string> names;
+
+    for (auto i : recorder_node["streams"]) {
+        auto name = i["name"].as<std::string>();
+
+        if (! names.insert(name).second) {
+            throw std::runtime_error("attempt to register duplicate recording name: " + name);
+        }
+
+        recordings.push_back({ name, i["chain"].as<std::string>(), i["port"].as<std::string>() });
+    }
 }
 
-audio::sample_type * audio::processor::make_buffer()
+void audio::processor::init_ptt()
 {
-    auto new_buffer = modpro::audio::make_buffer(jack->get_buffer_size());
-    buffers.push_back(new_buffer);
-    return new_buffer;
+    auto ptt_node = config->get_ptt();
+
+    if (! ptt_node) {
+        return;
+    }
+
+    ptt_unix_path = ptt_node["unix"].as<std::string>("");
+    ptt_tcp_address = ptt_node["tcp"].as<std::string>("");
+}
+
+// outside jack audio thread
+//
+// The state is flipped before anything else so the next period sees it
+// whatever else the processor is busy with.
+void audio::processor::set_ptt(const bool transmitting_in)
+{
+    if (transmitting.exchange(transmitting_in) == transmitting_in) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(restart_mutex);
+
+        if (! restart_thread.joinable()) {
+            restart_thread = std::thread([this]() -> void {
+                std::unique_lock<std::mutex> lock(restart_mutex);
+
+                while(! restart_stop) {
+                    restart_wakeup.wait(lock, [this] { return restart_requested || restart_stop; });
+
+                    if (! restart_stop) {
+                        restart_requested = false;
+                        lock.unlock();
+                        restart_stopped_chains();
+                        lock.lock();
+                    }
+                }
+            });
+        }
+
+        restart_requested = true;
+    }
+
+    restart_wakeup.notify_all();
+
+    std::cout << "PTT " << (transmitting_in ? "on" : "off") << std::endl;
+
+    if (rotate_on_ptt) {
+        rotate_recordings();
+    }
+}
+
+// on the restart thread
+//
+// A chain that PTT is stopping is given up to ptt_restart_timeout_ns to
+// finish its last block; one that silence had already suspended was not
+// running to be stopped. The graph does not run a chain
+// while restart_pending is set so nothing else touches its effects.
+void audio::processor::restart_stopped_chains()
+{
+    std::unique_lock<std::mutex> lock(dsp_mutex);
+
+    for (auto& i : chains) {
+        auto chain = i.second;
+
+        if (! chain->restart_effects) {
+            continue;
+        }
+
+        auto give_up = timing::now() + ptt_restart_timeout_ns;
+
+        while(! chain->restart_pending.load(std::memory_order_acquire) && chain->suspended.load(std::memory_order_acquire) == modpro::chain::not_suspended && ! chain->is_active(transmitting.load())) {
+            if (timing::now() >= give_up) {
+                std::cout << "PTT: chain " << i.first << " did not stop so its effects were not restarted" << std::endl;
+                break;
+            }
+
+            {
+                std::unique_lock<std::mutex> stop_lock(restart_mutex);
+
+                if (restart_stop) {
+                    return;
+                }
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        if (chain->restart_pending.load(std::memory_order_acquire)) {
+            chain->restart();
+            chain->restart_pending.store(false, std::memory_order_release);
+        }
+    }
+}
+
+bool audio::processor::get_ptt()
+{
+    return transmitting.load();
+}
+
+void audio::processor::rotate_recordings()
+{
+    if (disk_recorder != nullptr) {
+        disk_recorder->rotate();
+    }
+}
+
+std::map<std::string, double> audio::processor::get_recorder_stats()
+{
+    if (disk_recorder == nullptr) {
+        return {};
+    }
+
+    return disk_recorder->get_stats();
+}
+
+// on the meter thread with meter_mutex held
+void audio::processor::publish_meters()
+{
+    if (meter_readings == nullptr || meter_readings->size() == 0) {
+        return;
+    }
+
+    auto readings = meter_readings->read();
+
+    if (meter_block != nullptr) {
+        meter_block->write(readings);
+    }
+
+    if (meter_listener) {
+        meter_listener(readings);
+    }
+}
+
+std::vector<meter_bank::reading> audio::processor::read_meters()
+{
+    std::unique_lock<std::mutex> lock(meter_mutex);
+
+    if (meter_readings == nullptr) {
+        return {};
+    }
+
+    return meter_readings->read();
+}
+
+void audio::processor::set_meter_handler(meter_handler handler_in)
+{
+    std::unique_lock<std::mutex> lock(meter_mutex);
+    meter_listener = handler_in;
+}
+
+void audio::processor::note_written_control(const std::string & path_in, const std::string & name_in)
+{
+    std::unique_lock<std::mutex> lock(changes_mutex);
+    written_controls.insert(std::make_pair(path_in, name_in));
+}
+
+// values come from the snapshot every effect keeps for other threads
+audio::processor::control_list audio::processor::take_written_controls()
+{
+    std::unique_lock<std::mutex> lock(changes_mutex);
+    control_list retval;
+
+    for (auto& i : written_controls) {
+        auto object = signal_objects.find(i.first);
+
+        // the effect went away in a reload
+        if (object == signal_objects.end()) {
+            continue;
+        }
+
+        try {
+            retval.push_back(std::make_tuple(i.first, i.second, double(object->second->get_target()->get_control(i.second))));
+        } catch (std::exception & e) {
+            continue;
+        }
+    }
+
+    written_controls.clear();
+
+    return retval;
+}
+
+audio::processor::control_list audio::processor::read_output_controls()
+{
+    std::unique_lock<std::mutex> lock(changes_mutex);
+    control_list retval;
+
+    for (auto& i : signal_objects) {
+        auto target = i.second->get_target();
+        auto input_names = target->get_input_control_names();
+
+        for (auto& j : target->get_control_names()) {
+            if (std::find(input_names.begin(), input_names.end(), j) == input_names.end()) {
+                retval.push_back(std::make_tuple(i.first, j, double(target->get_control(j))));
+            }
+        }
+    }
+
+    return retval;
+}
+
+double audio::processor::get_signal_interval()
+{
+    auto dbus_node = config->get_dbus();
+
+    if (dbus_node && dbus_node["signal_interval"]) {
+        return dbus_node["signal_interval"].as<double>();
+    }
+
+    return signal_interval;
+}
+
+// on the metrics thread; the file is replaced in one step so a scraper
+// never sees half of it
+void audio::processor::write_metrics()
+{
+    std::map<std::string, double> extra;
+    std::vector<metrics::labeled_sample> labeled;
+    extra["dsp_load_ratio"] = audio_backend->get_dsp_load() / 100;
+
+    {
+        std::unique_lock<std::mutex> lock(dsp_mutex);
+
+        for (auto& i : chains) {
+            labeled.push_back({ "chain_suspended_seconds_total", "counter", { { "chain", i.first }, { "reason", "ptt" } }, i.second->ptt_suspended_ns.load() / 1e9 });
+            labeled.push_back({ "chain_suspended_seconds_total", "counter", { { "chain", i.first }, { "reason", "silence" } }, i.second->silence_suspended_ns.load() / 1e9 });
+        }
+    }
+
+    auto temp_path = metrics_path + ".tmp";
+    std::ofstream out(temp_path);
+    out << audio_metrics.get_prometheus(extra, labeled);
+    out.close();
+
+    if (! out || rename(temp_path.c_str(), metrics_path.c_str())) {
+        std::cout << "Could not write metrics to " << metrics_path << std::endl;
+    }
+}
+
+// outside of jack audio thread
+void audio::processor::start()
+{
+    std::cout << "Starting audio processing" << std::endl;
+    assert(initialized);
+    assert(! activated);
+
+    // the process callback can not run before the backend is activated so the
+    // plugins are wired up and activated here instead of from inside the
+    // audio thread
+    initial_graph->bind();
+
+    if (lock_memory) {
+        effect_memory->lock();
+        initial_graph->memory->lock();
+        std::cout << "  Locked " << arena::get_total_locked() << " bytes of audio memory" << std::endl;
+    }
+
+    for (auto i : chains) {
+        std::cout << "  Activating chain " << i.first << std::endl;
+        i.second->activate();
+    }
+
+    if (workers != nullptr) {
+        workers->start();
+    }
+
+    if (metrics_path != "") {
+        std::cout << "  Writing metrics to " << metrics_path << " every " << metrics_interval << " seconds" << std::endl;
+
+        metrics_thread = std::thread([this]() -> void {
+            std::unique_lock<std::mutex> lock(metrics_mutex);
+
+            while(! metrics_stop) {
+                metrics_wakeup.wait_for(lock, std::chrono::duration<double>(metrics_interval));
+
+                if (! metrics_stop) {
+                    write_metrics();
+                }
+            }
+        });
+    }
+
+    if (disk_recorder != nullptr) {
+        std::cout << "  Starting the recorder with " << recordings.size() << " streams" << std::endl;
+        disk_recorder->start();
+    }
+
+    if (ptt_unix_path != "" || ptt_tcp_address != "") {
+        ptt_input = ptt_server::make(ptt_unix_path, ptt_tcp_address, [this](const bool transmitting_in) -> void {
+            set_ptt(transmitting_in);
+        }, [this]() -> bool {
+            return get_ptt();
+        });
+    }
+
+    start_meters();
+
+    send_command({ command::activate, initial_graph.release() });
+    activated = true;
+
+    audio_backend->activate();
+    check_auto_connect();
+
+    broker->send_event(event::name::audio_started);
+}
+
+// outside jack audio thread
+//
+// There is only a thread once there is something to publish; a reload that
+// adds the first meters starts it then.
+void audio::processor::start_meters()
+{
+    if (meter_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(meter_mutex);
+
+        if (meter_readings == nullptr || meter_readings->size() == 0) {
+            return;
+        }
+    }
+
+    std::cout << "  Publishing meters " << meter_rate << " times a second";
+    if (meter_block != nullptr) {
+        std::cout << " to " << meter_shm_name;
+    }
+    std::cout << std::endl;
+
+    meter_thread = std::thread([this]() -> void {
+        std::unique_lock<std::mutex> lock(meter_mutex);
+
+        while(! meter_stop) {
+            meter_wakeup.wait_for(lock, std::chrono::duration<double>(1 / meter_rate));
+
+            if (! meter_stop) {
+                publish_meters();
+            }
+        }
+    });
+}
+
+void audio::processor::set_auto_connect(const std::string source_in, const std::string dest_in)
+{
+    auto_connect[source_in].push_back(dest_in);
+}
+
+// inside jack audio thread - jack is already locked
+void audio::processor::handle_shutdown()
+{
+    broker->send_event(event::name::audio_stopped);
+}
+
+void audio::processor::check_auto_connect()
+{
+    std::unique_lock<std::mutex> lock(dsp_mutex);
+
+    for(auto client_port : audio_backend->get_known_port_names()) {
+        if (auto_connect.count(client_port) > 0) {
+            for (auto destination : auto_connect[client_port] ) {
+                std::cout << "Auto connect: " << client_port << " -> " << destination << std::endl;
+                auto result = audio_backend->connect_port(client_port, destination);
+                if (result != 0 && result != EEXIST) {
+                    std::cout << "Error trying to connect ports: " << client_port << " -> " << destination << std::endl;
+                }
+            }
+        }
+    }
+}
+
+std::map<std::string, double> audio::processor::get_process_time()
+{
+    return audio_metrics.process_time.get_summary();
+}
+
+void audio::processor::reset_process_time()
+{
+    audio_metrics.process_time.reset();
+}
+
+std::map<std::string, double> audio::processor::get_metrics()
+{
+    auto retval = audio_metrics.get_summary();
+    retval["dsp_load_percent"] = audio_backend->get_dsp_load();
+    return retval;
+}
+
+std::vector<double> audio::processor::get_xrun_times()
+{
+    return audio_metrics.get_xrun_times();
+}
+
+void audio::processor::reset_metrics()
+{
+    audio_metrics.reset();
+}
+
+// outside jack audio thread - dsp_mutex must be held; once the backend is
+// running the batch is handed to the audio thread and this waits for it
+void audio::processor::run_batch(std::unique_ptr<control_batch> & batch_in)
+{
+    auto start = timing::now();
+
+    if (! activated) {
+        for (auto& i : batch_in->entries) {
+            if (batch_in->is_write) {
+                i.target->set_control(i.port, i.value);
+            } else {
+                i.value = i.target->get_control(i.port);
+            }
+        }
+
+        return;
+    }
+
+    // batches the audio thread was late for are finished by now
+    for (auto i = abandoned_batches.begin(); i != abandoned_batches.end();) {
+        if ((*i)->done.load(std::memory_order_acquire)) {
+            i = abandoned_batches.erase(i);
+        } else {
+            i++;
+        }
+    }
+
+    send_command({ command::run_batch, nullptr, batch_in.get() });
+
+    while(! batch_in->done.load(std::memory_order_acquire)) {
+        if (timing::now() - start > batch_timeout_ns) {
+            abandoned_batches.push_back(std::move(batch_in));
+            throw DBus::Error("hamradio.modpro.errors.Timeout", "audio thread did not run the control batch");
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void audio::processor::write_many(const control_list & controls_in)
+{
+    std::unique_lock<std::mutex> lock(dsp_mutex);
+    auto batch = std::make_unique<control_batch>();
+
+    batch->is_write = true;
+
+    for (auto& i : controls_in) {
+        auto object = effect_objects.find(std::get<0>(i));
+
+        if (object == effect_objects.end()) {
+            throw DBus::Error("hamradio.modpro.errors.EffectUnknown", ("unknown effect: " + std::get<0>(i)).c_str());
+        }
+
+        auto target = object->second->get_target();
+        auto input_names = target->get_input_control_names();
+
+        if (std::find(input_names.begin(), input_names.end(), std::get<1>(i)) == input_names.end()) {
+            throw DBus::Error("hamradio.modpro.errors.ControlNameUnknown", ("unknown control name: " + std::get<1>(i)).c_str());
+        }
+
+        batch->entries.push_back({ target.get(), target->get_port_id(std::get<1>(i)), data_type(std::get<2>(i)) });
+    }
+
+    run_batch(batch);
+
+    for (auto& i : controls_in) {
+        note_written_control(std::get<0>(i), std::get<1>(i));
+    }
+}
+
+audio::processor::control_list audio::processor::read_snapshot()
+{
+    std::unique_lock<std::mutex> lock(dsp_mutex);
+    auto batch = std::make_unique<control_batch>();
+    std::vector<std::pair<std::string, std::string>> names;
+    control_list retval;
+
+    batch->is_write = false;
+
+    for (auto& i : effect_objects) {
+        auto target = i.second->get_target();
+
+        for (auto& j : target->get_control_names()) {
+            batch->entries.push_back({ target.get(), target->get_port_id(j), 0 });
+            names.push_back({ i.first, j });
+        }
+    }
+
+    run_batch(batch);
+
+    for (size_t i = 0; i < names.size(); i++) {
+        retval.push_back(std::make_tuple(names[i].first, names[i].second, batch->entries[i].value));
+    }
+
+    return retval;
+}
+
+std::map<std::string, double> audio::processor::get_memory_usage()
+{
+    std::map<std::string, double> retval;
+
+    retval["arena_bytes"] = arena::get_total_size();
+    retval["used_bytes"] = arena::get_total_used();
+    retval["locked_bytes"] = arena::get_total_locked();
+
+    return retval;
+}
+
+void audio::processor::handle_client_register(const std::string client_name_in)
+{
+    // broker->send_event(event::name::audio_client_change);
+}
+
+void audio::processor::handle_client_unregister(const std::string client_name_in)
+{
+    // broker->send_event(event::name::audio_client_change);
+}
+
+void audio::processor::handle_port_register(const uint32_t port_id_in)
+{
+    broker->send_event(event::name::audio_client_change);
+}
+
+void audio::processor::handle_port_unregister(const uint32_t port_id_in)
+{
+    // broker->send_event(event::name::audio_client_change);
+}
+
+// outside jack audio thread
+void audio::processor::send_command(const command & command_in)
+{
+    if (! commands.push(command_in)) {
+        throw std::runtime_error("audio command queue is full");
+    }
+}
+
+// outside jack audio thread
+void audio::processor::swap_graph(std::unique_ptr<modpro::graph> graph_in)
+{
+    if (lock_memory) {
+        effect_memory->lock();
+        graph_in->memory->lock();
+    }
+
+    send_command({ command::swap_graph, graph_in.release() });
+}
+
+// outside jack audio thread
+void audio::processor::reap()
+{
+    modpro::graph * retired;
+
+    while(retired_graphs.pop(retired)) {
+        delete retired;
+    }
+}
+
+// inside jack audio thread
+bool audio::processor::retire_graph(modpro::graph * graph_in)
+{
+    assert(unretired_graph == nullptr);
+
+    if (graph_in == nullptr) {
+        return true;
+    }
+
+    if (retired_graphs.push(graph_in)) {
+        broker->send_event(event::name::graph_retired);
+        return true;
+    }
+
+    // try again next period instead of blocking
+    unretired_graph = graph_in;
+    return false;
+}
+
+// inside jack audio thread
+void audio::processor::run_commands()
+{
+    if (unretired_graph != nullptr) {
+        auto graph = unretired_graph;
+        unretired_graph = nullptr;
+
+        if (! retire_graph(graph)) {
+            return;
+        }
+    }
+
+    command next_command;
+
+    while(commands.pop(next_command)) {
+        switch(next_command.type) {
+            case command::activate:
+                assert(active_graph == nullptr);
+                active_graph = next_command.graph_p;
+                active_graph->bind();
+                break;
+            case command::run_batch: {
+                auto batch = next_command.batch_p;
+
+                for (auto& i : batch->entries) {
+                    if (batch->is_write) {
+                        i.target->set_control(i.port, i.value);
+                    } else {
+                        i.value = i.target->get_control(i.port);
+                    }
+                }
+
+                batch->done.store(true, std::memory_order_release);
+                break;
+            }
+            case command::swap_graph: {
+                auto old_graph = active_graph;
+                active_graph = next_command.graph_p;
+                active_graph->bind();
+
+                if (! retire_graph(old_graph)) {
+                    return;
+                }
+
+                break;
+            }
+        }
+    }
+}
+
+// inside jack audio thread
+void audio::processor::handle_process(modpro::backend::nframes_type nframes)
+{
+    auto start = timing::now();
+
+    run_commands();
+
+    if (active_graph == nullptr) {
+        return;
+    }
+
+    active_graph->run(nframes, workers.get(), transmitting.load(std::memory_order_relaxed));
+
+    auto budget = timing::ns_type(nframes) * 1000000000 / audio_backend->get_sample_rate();
+    audio_metrics.record_period(timing::now() - start, active_graph->get_plugin_time(), budget);
+}
+
+// called by JACK when a period was missed; may be inside jack audio thread
+void audio::processor::handle_xrun()
+{
+    audio_metrics.record_xrun();
+}
+
+// called by JACK when the engine sample rate changes - jack is already
+// locked
+void audio::processor::handle_sample_rate_change(modpro::backend::nframes_type sample_rate_in)
+{
+    // plugins have to be instantiated again which is far too slow to do
+    // here so it happens in the main loop while the current graph runs on
+    event sample_rate_event;
+    sample_rate_event.type = event::name::sample_rate_change;
+    sample_rate_event.payload.number = sample_rate_in;
+    broker->send_event(sample_rate_event);
+}
+
+// called by JACK before the first period with the new size - jack is
+// already locked
+void audio::processor::handle_buffer_size_change(modpro::backend::nframes_type buffer_size_in)
+{
+    // the current graph handles larger periods by running in pieces so the
+    // reallocation can happen in the main loop
+    event buffer_size_event;
+    buffer_size_event.type = event::name::buffer_size_change;
+    buffer_size_event.payload.number = buffer_size_in;
+    broker->send_event(buffer_size_event);
+}
+
+// outside jack audio thread
+void audio::processor::rebuild_graph()
+{
+    std::unique_lock<std::mutex> lock(dsp_mutex);
+    std::cout << "Rebuilding audio graph for buffer size " << audio_backend->get_buffer_size() << std::endl;
+    swap_graph(compile_graph());
+}
+
+// outside jack audio thread
+//
+// Every effect is instantiated again at the new rate and activated before
+// it is published so the audio thread only ever sees a finished graph. The
+// old instances keep running until the swap and are cleaned up when the
+// graph that uses them is reaped.
+void audio::processor::change_sample_rate(const size_type sample_rate_in)
+{
+    std::unique_lock<std::mutex> lock(dsp_mutex);
+    std::cout << "Instantiating effects for sample rate " << sample_rate_in << std::endl;
+
+    auto start = timing::now();
+    std::vector<effect_type> new_effects;
+
+    // a chain that can not run at its internal rate any more runs at the
+    // new rate until the configuration is reloaded instead of stopping
+    // everything
+    for (auto& i : chains) {
+        if (! i.second->is_rate_usable(sample_rate_in)) {
+            std::cout << "  internal rate " << i.second->internal_rate.load() << " of chain " << i.first << " does not divide " << sample_rate_in << "; running it at " << sample_rate_in << std::endl;
+            i.second->internal_rate = 0;
+        }
+    }
+
+    // the old instances keep the old arena alive until they are released
+    effect_memory = make_arena();
+
+    for (auto& i : chains) {
+        auto chain = i.second;
+        auto chain_rate = sample_rate_in / chain->get_rate_factor(sample_rate_in);
+
+        for (auto& j : chain->run_names) {
+            auto old_effect = chain->get_effect(j);
+            auto new_effect = make_effect(old_effect->get_name(), chain_rate, get_effect_options(old_effect));
+            auto object = effect_objects[make_effect_dbus_path(i.first, j)];
+
+            object->replace(new_effect);
+            chain->replace_effect(j, new_effect);
+            new_effects.push_back(new_effect);
+        }
+    }
+
+    auto new_graph = compile_graph();
+    new_graph->bind();
+
+    for (auto& i : new_effects) {
+        i->activate();
+    }
+
+    swap_graph(std::move(new_graph));
+
+    std::cout << "  " << new_effects.size() << " effects ready in " << (timing::now() - start) / 1000000.0 << " ms" << std::endl;
+}
+
+// from the DBus thread or a signal handler
+void audio::processor::reload()
+{
+    broker->send_event(event::name::reload_requested);
+}
+
+// outside jack audio thread, from the main loop
+void audio::processor::begin_reload()
+{
+    // a reload that is still running finishes first so they apply in order
+    if (reload_thread.joinable()) {
+        reload_thread.join();
+    }
+
+    reload_thread = std::thread(&processor::load_config, this);
+}
+
+// on the reload thread
+//
+// The file is parsed before anything is locked and the new chains are built
+// next to the running ones so a bad file leaves everything as it was. The
+// result is published as a new graph that the jack audio thread picks up
+// at the start of a period; the graph it replaces is freed once the audio
+// thread hands it back which is the only grace period needed since nothing
+// else reads a graph.
+void audio::processor::load_config()
+{
+    auto start = timing::now();
+    std::unique_ptr<audio::config> new_config;
+
+    std::cout << "Reloading configuration from " << config->path << std::endl;
+
+    try {
+        new_config = std::make_unique<audio::config>(config->path);
+    } catch (std::exception & e) {
+        std::cout << "Could not load configuration: " << e.what() << std::endl;
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(dsp_mutex);
+        std::map<std::string, std::shared_ptr<modpro::chain>> new_chains;
+        std::vector<effect_type> new_effects;
+        control_values controls;
+        auto reused_controls = std::make_unique<control_batch>();
+
+        reused_controls->is_write = true;
+
+        try {
+            open_plugins(*new_config);
+            validate_chains(*new_config);
+            new_chains = build_chains(*new_config, new_effects, controls, *reused_controls);
+
+            for (auto& i : new_effects) {
+                i->activate();
+            }
+        } catch (std::exception & e) {
+            std::cout << "Configuration was not reloaded: " << e.what() << std::endl;
+            return;
+        }
+
+        auto_connect.clear();
+        for (auto i : new_config->get_routes()) {
+            set_auto_connect(i[0].as<std::string>(), i[1].as<std::string>());
+        }
+
+        // the new chains stay suspended like the ones they replace and keep
+        // counting from where those were
+        for (auto& i : new_chains) {
+            auto old_chain = chains.find(i.first);
+
+            if (old_chain == chains.end()) {
+                continue;
+            }
+
+            i.second->suspended.store(old_chain->second->suspended.load());
+            i.second->ptt_suspended_ns.store(old_chain->second->ptt_suspended_ns.load());
+            i.second->silence_suspended_ns.store(old_chain->second->silence_suspended_ns.load());
+        }
+
+        chains = new_chains;
+        configured_controls = controls;
+        config = std::move(new_config);
+        publish_chains(chains);
+        swap_graph(compile_graph());
+
+        // the audio thread takes the batch after the swap so the controls
+        // change in the first period of the new graph
+        if (reused_controls->entries.size() > 0) {
+            try {
+                run_batch(reused_controls);
+            } catch (DBus::Error & e) {
+                std::cout << "Controls of reused effects will change late: " << e.what() << std::endl;
+            }
+        }
+
+        std::cout << "Configuration reloaded in " << (timing::now() - start) / 1000000.0 << " ms; ";
+        std::cout << new_effects.size() << " effects instantiated" << std::endl;
+    }
+
+    check_auto_connect();
+}
+
+// outside jack audio thread
+std::unique_ptr<modpro::graph> audio::processor::compile_graph()
+{
+    auto new_graph = std::make_unique<modpro::graph>();
+    auto new_meters = meter_bank::make();
+
+    for (auto& i : chains) {
+        auto chain = i.second;
+        std::vector<graph::route> routes;
+
+        for (auto& j : chain->get_routes()) {
+            auto effect_port = parse_effect_port_string(j.effect_port);
+            auto effect = chain->get_effect(effect_port.first);
+            routes.push_back({ effect.get(), effect->get_port_id(effect_port.second), j.port.get(), j.is_input, nullptr });
+        }
+
+        auto sample_rate = audio_backend->get_sample_rate();
+        auto factor = chain->get_rate_factor(sample_rate);
+        auto latency = factor == 1 ? 0 : resampler::get_latency(factor);
+
+        chain->latency.store(double(latency) / sample_rate);
+
+        if (factor != 1) {
+            std::cout << "Chain " << i.first << " runs at " << sample_rate / factor << " Hz; resampling adds ";
+            std::cout << latency << " samples (" << chain->latency.load() * 1000 << " ms) of latency" << std::endl;
+        }
+
+        size_type silence_frames = 0;
+
+        if (chain->silence_hold > 0) {
+            auto wait = chain->silence_hold + chain->get_tail();
+
+            if (std::isfinite(wait)) {
+                silence_frames = std::max(size_type(1), size_type(wait * sample_rate));
+            } else {
+                std::cout << "Chain " << i.first << " has an effect that must always run so it is never suspended for silence" << std::endl;
+            }
+        }
+
+        new_graph->add_chain(chain, routes, factor, silence_frames);
+
+        for (auto& j : chain->meters) {
+            auto effect_port = parse_effect_port_string(j);
+            auto effect = chain->get_effect(effect_port.first);
+            auto control_names = effect->get_control_names();
+            auto is_audio = std::find(control_names.begin(), control_names.end(), effect_port.second) == control_names.end();
+            // a reading covers 1 / meter_rate seconds of audio
+            auto window = std::max(size_type(1), size_type(sample_rate / factor / meter_rate));
+            auto slot = new_meters->add(i.first + "/" + j, is_audio ? window : 1);
+
+            new_graph->add_meter(effect.get(), effect->get_port_id(effect_port.second), is_audio, slot);
+        }
+    }
+
+    for (auto& i : recordings) {
+        if (chains.count(i.chain) == 0) {
+            std::cout << "Not recording " << i.name << ": there is no chain named " << i.chain << std::endl;
+            continue;
+        }
+
+        auto chain = chains[i.chain];
+        auto effect_port = parse_effect_port_string(i.effect_port);
+        auto effect = chain->get_effect(effect_port.first);
+        auto sample_rate = audio_backend->get_sample_rate();
+        auto stream = disk_recorder->get_stream(i.name, sample_rate / chain->get_rate_factor(sample_rate));
+
+        new_graph->add_recording(effect.get(), effect->get_port_id(effect_port.second), stream);
+    }
+
+    new_graph->meter_readings = new_meters;
+    new_graph->sample_rate = audio_backend->get_sample_rate();
+
+    new_graph->finalize(audio_backend->get_buffer_size(), make_arena());
+
+    std::cout << "Compiled graph: " << new_graph->chains.size() << " chains, ";
+    std::cout << new_graph->steps.size() << " effects, " << new_graph->routes.size() << " routes, ";
+    std::cout << new_graph->taps.size() << " taps" << std::endl;
+
+    {
+        std::unique_lock<std::mutex> lock(meter_mutex);
+        meter_readings = new_meters;
+    }
+
+    if (activated) {
+        start_meters();
+    }
+
+    return new_graph;
+}
+
+audio::processor::effect_type audio::processor::make_effect(const std::string name_in, const size_type sample_rate_in, const native::options_type & options_in)
+{
+    // built in effects take priority over plugins with the same name
+    if (native->has_type(name_in)) {
+        return native->instantiate(name_in, sample_rate_in, effect_memory, options_in);
+    }
+
+    auto new_effect = ladspa->instantiate(name_in, sample_rate_in, effect_memory);
+    return new_effect;
+}
+
+native::options_type audio::processor::get_effect_options(effect_type effect_in)
+{
+    auto native_effect = std::dynamic_pointer_cast<native::instance>(effect_in);
+
+    if (native_effect == nullptr) {
+        return {};
+    }
+
+    return native_effect->get_options();
+}
+
+const std::string audio::processor::make_effect_dbus_path(const std::string chain_name_in, const std::string effect_name_in)
+{
+    auto buf = modpro::chain::make_dbus_path(chain_name_in);
+    buf += "/";
+    buf += effect_name_in;
+    return buf;
+}
+
+std::shared_ptr<modpro::arena> audio::processor::make_arena()
+{
+    return arena::make(arena::default_chunk_size, use_huge_pages);
+}
+
+audio::processor_object::processor_object(std::shared_ptr<dbus> dbus_broker_in, std::shared_ptr<processor> processor_in)
+: DBus::ObjectAdaptor(dbus_broker_in->connection, MODPRO_DBUS_PROCESSOR_PATH), target(processor_in)
+{
+    target->set_meter_handler([this](const std::vector<meter_bank::reading> & readings_in) -> void {
+        meters(convert_meters(readings_in));
+    });
+
+    auto interval = target->get_signal_interval();
+
+    if (interval <= 0) {
+        return;
+    }
+
+    signal_thread = std::thread([this, interval]() -> void {
+        std::unique_lock<std::mutex> lock(signal_mutex);
+
+        while(! signal_stop) {
+            signal_wakeup.wait_for(lock, std::chrono::duration<double>(interval));
+
+            if (! signal_stop) {
+                send_changes();
+            }
+        }
+    });
+}
+
+audio::processor_object::~processor_object()
+{
+    target->set_meter_handler(nullptr);
+
+    if (signal_thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(signal_mutex);
+            signal_stop = true;
+        }
+
+        signal_wakeup.notify_all();
+        signal_thread.join();
+    }
+}
+
+// on the signal thread
+//
+// Inputs are only sent after something wrote them and outputs are compared
+// with what was sent last; the first value seen of an output is only
+// remembered.
+void audio::processor_object::send_changes()
+{
+    dbus_control_list changes;
+
+    auto add_changes = [&](const processor::control_list & controls_in, const bool written_in) -> void {
+        for (auto& i : controls_in) {
+            auto key = std::make_pair(std::get<0>(i), std::get<1>(i));
+            auto last = signaled_values.find(key);
+            double value = std::get<2>(i);
+
+            if (last != signaled_values.end() && last->second == value) {
+                continue;
+            }
+
+            auto first = last == signaled_values.end();
+            signaled_values[key] = value;
+
+            if (first && ! written_in) {
+                continue;
+            }
+
+            DBus::Struct<std::string, std::string, double> change;
+            change._1 = std::get<0>(i);
+            change._2 = std::get<1>(i);
+            change._3 = value;
+            changes.push_back(change);
+        }
+    };
+
+    add_changes(target->take_written_controls(), true);
+    add_changes(target->read_output_controls(), false);
+
+    if (changes.size() > 0) {
+        controls_changed(changes);
+    }
+}
+
+void audio::processor_object::check_auto_connect()
+{
+    target->check_auto_connect();
+}
+
+void audio::processor_object::reload()
+{
+    target->reload();
+}
+
+std::map<std::string, double> audio::processor_object::get_process_time()
+{
+    return target->get_process_time();
+}
+
+void audio::processor_object::reset_process_time()
+{
+    target->reset_process_time();
+}
+
+std::map<std::string, double> audio::processor_object::get_memory_usage()
+{
+    return target->get_memory_usage();
+}
+
+std::map<std::string, double> audio::processor_object::get_metrics()
+{
+    return target->get_metrics();
+}
+
+std::vector<double> audio::processor_object::get_xrun_times()
+{
+    return target->get_xrun_times();
+}
+
+void audio::processor_object::reset_metrics()
+{
+    target->reset_metrics();
+}
+
+void audio::processor_object::write_many(const dbus_control_list & controls_in)
+{
+    processor::control_list controls;
+
+    for (auto& i : controls_in) {
+        controls.push_back(std::make_tuple(i._1, i._2, i._3));
+    }
+
+    target->write_many(controls);
+}
+
+audio::processor_object::dbus_meter_list audio::processor_object::convert_meters(const std::vector<meter_bank::reading> & readings_in)
+{
+    dbus_meter_list retval;
+
+    for (auto& i : readings_in) {
+        DBus::Struct<std::string, double, double> meter;
+        meter._1 = i.name;
+        meter._2 = i.peak;
+        meter._3 = i.rms;
+        retval.push_back(meter);
+    }
+
+    return retval;
+}
+
+audio::processor_object::dbus_meter_list audio::processor_object::read_meters()
+{
+    return convert_meters(target->read_meters());
+}
+
+void audio::processor_object::rotate_recordings()
+{
+    target->rotate_recordings();
+}
+
+std::map<std::string, double> audio::processor_object::get_recorder_stats()
+{
+    return target->get_recorder_stats();
+}
+
+void audio::processor_object::set_ptt(const bool & transmitting_in)
+{
+    target->set_ptt(transmitting_in);
+}
+
+bool audio::processor_object::get_ptt()
+{
+    return target->get_ptt();
+}
+
+audio::processor_object::dbus_control_list audio::processor_object::read_snapshot()
+{
+    dbus_control_list retval;
+
+    for (auto& i : target->read_snapshot()) {
+        DBus::Struct<std::string, std::string, double> control;
+        control._1 = std::get<0>(i);
+        control._2 = std::get<1>(i);
+        control._3 = std::get<2>(i);
+        retval.push_back(control);
+    }
+
+    return retval;
 }
 
 std::pair<const std::string, const std::string> audio::processor::parse_effect_port_string(const std::string string_in)
@@ -15,16 +15,33 @@
 
 #pragma once
 
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <yaml-cpp/yaml.h>
 #include <vector>
 
 #include "chain.h"
 #include "dbus.h"
-#include "jackaudio.h"
+#include "graph.h"
+#include "backend.h"
 #include "ladspa.h"
+#include "meter.h"
+#include "metrics.h"
+#include "native.h"
+#include "plugincache.h"
+#include "ptt.h"
+#include "recorder.h"
+#include "ring.h"
+#include "timing.h"
+#include "workers.h"
 
 #define MODPRO_DBUS_PROCESSOR_PATH "/modpro/Processor"
 
@@ -44,37 +61,179 @@ struct audio {
         std::vector<std::string> get_plugins();
         YAML::Node get_chains();
         YAML::Node get_routes();
+        YAML::Node get_workers();
+        YAML::Node get_memory();
+        YAML::Node get_metrics();
+        YAML::Node get_dbus();
+        YAML::Node get_meters();
+        YAML::Node get_recorder();
+        YAML::Node get_ptt();
+        // where plugin metadata is cached or empty to not cache it
+        std::string get_plugin_cache();
     };
 
-    class processor : public modpro::jackaudio::handlers, public hamradio::modpro::processor_adaptor, public DBus::IntrospectableAdaptor, public DBus::ObjectAdaptor, public std::enable_shared_from_this<processor> {
+    class processor : public modpro::backend::handlers, public std::enable_shared_from_this<processor> {
         public:
         using effect_type = std::shared_ptr<modpro::effect>;
         using sample_type = modpro::audio::sample_type;
         using size_type = modpro::audio::size_type;
+        // effect DBus path, control name and value
+        using control_list = std::vector<std::tuple<std::string, std::string, double>>;
+        using meter_handler = std::function<void (const std::vector<meter_bank::reading> &)>;
+
+        // Controls the jack audio thread writes or reads between two periods
+        // so every effect sees the whole batch in the same period. The
+        // thread that sent it owns it and waits for done.
+        struct control_batch {
+            struct entry {
+                modpro::effect * target;
+                effect::id_type port;
+                data_type value;
+            };
+
+            bool is_write;
+            std::vector<entry> entries;
+            std::atomic<bool> done = ATOMIC_VAR_INIT(false);
+        };
+
+        // Structural changes are handed to the jack audio thread as commands
+        // instead of locking it out; graphs it is done with come back through
+        // retired_graphs so they are freed outside of the audio thread.
+        struct command {
+            enum name { activate, swap_graph, run_batch };
+
+            name type;
+            modpro::graph * graph_p;
+            control_batch * batch_p;
+        };
 
         private:
+        // a port the recorder writes to disk
+        struct recording {
+            std::string name;
+            std::string chain;
+            std::string effect_port;
+        };
+
+        using control_values = std::map<std::string, std::map<std::string, data_type>>;
+
         // FIXME do these bools need to be atomic?
-        audio::config config;
+        std::unique_ptr<audio::config> config;
         std::shared_ptr<event::broker> broker;
         std::shared_ptr<dbus> dbus_broker;
         bool initialized = false;
         bool activated = false;
         std::map<const std::string, std::vector<std::string>> auto_connect;
-        std::shared_ptr<modpro::jackaudio::client> jack;
-        std::shared_ptr<modpro::jackaudio::audio_port> input;
-        std::shared_ptr<modpro::jackaudio::audio_port> output;
+        std::shared_ptr<modpro::backend> audio_backend;
         std::shared_ptr<modpro::ladspa> ladspa;
-        std::vector<sample_type *> buffers;
+        std::shared_ptr<modpro::native> native;
+        std::shared_ptr<modpro::plugin_cache> metadata_cache;
+        std::unique_ptr<modpro::worker_pool> workers;
+        std::shared_ptr<modpro::arena> effect_memory;
+        bool use_huge_pages = false;
+        bool lock_memory = true;
+        modpro::metrics audio_metrics;
+        // the metrics file is written by its own thread so monitoring never
+        // has to talk to the processor
+        std::string metrics_path;
+        double metrics_interval = 10;
+        std::thread metrics_thread;
+        std::mutex metrics_mutex;
+        std::condition_variable metrics_wakeup;
+        bool metrics_stop = false;
+        // guards everything a reload replaces against the main loop; the
+        // jack audio thread only ever sees it through a compiled graph
+        std::mutex dsp_mutex;
+        std::thread reload_thread;
+        // meter readings are published by their own thread at meter_rate
+        // to the shared memory block and the meter handler
+        double meter_rate = 20;
+        std::string meter_shm_name;
+        std::shared_ptr<meter_shm> meter_block;
+        std::thread meter_thread;
+        std::mutex meter_mutex;
+        std::condition_variable meter_wakeup;
+        bool meter_stop = false;
+        // the bank of the most recently compiled graph
+        std::shared_ptr<meter_bank> meter_readings;
+        meter_handler meter_listener;
+        // controls written since controls_changed was last sent and the
+        // objects to read them from; kept apart from dsp_mutex so the signal
+        // thread never waits for a reload or the audio thread
+        std::mutex changes_mutex;
+        std::set<std::pair<std::string, std::string>> written_controls;
+        std::map<std::string, std::shared_ptr<modpro::effect_object>> signal_objects;
+        std::shared_ptr<modpro::recorder> disk_recorder;
+        std::vector<recording> recordings;
+        // every recording starts a new file when PTT changes
+        bool rotate_on_ptt = false;
+        // read by the jack audio thread at the start of every period
+        std::atomic<bool> transmitting = ATOMIC_VAR_INIT(false);
+        // LADSPA plugins may allocate when activated so restart_effects is
+        // done by its own thread once PTT has stopped a chain; it gives up on
+        // a chain that has not stopped after ptt_restart_timeout_ns
+        static constexpr timing::ns_type ptt_restart_timeout_ns = 1000000000;
+        std::thread restart_thread;
+        std::mutex restart_mutex;
+        std::condition_variable restart_wakeup;
+        bool restart_requested = false;
+        bool restart_stop = false;
+        std::string ptt_unix_path;
+        std::string ptt_tcp_address;
+        std::shared_ptr<modpro::ptt_server> ptt_input;
+        std::set<std::string> plugin_files;
         std::map<std::string, std::shared_ptr<modpro::chain>> chains;
+        std::map<std::string, std::shared_ptr<modpro::chain_object>> chain_objects;
+        // keyed by DBus path
+        std::map<std::string, std::shared_ptr<modpro::effect_object>> effect_objects;
+        // the control values the configuration file asked for, keyed by the
+        // DBus path of the effect
+        control_values configured_controls;
+        // ports stay registered for as long as a chain or graph uses them
+        std::map<std::string, std::weak_ptr<modpro::backend::audio_port>> audio_ports;
         std::map<std::string, std::vector<std::string>> jack_routes;
+        std::unique_ptr<modpro::graph> initial_graph;
+        // batches the audio thread did not get to in time; freed once done
+        std::vector<std::unique_ptr<control_batch>> abandoned_batches;
+        double signal_interval = 0.1;
+        static constexpr timing::ns_type batch_timeout_ns = 1000000000;
+        ring<command> commands = ring<command>(64);
+        ring<modpro::graph *> retired_graphs = ring<modpro::graph *>(64);
+        // only touched from inside the jack audio thread
+        modpro::graph * active_graph = nullptr;
+        modpro::graph * unretired_graph = nullptr;
 
-        void init_jack();
+        void init_backend();
         void init_dsp();
+        void init_workers();
+        void init_metrics();
+        void write_metrics();
+        void init_meters();
+        void init_recorder();
+        void init_ptt();
+        void start_meters();
+        void restart_stopped_chains();
+        void publish_meters();
+        void open_plugins(audio::config & config_in);
+        void validate_chains(audio::config & config_in);
+        // control changes for effects reused from the running chains go in
+        // reused_controls_out to be applied once the reload can not fail
+        std::map<std::string, std::shared_ptr<modpro::chain>> build_chains(audio::config & config_in, std::vector<effect_type> & new_effects_out, control_values & controls_out, control_batch & reused_controls_out);
+        std::shared_ptr<modpro::backend::audio_port> get_audio_port(const std::string name_in, const bool is_input_in);
+        void publish_chains(const std::map<std::string, std::shared_ptr<modpro::chain>> & chains_in);
+        void load_config();
+        std::unique_ptr<modpro::graph> compile_graph();
+        std::shared_ptr<modpro::arena> make_arena();
+        void run_commands();
+        bool retire_graph(modpro::graph * graph_in);
         std::pair<const std::string, const std::string> parse_effect_port_string(const std::string string_in);
+        // takes the batch away if the audio thread does not get to it in time
+        void run_batch(std::unique_ptr<control_batch> & batch_in);
+        static const std::string make_effect_dbus_path(const std::string chain_name_in, const std::string effect_name_in);
 
         public:
-        processor(const std::string conf_path_in, std::shared_ptr<event::broker> broker_in, std::shared_ptr<dbus> dbus_broker_in);
-        virtual ~processor() { }
+        processor(const std::string conf_path_in, std::shared_ptr<event::broker> broker_in, std::shared_ptr<dbus> dbus_broker_in, std::shared_ptr<modpro::backend> backend_in);
+        virtual ~processor();
         template<typename... Args>
         static std::shared_ptr<processor> make(Args... args)
         {
@@ -85,21 +244,93 @@ struct audio {
 
         void init();
         void start();
+        void send_command(const command & command_in);
+        void swap_graph(std::unique_ptr<modpro::graph> graph_in);
+        void rebuild_graph();
+        void change_sample_rate(const size_type sample_rate_in);
+        void begin_reload();
+        void reload();
+        void reap();
         void set_auto_connect(const std::string source_in, const std::string dest_in);
         void check_auto_connect();
+        std::map<std::string, double> get_process_time();
+        void reset_process_time();
+        std::map<std::string, double> get_memory_usage();
+        std::map<std::string, double> get_metrics();
+        std::vector<double> get_xrun_times();
+        void reset_metrics();
+        // every control is set in the same period; returns once they are
+        void write_many(const control_list & controls_in);
+        // every control of every effect as of one period boundary
+        control_list read_snapshot();
+        // how often controls_changed may be sent in seconds
+        double get_signal_interval();
+        void note_written_control(const std::string & path_in, const std::string & name_in);
+        // the current value of every control written since the last call
+        control_list take_written_controls();
+        // every output control as last published by its effect
+        control_list read_output_controls();
+        std::vector<meter_bank::reading> read_meters();
+        // called from the meter thread with every published reading; an
+        // empty handler removes it
+        void set_meter_handler(meter_handler handler_in);
+        // every recording starts a new file
+        void rotate_recordings();
+        std::map<std::string, double> get_recorder_stats();
+        // chains that are active on tx or rx start or stop in the next period
+        void set_ptt(const bool transmitting_in);
+        bool get_ptt();
         virtual void handle_client_register(const std::string client_name_in);
         virtual void handle_client_unregister(const std::string client_name_in);
         virtual void handle_port_register(const uint32_t port_id_in);
         virtual void handle_port_unregister(const uint32_t port_id_in);
         virtual void handle_shutdown();
-        virtual void handle_process(modpro::jackaudio::nframes_type nframes);
-        virtual void handle_sample_rate_change(modpro::jackaudio::nframes_type sample_rate_in);
-        virtual void handle_buffer_size_change(modpro::jackaudio::nframes_type buffer_size_in);
-        effect_type make_effect(const std::string name_in, const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in);
-        sample_type * make_buffer();
+        virtual void handle_process(modpro::backend::nframes_type nframes);
+        virtual void handle_sample_rate_change(modpro::backend::nframes_type sample_rate_in);
+        virtual void handle_buffer_size_change(modpro::backend::nframes_type buffer_size_in);
+        virtual void handle_xrun();
+        effect_type make_effect(const std::string name_in, const size_type sample_rate_in, const native::options_type & options_in = {});
+        static native::options_type get_effect_options(effect_type effect_in);
     };
 
-    static sample_type * make_buffer(const size_type size_in);
+    // the DBus face of the processor
+    class processor_object : public hamradio::modpro::processor_adaptor, public DBus::IntrospectableAdaptor, public DBus::ObjectAdaptor {
+        using dbus_control_list = std::vector<DBus::Struct<std::string, std::string, double>>;
+        using dbus_meter_list = std::vector<DBus::Struct<std::string, double, double>>;
+
+        std::shared_ptr<processor> target;
+        // controls_changed is sent from its own thread at most once per
+        // signal interval with only the controls that changed since the
+        // last one, however many writes happened in between; none of it
+        // goes through the audio thread
+        std::thread signal_thread;
+        std::mutex signal_mutex;
+        std::condition_variable signal_wakeup;
+        bool signal_stop = false;
+        std::map<std::pair<std::string, std::string>, double> signaled_values;
+
+        void send_changes();
+        static dbus_meter_list convert_meters(const std::vector<meter_bank::reading> & readings_in);
+
+        public:
+        processor_object(std::shared_ptr<dbus> dbus_broker_in, std::shared_ptr<processor> processor_in);
+        ~processor_object();
+        virtual void check_auto_connect() override;
+        virtual void reload() override;
+        virtual std::map<std::string, double> get_process_time() override;
+        virtual void reset_process_time() override;
+        virtual std::map<std::string, double> get_memory_usage() override;
+        virtual std::map<std::string, double> get_metrics() override;
+        virtual std::vector<double> get_xrun_times() override;
+        virtual void reset_metrics() override;
+        virtual void write_many(const dbus_control_list & controls_in) override;
+        virtual dbus_control_list read_snapshot() override;
+        virtual dbus_meter_list read_meters() override;
+        virtual void rotate_recordings() override;
+        virtual std::map<std::string, double> get_recorder_stats() override;
+        virtual void set_ptt(const bool & transmitting_in) override;
+        virtual bool get_ptt() override;
+    };
 
     class chain {
         std::map<std::string, audio::processor::effect_type> effects;
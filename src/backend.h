@@ -0,0 +1,67 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace modpro {
+
+// Something that drives the processor by calling handle_process() once per
+// period. JACK is the normal one; the others let the same graph run without
+// a sound server.
+struct backend {
+    using sample_type = float;
+    using nframes_type = uint32_t;
+
+    struct handlers {
+        virtual void handle_shutdown() = 0;
+        virtual void handle_process(nframes_type nframes_in) = 0;
+        virtual void handle_client_register(const std::string client_name_in) = 0;
+        virtual void handle_client_unregister(const std::string client_name_in) = 0;
+        virtual void handle_port_register(const uint32_t port_id_in) = 0;
+        virtual void handle_port_unregister(const uint32_t port_id_in) = 0;
+        virtual void handle_sample_rate_change(nframes_type rate_in) = 0;
+        virtual void handle_buffer_size_change(nframes_type buffer_size_in) = 0;
+        virtual void handle_xrun() = 0;
+    };
+
+    struct audio_port {
+        virtual ~audio_port() { }
+        // only valid until the end of the current period
+        virtual sample_type * get_buffer(const nframes_type nframes_in) = 0;
+    };
+
+    virtual ~backend() { }
+    virtual void open(std::shared_ptr<handlers> handler_in) = 0;
+    virtual void activate() = 0;
+    // true if handle_process() is called from a realtime thread that has a
+    // deadline to meet
+    virtual bool is_realtime() = 0;
+    virtual nframes_type get_sample_rate() = 0;
+    virtual nframes_type get_buffer_size() = 0;
+    virtual int get_realtime_priority() = 0;
+    // percent of the period the backend thinks was used; 0 if unknown
+    virtual float get_dsp_load() = 0;
+    virtual std::vector<std::string> get_known_port_names() = 0;
+    virtual std::shared_ptr<audio_port> add_audio_input(const std::string name_in) = 0;
+    virtual std::shared_ptr<audio_port> add_audio_output(const std::string name_in) = 0;
+    virtual int connect_port(const std::string source_in, const std::string dest_in) = 0;
+};
+
+}
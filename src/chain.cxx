@@ -13,14 +13,17 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <cstdint>
 #include <exception>
+#include <iostream>
+#include <stdexcept>
 
 #include "chain.h"
 
 namespace modpro {
 
-chain::chain(const std::string name_in, std::shared_ptr<dbus> dbus_broker_in)
-:  DBus::ObjectAdaptor(dbus_broker_in->connection, make_dbus_path(name_in)), name(name_in)
+chain::chain(const std::string name_in)
+: name(name_in)
 {
 
 }
@@ -40,6 +43,13 @@ void chain::activate()
     }
 }
 
+void chain::restart()
+{
+    for(auto i : run_list) {
+        i->restart();
+    }
+}
+
 void chain::run(const effect::size_type sample_count_in)
 {
     for(auto i : run_list) {
@@ -55,6 +65,121 @@ void chain::add_effect(const std::string name_in, std::shared_ptr<effect> effect
 
     effect_instances[name_in] = effect_in;
     run_list.push_back(effect_in);
+    run_names.push_back(name_in);
+    run_successors.push_back({});
+}
+
+// outside jack audio thread; graphs hold their own references to effects
+// so the old effect stays alive until no graph that runs it is left
+void chain::replace_effect(const std::string name_in, std::shared_ptr<effect> effect_in)
+{
+    auto old_effect = get_effect(name_in);
+
+    effect_instances[name_in] = effect_in;
+
+    for (auto& i : run_list) {
+        if (i == old_effect) {
+            i = effect_in;
+        }
+    }
+}
+
+void chain::add_wire(const std::string source_in, const std::string source_port_in, const std::string dest_in, const std::string dest_port_in, const effect::data_type gain_in)
+{
+    get_effect(source_in)->get_port_id(source_port_in);
+    get_effect(dest_in)->get_port_id(dest_port_in);
+
+    if (source_in == dest_in) {
+        throw std::runtime_error("effect can not be wired to itself: " + source_in);
+    }
+
+    wire_targets[source_in].insert(dest_in);
+
+    for (auto& i : wires) {
+        if (i.source == source_in && i.source_port == source_port_in) {
+            for (auto& j : i.dests) {
+                if (j.effect == dest_in && j.port == dest_port_in) {
+                    throw std::runtime_error("duplicate wire from " + source_in + "." + source_port_in + " to " + dest_in + "." + dest_port_in);
+                }
+            }
+
+            i.dests.push_back({ dest_in, dest_port_in, gain_in });
+            return;
+        }
+    }
+
+    wires.push_back({ source_in, source_port_in, { { dest_in, dest_port_in, gain_in } } });
+}
+
+// Orders run_list so every effect runs after everything wired into it. When
+// several effects are ready the one declared first goes first so a config
+// that is already in order runs exactly as written.
+void chain::schedule()
+{
+    std::map<std::string, size_t> waiting_on;
+    std::vector<std::string> new_names;
+
+    for (auto& i : run_names) {
+        waiting_on[i] = 0;
+    }
+
+    for (auto& i : wire_targets) {
+        for (auto& j : i.second) {
+            waiting_on[j]++;
+        }
+    }
+
+    while(new_names.size() < run_names.size()) {
+        bool found = false;
+
+        for (auto& i : run_names) {
+            if (waiting_on[i] != 0) {
+                continue;
+            }
+
+            found = true;
+            waiting_on[i] = SIZE_MAX;
+            new_names.push_back(i);
+
+            for (auto& j : wire_targets[i]) {
+                waiting_on[j]--;
+            }
+
+            break;
+        }
+
+        if (! found) {
+            throw std::runtime_error("wires in chain " + name + " form a loop");
+        }
+    }
+
+    if (new_names != run_names) {
+        std::cout << "  effects in chain " << name << " will run in wiring order:";
+        for (auto& i : new_names) {
+            std::cout << " " << i;
+        }
+        std::cout << std::endl;
+    }
+
+    std::map<std::string, size_t> position;
+    for (size_t i = 0; i < new_names.size(); i++) {
+        position[new_names[i]] = i;
+    }
+
+    run_names = new_names;
+    run_list.clear();
+    run_successors.clear();
+
+    for (auto& i : run_names) {
+        std::vector<size_t> successors;
+
+        for (auto& j : wire_targets[i]) {
+            successors.push_back(position[j]);
+        }
+
+        run_list.push_back(effect_instances[i]);
+        run_successors.push_back(successors);
+    }
 }
 
 std::shared_ptr<effect> chain::get_effect(const std::string name_in)
@@ -66,14 +191,133 @@ std::shared_ptr<effect> chain::get_effect(const std::string name_in)
     return effect_instances[name_in];
 }
 
-void chain::add_route(std::string port_name_in, std::shared_ptr<jackaudio::audio_port> port_in)
+void chain::add_route(std::string port_name_in, std::shared_ptr<backend::audio_port> port_in, const bool is_input_in)
 {
-    jack_connections.push_back(std::make_pair(port_name_in, port_in));
+    port_connections.push_back({ port_name_in, port_in, is_input_in });
 }
 
-const std::vector<std::pair<std::string, std::shared_ptr<jackaudio::audio_port>>> chain::get_routes()
+const std::vector<chain::route> & chain::get_routes()
 {
-    return jack_connections;
+    return port_connections;
+}
+
+effect::size_type chain::get_rate_factor(const effect::size_type sample_rate_in)
+{
+    auto rate = internal_rate.load();
+
+    if (rate == 0 || rate == sample_rate_in) {
+        return 1;
+    }
+
+    if (! is_rate_usable(sample_rate_in)) {
+        throw std::runtime_error("internal rate of chain " + name + " does not divide the sample rate " + std::to_string(sample_rate_in));
+    }
+
+    return sample_rate_in / rate;
+}
+
+bool chain::is_rate_usable(const effect::size_type sample_rate_in)
+{
+    auto rate = internal_rate.load();
+
+    return rate == 0 || (rate <= sample_rate_in && sample_rate_in % rate == 0);
+}
+
+chain::activity chain::parse_activity(const std::string & name_in)
+{
+    if (name_in == "always") {
+        return always;
+    } else if (name_in == "tx") {
+        return transmit;
+    } else if (name_in == "rx") {
+        return receive;
+    }
+
+    throw std::runtime_error("active_on must be tx, rx or always: " + name_in);
+}
+
+double chain::get_tail()
+{
+    double retval = 0;
+
+    for (auto& i : effect_instances) {
+        retval += tails.count(i.first) != 0 ? tails[i.first] : i.second->get_tail();
+    }
+
+    return retval;
+}
+
+// inside jack audio thread
+bool chain::is_active(const bool transmitting_in)
+{
+    switch(active_on) {
+        case always:
+            return true;
+        case transmit:
+            return transmitting_in;
+        case receive:
+            return ! transmitting_in;
+    }
+
+    return true;
+}
+
+std::map<std::string, double> chain::get_run_time()
+{
+    return run_time.get_summary();
+}
+
+void chain::reset_run_time()
+{
+    run_time.reset();
+}
+
+chain_object::chain_object(std::shared_ptr<dbus> dbus_broker_in, std::shared_ptr<chain> target_in)
+: DBus::ObjectAdaptor(dbus_broker_in->connection, chain::make_dbus_path(target_in->name)), target(target_in)
+{
+
+}
+
+std::shared_ptr<chain> chain_object::get_target()
+{
+    std::unique_lock<std::mutex> lock(target_mutex);
+    return target;
+}
+
+void chain_object::set_target(std::shared_ptr<chain> target_in)
+{
+    std::unique_lock<std::mutex> lock(target_mutex);
+    target = target_in;
+}
+
+std::map<std::string, double> chain_object::get_run_time()
+{
+    return get_target()->get_run_time();
+}
+
+void chain_object::reset_run_time()
+{
+    get_target()->reset_run_time();
+}
+
+std::map<std::string, double> chain_object::get_latency()
+{
+    auto target = get_target();
+
+    return {
+        { "internal_rate", double(target->internal_rate.load()) },
+        { "resampler_latency", target->latency.load() },
+    };
+}
+
+std::map<std::string, double> chain_object::get_suspended_time()
+{
+    auto target = get_target();
+
+    return {
+        { "ptt", target->ptt_suspended_ns.load() / 1e9 },
+        { "silence", target->silence_suspended_ns.load() / 1e9 },
+    };
 }
 
 }
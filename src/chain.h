@@ -13,34 +13,138 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#pragma once
+
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 
 #include "dbus.h"
 #include "effect.h"
-#include "jackaudio.h"
+#include "backend.h"
+#include "timing.h"
 
 #define MODPRO_DBUS_CHAIN_PREFIX "/modpro/Chain"
 
 namespace modpro {
 
-struct chain : public hamradio::modpro::chain_adaptor, public DBus::IntrospectableAdaptor, public DBus::ObjectAdaptor, public std::enable_shared_from_this<chain> {
+struct chain : public std::enable_shared_from_this<chain> {
     const std::string name;
     std::map<std::string, std::shared_ptr<effect>> effect_instances;
     std::vector<std::shared_ptr<effect>> run_list;
-    std::vector<std::pair<std::string, std::shared_ptr<jackaudio::audio_port>>> jack_connections;
-    std::shared_ptr<dbus> dbus_broker;
+    std::vector<std::string> run_names;
+    // for each entry in run_list the index of every entry that reads from it
+    std::vector<std::vector<size_t>> run_successors;
+    std::map<std::string, std::set<std::string>> wire_targets;
+
+    struct wire_dest {
+        std::string effect;
+        std::string port;
+        // the wire is scaled by this before it reaches the port
+        effect::data_type gain;
+    };
+
+    // an input port can be the destination of more than one wire; the
+    // graph sums them together before the effect runs
+    struct wire {
+        std::string source;
+        std::string source_port;
+        std::vector<wire_dest> dests;
+    };
+
+    // a chain input or output and the effect port it is connected to
+    struct route {
+        std::string effect_port;
+        std::shared_ptr<backend::audio_port> port;
+        bool is_input;
+    };
+
+    std::vector<wire> wires;
+    std::vector<route> port_connections;
+    // effect.port names whose levels are published
+    std::vector<std::string> meters;
+    timing::stats run_time;
+    // the rate the effects run at when it is lower than the backend rate
+    // or 0 to run at the backend rate; a sample rate change can clear it
+    // while DBus reads it
+    std::atomic<effect::size_type> internal_rate = ATOMIC_VAR_INIT(0);
+    // seconds of delay the resamplers add to the chain at the current rate
+    std::atomic<double> latency = ATOMIC_VAR_INIT(0);
+    // the PTT state the chain runs in; the rest of the time its effects are
+    // not run and its outputs are silent
+    enum activity { always, transmit, receive };
+    activity active_on = always;
+    // every effect is restarted when the chain starts running again so
+    // nothing left over from the last time is heard
+    bool restart_effects = false;
+    // set by the graph to why it does not run the effects of the chain so
+    // the next graph picks up where it left off
+    enum suspension { not_suspended, suspended_by_ptt, suspended_by_silence };
+    std::atomic<suspension> suspended = ATOMIC_VAR_INIT(not_suspended);
+    // set by the graph when PTT stops a chain with restart_effects; the
+    // chain is not started again until its effects have been restarted
+    // outside jack audio thread and this is cleared
+    std::atomic<bool> restart_pending = ATOMIC_VAR_INIT(false);
+    // a chain whose inputs all stay at or below silence_threshold, as a
+    // peak level, for silence_hold seconds plus the tail of every effect
+    // is not run until one of them is above it again; a hold of 0 never
+    // suspends the chain
+    effect::sample_type silence_threshold = 0;
+    double silence_hold = 0;
+    // seconds of tail for effects that can not declare their own
+    std::map<std::string, double> tails;
+    // how long the chain was not run because of PTT and because its inputs
+    // were silent
+    std::atomic<timing::ns_type> ptt_suspended_ns = ATOMIC_VAR_INIT(0);
+    std::atomic<timing::ns_type> silence_suspended_ns = ATOMIC_VAR_INIT(0);
 
     public:
-    chain(const std::string name_in, std::shared_ptr<dbus> dbus_broker_in);
+    chain(const std::string name_in);
     static const std::string make_dbus_path(const std::string name_in);
     void activate();
+    // outside jack audio thread and only while suspended
+    void restart();
     void run(const effect::size_type sample_count_in);
     void add_effect(const std::string name_in, std::shared_ptr<effect> effect_in);
+    void replace_effect(const std::string name_in, std::shared_ptr<effect> effect_in);
+    void add_wire(const std::string source_in, const std::string source_port_in, const std::string dest_in, const std::string dest_port_in, const effect::data_type gain_in = 1);
+    void schedule();
     std::shared_ptr<effect> get_effect(const std::string name_in);
-    void add_route(std::string port_name_in, std::shared_ptr<jackaudio::audio_port> port_in);
-    const std::vector<std::pair<std::string, std::shared_ptr<jackaudio::audio_port>>> get_routes();
+    void add_route(std::string port_name_in, std::shared_ptr<backend::audio_port> port_in, const bool is_input_in);
+    const std::vector<route> & get_routes();
+    // how many samples at the backend rate make up one sample inside the
+    // chain; the internal rate must divide the backend rate evenly
+    effect::size_type get_rate_factor(const effect::size_type sample_rate_in);
+    // false if get_rate_factor would throw
+    bool is_rate_usable(const effect::size_type sample_rate_in);
+    // tx, rx or always
+    static activity parse_activity(const std::string & name_in);
+    bool is_active(const bool transmitting_in);
+    // the tails of every effect added together
+    double get_tail();
+    std::map<std::string, double> get_run_time();
+    void reset_run_time();
+};
+
+// The DBus face of a chain. A reload builds a new chain from the new
+// configuration and points the existing object at it so the path stays
+// put. Only used outside the jack audio thread.
+struct chain_object : public hamradio::modpro::chain_adaptor, public DBus::IntrospectableAdaptor, public DBus::ObjectAdaptor {
+    private:
+    std::mutex target_mutex;
+    std::shared_ptr<chain> target;
+
+    public:
+    chain_object(std::shared_ptr<dbus> dbus_broker_in, std::shared_ptr<chain> target_in);
+    std::shared_ptr<chain> get_target();
+    void set_target(std::shared_ptr<chain> target_in);
+    virtual std::map<std::string, double> get_run_time() override;
+    virtual void reset_run_time() override;
+    virtual std::map<std::string, double> get_latency() override;
+    virtual std::map<std::string, double> get_suspended_time() override;
 };
 
 }
@@ -22,6 +22,9 @@ namespace modpro {
 
 static DBus::BusDispatcher * init_dispatcher()
 {
+    // signals are sent from threads other than the dispatcher
+    DBus::_init_threading();
+
     auto new_dispatcher = new DBus::BusDispatcher();
     // this is annoying
     DBus::default_dispatcher = new_dispatcher;
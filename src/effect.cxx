@@ -13,6 +13,8 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <map>
 #include <string>
@@ -23,18 +25,102 @@
 
 namespace modpro {
 
-static effect::size_type next_effect_id = 0;
+static std::atomic<effect::size_type> next_effect_id(0);
 
-effect::effect(const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in)
-// FIXME this needs to be made atomic
-: DBus::ObjectAdaptor(dbus_broker_in->connection, dbus_path_in), effect_id(next_effect_id++)
+effect::effect()
+: effect_id(next_effect_id++)
 {
 
 }
 
-std::unique_lock<std::mutex> effect::get_lock()
+// copies every input control the two effects have in common
+void effect::carry_controls(std::shared_ptr<effect> source_in)
 {
-    return std::unique_lock<std::mutex>(effect_mutex);
+    auto names = get_input_control_names();
+
+    for (auto& i : source_in->get_input_control_names()) {
+        if (std::find(names.begin(), names.end(), i) != names.end()) {
+            set_control(i, source_in->get_control(i));
+        }
+    }
+}
+
+effect_object::effect_object(const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in, std::shared_ptr<effect> target_in, change_handler on_change_in)
+: DBus::ObjectAdaptor(dbus_broker_in->connection, dbus_path_in), target(target_in), on_change(on_change_in)
+{
+
+}
+
+std::shared_ptr<effect> effect_object::get_target()
+{
+    std::unique_lock<std::mutex> lock(target_mutex);
+    return target;
+}
+
+void effect_object::replace(std::shared_ptr<effect> target_in)
+{
+    std::unique_lock<std::mutex> lock(target_mutex);
+
+    if (target != nullptr && target != target_in) {
+        target_in->carry_controls(target);
+    }
+
+    target = target_in;
+}
+
+void effect_object::set_target(std::shared_ptr<effect> target_in)
+{
+    std::unique_lock<std::mutex> lock(target_mutex);
+    target = target_in;
+}
+
+double effect_object::read(const std::string & name_in)
+{
+    return get_target()->read(name_in);
+}
+
+std::map<std::string, double> effect_object::read_all()
+{
+    return get_target()->read_all();
+}
+
+void effect_object::write(const std::string & name_in, const double & value_in)
+{
+    // hold the lock so a write can not land on an effect that is in the
+    // middle of being replaced
+    std::unique_lock<std::mutex> lock(target_mutex);
+    target->write(name_in, value_in);
+
+    if (on_change) {
+        on_change(name_in);
+    }
+}
+
+double effect_object::knudge(const std::string & name_in, const double & value_in)
+{
+    std::unique_lock<std::mutex> lock(target_mutex);
+    auto retval = target->knudge(name_in, value_in);
+
+    if (on_change) {
+        on_change(name_in);
+    }
+
+    return retval;
+}
+
+std::vector<std::string> effect_object::get_control_names()
+{
+    return get_target()->get_control_names();
+}
+
+std::map<std::string, double> effect_object::get_run_time()
+{
+    return get_target()->run_time.get_summary();
+}
+
+void effect_object::reset_run_time()
+{
+    get_target()->run_time.reset();
 }
 
 }
@@ -15,37 +15,94 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include "dbus.h"
 #include "event.h"
+#include "timing.h"
 
 namespace modpro {
 
-struct effect : public hamradio::modpro::effect_adaptor, public DBus::IntrospectableAdaptor, public DBus::ObjectAdaptor {
+struct effect {
     using sample_type = float;
     using data_type = float;
     using size_type = unsigned long;
-
-    std::mutex effect_mutex;
-    std::shared_ptr<dbus> dbus_broker;
-
-    protected:
-    std::unique_lock<std::mutex> get_lock();
+    using id_type = unsigned long;
 
     public:
-    effect(const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in);
+    effect();
+    virtual ~effect() { }
     const size_type effect_id;
+    // how long each call to run() takes
+    timing::stats run_time;
     virtual const std::string get_name() = 0;
     virtual const std::string get_label() = 0;
     virtual data_type get_control(const std::string name_in) = 0;
     virtual void set_control(const std::string name_in, const sample_type data_type) = 0;
+    // take a port id from get_port_id() and are safe to call from inside
+    // the jack audio thread
+    virtual data_type get_control(const id_type id_in) = 0;
+    virtual void set_control(const id_type id_in, const data_type value_in) = 0;
+    virtual std::vector<std::string> get_control_names() = 0;
+    virtual std::vector<std::string> get_input_control_names() = 0;
+    virtual id_type get_port_id(const std::string name_in) = 0;
+    // the ids of every audio input or every audio output
+    virtual std::vector<id_type> get_audio_ports(const bool inputs_in) = 0;
+    virtual void connect(const id_type port_id_in, sample_type * buffer_in) = 0;
     virtual void connect(const std::string name_in, sample_type * buffer_in) = 0;
     virtual void disconnect(const std::string name_in) = 0;
+    // true if the effect can not use the same buffer for an input and output
+    virtual bool is_inplace_broken() = 0;
     virtual void activate() = 0;
+    // deactivates and activates the effect again so it forgets the audio it
+    // has seen; LADSPA plugins may allocate when activated so this is only
+    // called outside jack audio thread while no graph is running the effect
+    virtual void restart() = 0;
+    // seconds the effect can keep making sound after its input went silent;
+    // infinite for an effect that has to run whatever its input is
+    virtual double get_tail() = 0;
     virtual void run(size_type sample_count) = 0;
     virtual double read(const std::string & name_in) = 0;
+    virtual std::map<std::string, double> read_all() = 0;
     virtual void write(const std::string & name_in, const double & value_in) = 0;
     virtual double knudge(const std::string & name_in, const double & value_in) = 0;
+    void carry_controls(std::shared_ptr<effect> source_in);
+};
+
+// The DBus face of an effect. It stays at the same path for as long as the
+// configuration has an effect with that name so the effect behind it can
+// be replaced, like when every plugin is instantiated again for a new
+// sample rate, without scripts noticing. Only used outside the jack audio
+// thread so a plain mutex guards the target.
+struct effect_object : public hamradio::modpro::effect_adaptor, public DBus::IntrospectableAdaptor, public DBus::ObjectAdaptor {
+    // called with the name of every control written through the object
+    using change_handler = std::function<void(const std::string & name_in)>;
+
+    private:
+    std::mutex target_mutex;
+    std::shared_ptr<effect> target;
+    change_handler on_change;
+
+    public:
+    effect_object(const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in, std::shared_ptr<effect> target_in, change_handler on_change_in = nullptr);
+    std::shared_ptr<effect> get_target();
+    // copies the current control values into the new effect and then
+    // points the object at it
+    void replace(std::shared_ptr<effect> target_in);
+    // points the object at an effect that keeps its own control values
+    void set_target(std::shared_ptr<effect> target_in);
+    virtual double read(const std::string & name_in) override;
+    virtual std::map<std::string, double> read_all() override;
+    virtual void write(const std::string & name_in, const double & value_in) override;
+    virtual double knudge(const std::string & name_in, const double & value_in) override;
+    virtual std::vector<std::string> get_control_names() override;
+    virtual std::map<std::string, double> get_run_time() override;
+    virtual void reset_run_time() override;
 };
 
 }
@@ -14,30 +14,90 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <cassert>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "event.h"
 
 namespace modpro {
 
-event::broker::lock_type event::broker::get_pending_events_lock()
+event::broker::broker()
 {
-    return lock_type(pending_events_mutex);
+    wakeup_fd = eventfd(0, EFD_CLOEXEC);
+
+    if (wakeup_fd == -1) {
+        throw std::runtime_error("could not create eventfd for event broker");
+    }
+}
+
+event::broker::~broker()
+{
+    if (wakeup_fd != -1) {
+        close(wakeup_fd);
+        wakeup_fd = -1;
+    }
+}
+
+void event::broker::subscribe(const event::name event_name_in)
+{
+    subscriptions.fetch_or(uint64_t(1) << event_name_in);
+}
+
+void event::broker::unsubscribe(const event::name event_name_in)
+{
+    subscriptions.fetch_and(~(uint64_t(1) << event_name_in));
 }
 
-void event::broker::send_event(const event::name event_name_in) {
-    auto lock = get_pending_events_lock();
-    assert(pending_events.size() < 50);
-    pending_events.push_back(event_name_in);
-    pending_events_cv.notify_one();
+bool event::broker::is_subscribed(const event::name event_name_in)
+{
+    return subscriptions.load(std::memory_order_relaxed) & (uint64_t(1) << event_name_in);
 }
 
-const event::name event::broker::get_event()
+event::broker::size_type event::broker::get_dropped_events()
 {
-    auto lock = get_pending_events_lock();
-    pending_events_cv.wait(lock, [this]{ return pending_events.size() > 0; });
+    return dropped_events.load();
+}
+
+void event::broker::send_event(const event::name event_name_in)
+{
+    event new_event;
+    new_event.type = event_name_in;
+    new_event.payload.number = 0;
+    send_event(new_event);
+}
+
+// safe to call from inside the jack audio thread
+void event::broker::send_event(const event & event_in) {
+    if (! is_subscribed(event_in.type)) {
+        return;
+    }
+
+    if (! pending_events.push(event_in)) {
+        dropped_events.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint64_t one = 1;
+    // can only fail if the counter would overflow in which case the
+    // consumer is already guaranteed to wake up
+    auto result = write(wakeup_fd, &one, sizeof(one));
+    (void)result;
+}
+
+const event event::broker::get_event()
+{
+    event retval;
+
+    while(! pending_events.pop(retval)) {
+        uint64_t count;
+
+        if (read(wakeup_fd, &count, sizeof(count)) == -1 && errno != EINTR) {
+            throw std::runtime_error("could not read from event broker eventfd");
+        }
+    }
 
-    auto retval = pending_events.front();
-    pending_events.pop_front();
     return retval;
 }
 
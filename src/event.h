@@ -15,31 +15,52 @@
 
 #pragma once
 
-#include <condition_variable>
-#include <list>
-#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "ring.h"
 
 namespace modpro {
 
 struct event {
     enum name {
-        audio_started, audio_stopped, audio_processed, audio_client_change
+        audio_started, audio_stopped, audio_client_change, graph_retired,
+        buffer_size_change, sample_rate_change, reload_requested
+    };
+
+    // which member is valid depends on the event name
+    union payload_type {
+        uint64_t number;
+        double real;
+        void * pointer;
     };
 
+    name type;
+    payload_type payload;
+
+    // Events are passed through a fixed size lock-free ring so send_event()
+    // can be called from the jack audio thread: it never allocates or
+    // blocks. Only events the consumer has subscribed to are queued and
+    // each one costs a single eventfd write to wake the consumer up.
     struct broker {
-        using mutex_type = std::mutex;
-        using lock_type = std::unique_lock<mutex_type>;
+        using size_type = unsigned long;
 
         private:
-        mutex_type pending_events_mutex;
-        std::condition_variable pending_events_cv;
-        std::list<event::name> pending_events;
-
-        lock_type get_pending_events_lock();
+        int wakeup_fd = -1;
+        std::atomic<uint64_t> subscriptions = ATOMIC_VAR_INIT(0);
+        std::atomic<size_type> dropped_events = ATOMIC_VAR_INIT(0);
+        ring<event> pending_events = ring<event>(256);
 
         public:
-        const event::name get_event();
+        broker();
+        ~broker();
+        void subscribe(const event::name event_name_in);
+        void unsubscribe(const event::name event_name_in);
+        bool is_subscribed(const event::name event_name_in);
+        size_type get_dropped_events();
+        const event get_event();
         void send_event(const event::name event_name_in);
+        void send_event(const event & event_in);
     };
 };
 
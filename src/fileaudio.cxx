@@ -0,0 +1,160 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <cassert>
+#include <stdexcept>
+
+#include "fileaudio.h"
+
+namespace modpro {
+
+fileaudio::audio_port::audio_port(const std::string name_in, const nframes_type block_size_in)
+: buffer(block_size_in), name(name_in)
+{
+
+}
+
+fileaudio::sample_type * fileaudio::audio_port::get_buffer(const nframes_type nframes_in)
+{
+    assert(nframes_in <= buffer.size());
+    return buffer.data();
+}
+
+fileaudio::client::client(const std::string input_path_in, const std::string output_path_in, const nframes_type block_size_in, const nframes_type raw_sample_rate_in)
+: input_path(input_path_in), output_path(output_path_in), block_size(block_size_in), raw_sample_rate(raw_sample_rate_in)
+{
+
+}
+
+void fileaudio::client::open(std::shared_ptr<handlers> handler_in)
+{
+    handler = handler_in;
+    input = std::make_unique<wavfile::reader>(input_path, 1, raw_sample_rate);
+}
+
+void fileaudio::client::activate()
+{
+    activated = true;
+}
+
+bool fileaudio::client::is_realtime()
+{
+    return false;
+}
+
+fileaudio::nframes_type fileaudio::client::get_sample_rate()
+{
+    assert(input != nullptr);
+    return input->sample_rate;
+}
+
+fileaudio::nframes_type fileaudio::client::get_buffer_size()
+{
+    return block_size;
+}
+
+int fileaudio::client::get_realtime_priority()
+{
+    return 0;
+}
+
+float fileaudio::client::get_dsp_load()
+{
+    return 0;
+}
+
+// there is nothing to connect to
+std::vector<std::string> fileaudio::client::get_known_port_names()
+{
+    return {};
+}
+
+std::shared_ptr<backend::audio_port> fileaudio::client::add_audio_input(const std::string name_in)
+{
+    auto new_port = std::make_shared<fileaudio::audio_port>(name_in, block_size);
+    inputs.push_back(new_port);
+    return new_port;
+}
+
+std::shared_ptr<backend::audio_port> fileaudio::client::add_audio_output(const std::string name_in)
+{
+    auto new_port = std::make_shared<fileaudio::audio_port>(name_in, block_size);
+    outputs.push_back(new_port);
+    return new_port;
+}
+
+int fileaudio::client::connect_port(const std::string source_in, const std::string dest_in)
+{
+    return 0;
+}
+
+void fileaudio::client::run()
+{
+    assert(activated);
+
+    auto handler_p = handler.lock();
+
+    if (handler_p == nullptr) {
+        throw std::runtime_error("file audio client has no handler");
+    }
+
+    if (outputs.size() == 0) {
+        throw std::runtime_error("configuration has no outputs to render to " + output_path);
+    }
+
+    wavfile::writer output(output_path, outputs.size(), input->sample_rate);
+    std::vector<sample_type> in_frames(block_size * input->channels);
+    std::vector<sample_type> out_frames(block_size * outputs.size());
+    auto channels = input->channels;
+
+    while(true) {
+        auto nframes = input->read(in_frames.data(), block_size);
+
+        if (nframes == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < inputs.size(); i++) {
+            auto buffer = inputs[i]->get_buffer(nframes);
+            auto channel = i % channels;
+
+            for (size_t j = 0; j < nframes; j++) {
+                buffer[j] = in_frames[j * channels + channel];
+            }
+        }
+
+        handler_p->handle_process(nframes);
+
+        for (size_t i = 0; i < outputs.size(); i++) {
+            auto buffer = outputs[i]->get_buffer(nframes);
+
+            for (size_t j = 0; j < nframes; j++) {
+                out_frames[j * outputs.size() + i] = buffer[j];
+            }
+        }
+
+        output.write(out_frames.data(), nframes);
+        frames_done += nframes;
+    }
+
+    output.close();
+}
+
+wavfile::size_type fileaudio::client::get_frames_done()
+{
+    return frames_done;
+}
+
+}
@@ -0,0 +1,80 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "backend.h"
+#include "wavfile.h"
+
+namespace modpro {
+
+// Runs the graph over audio files instead of a sound server as fast as the
+// CPU allows. Input port N reads channel N of the input file, wrapping
+// around when there are more ports than channels, and the output file gets
+// one channel for every output port in the order they were created.
+struct fileaudio {
+    using nframes_type = backend::nframes_type;
+    using sample_type = backend::sample_type;
+
+    static const nframes_type default_block_size = 4096;
+
+    class audio_port : public backend::audio_port {
+        std::vector<sample_type> buffer;
+
+        public:
+        const std::string name;
+        audio_port(const std::string name_in, const nframes_type block_size_in);
+        virtual sample_type * get_buffer(const nframes_type nframes_in) override;
+    };
+
+    class client : public backend {
+        // weak so the processor that handles this client can be freed once
+        // the render is done
+        std::weak_ptr<handlers> handler;
+        std::unique_ptr<wavfile::reader> input;
+        std::vector<std::shared_ptr<fileaudio::audio_port>> inputs;
+        std::vector<std::shared_ptr<fileaudio::audio_port>> outputs;
+        bool activated = false;
+        wavfile::size_type frames_done = 0;
+
+        public:
+        const std::string input_path;
+        const std::string output_path;
+        const nframes_type block_size;
+        const nframes_type raw_sample_rate;
+
+        client(const std::string input_path_in, const std::string output_path_in, const nframes_type block_size_in = default_block_size, const nframes_type raw_sample_rate_in = 48000);
+        virtual void open(std::shared_ptr<handlers> handler_in) override;
+        virtual void activate() override;
+        virtual bool is_realtime() override;
+        virtual nframes_type get_sample_rate() override;
+        virtual nframes_type get_buffer_size() override;
+        virtual int get_realtime_priority() override;
+        virtual float get_dsp_load() override;
+        virtual std::vector<std::string> get_known_port_names() override;
+        virtual std::shared_ptr<backend::audio_port> add_audio_input(const std::string name_in) override;
+        virtual std::shared_ptr<backend::audio_port> add_audio_output(const std::string name_in) override;
+        virtual int connect_port(const std::string source_in, const std::string dest_in) override;
+        // processes the whole input file
+        void run();
+        wavfile::size_type get_frames_done();
+    };
+};
+
+}
@@ -0,0 +1,890 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+#include "graph.h"
+
+namespace modpro {
+
+graph::sample_type * graph::make_buffer(const size_type size_in)
+{
+    assert(size_in > 0);
+    return memory->allocate_array<sample_type>(size_in);
+}
+
+// outside jack audio thread
+void graph::add_chain(std::shared_ptr<modpro::chain> chain_in, const std::vector<route> & routes_in, const size_type factor_in, const size_type silence_frames_in)
+{
+    chain_plan plan;
+
+    plan.chain = chain_in.get();
+    plan.factor = factor_in;
+    plan.phase = 0;
+    plan.running = true;
+    plan.fading_in = false;
+    plan.fading_out = false;
+    plan.active = true;
+    plan.stopped_by_ptt = false;
+    plan.silence_frames = silence_frames_in;
+    plan.silent_frames = 0;
+
+    plan.route_begin = routes.size();
+    plan.resampled_begin = resampled.size();
+    for (auto& i : routes_in) {
+        if (factor_in == 1) {
+            routes.push_back(i);
+        } else {
+            // the converter and buffer need the arena from finalize()
+            resampled.push_back({ i, nullptr, nullptr, nullptr });
+        }
+    }
+    plan.route_end = routes.size();
+    plan.resampled_end = resampled.size();
+
+    plan.step_begin = steps.size();
+    for (size_t i = 0; i < chain_in->run_list.size(); i++) {
+        std::vector<task_graph::task_type> successors;
+
+        for (auto j : chain_in->run_successors[i]) {
+            successors.push_back(plan.step_begin + j);
+        }
+
+        steps.push_back(chain_in->run_list[i].get());
+        step_chains.push_back(chains.size());
+        tasks.add_task(successors);
+    }
+    plan.step_end = steps.size();
+
+    std::map<std::string, size_type> step_of;
+    for (size_t i = 0; i < chain_in->run_names.size(); i++) {
+        step_of[chain_in->run_names[i]] = plan.step_begin + i;
+    }
+
+    // a chain input replaces whatever else is connected to the port every
+    // period so it can not share a port with another input or a wire
+    std::set<std::pair<effect *, effect::id_type>> routed;
+    for (auto& i : routes_in) {
+        if (! routed.insert(std::make_pair(i.target, i.port)).second) {
+            throw std::runtime_error("more than one input is routed to the same port in chain " + chain_in->name);
+        }
+    }
+
+    for (auto& i : chain_in->wires) {
+        wire_plan wire;
+        wire.producer = step_of[i.source];
+        wire.source_port = steps[wire.producer]->get_port_id(i.source_port);
+
+        for (auto& j : i.dests) {
+            auto consumer = step_of[j.effect];
+            auto port = steps[consumer]->get_port_id(j.port);
+
+            if (routed.count(std::make_pair(steps[consumer], port)) != 0) {
+                throw std::runtime_error("port is both wired and routed to an input: " + j.effect + "." + j.port);
+            }
+
+            wire.consumers.push_back({ consumer, port, j.gain });
+        }
+
+        wires.push_back(wire);
+    }
+
+    chains.push_back(plan);
+    owned_chains.push_back(chain_in);
+    owned_effects.insert(owned_effects.end(), chain_in->run_list.begin(), chain_in->run_list.end());
+}
+
+// outside jack audio thread
+graph::tap graph::make_tap(effect * target_in, const effect::id_type port_in, const bool is_audio_in)
+{
+    auto found = std::find(steps.begin(), steps.end(), target_in);
+
+    if (found == steps.end()) {
+        throw std::runtime_error("tapped effect is not part of the graph");
+    }
+
+    tap new_tap;
+
+    new_tap.step = found - steps.begin();
+    new_tap.port = port_in;
+    new_tap.is_audio = is_audio_in;
+    new_tap.is_input = false;
+    new_tap.buffer = nullptr;
+    new_tap.route = SIZE_MAX;
+    new_tap.slot = 0;
+    new_tap.stream = nullptr;
+
+    if (! is_audio_in) {
+        return new_tap;
+    }
+
+    bool connected = false;
+
+    for (auto& i : routes) {
+        if (i.target == target_in && i.port == port_in) {
+            new_tap.is_input = i.is_input;
+            connected = true;
+        }
+    }
+
+    for (auto& i : resampled) {
+        if (i.target.target == target_in && i.target.port == port_in) {
+            new_tap.is_input = i.target.is_input;
+            connected = true;
+        }
+    }
+
+    for (auto& i : wires) {
+        if (i.producer == new_tap.step && i.source_port == port_in) {
+            connected = true;
+        }
+
+        for (auto& j : i.consumers) {
+            if (j.step == new_tap.step && j.port == port_in) {
+                new_tap.is_input = true;
+                connected = true;
+            }
+        }
+    }
+
+    if (! connected) {
+        throw std::runtime_error("tapped port is not wired or routed");
+    }
+
+    return new_tap;
+}
+
+// outside jack audio thread
+void graph::add_meter(effect * target_in, const effect::id_type port_in, const bool is_audio_in, const size_type slot_in)
+{
+    auto new_tap = make_tap(target_in, port_in, is_audio_in);
+
+    new_tap.slot = slot_in;
+    taps.push_back(new_tap);
+}
+
+// outside jack audio thread
+void graph::add_recording(effect * target_in, const effect::id_type port_in, std::shared_ptr<recorder::stream> stream_in)
+{
+    auto new_tap = make_tap(target_in, port_in, true);
+
+    new_tap.stream = stream_in.get();
+    taps.push_back(new_tap);
+    owned_streams.push_back(stream_in);
+}
+
+// outside jack audio thread
+void graph::finalize(const size_type buffer_size_in, std::shared_ptr<arena> memory_in)
+{
+    memory = memory_in;
+    buffer_size = buffer_size_in;
+    tasks.finalize();
+    chain_steps_left = std::unique_ptr<std::atomic<size_type>[]>(new std::atomic<size_type>[chains.size()]);
+    chain_nframes = std::unique_ptr<backend::nframes_type[]>(new backend::nframes_type[chains.size()]);
+    allocate_buffers(buffer_size_in);
+
+    for (auto& i : chains) {
+        for (auto j = i.resampled_begin; j < i.resampled_end; j++) {
+            auto& route = resampled[j];
+            auto direction = route.target.is_input ? resampler::direction::down : resampler::direction::up;
+
+            route.converter = std::make_unique<resampler>(direction, i.factor, buffer_size_in, memory);
+            route.buffer = make_buffer(resampler::get_max_low_count(i.factor, buffer_size_in));
+            bindings.push_back({ route.target.target, route.target.port, route.buffer });
+        }
+    }
+
+    bind_unused();
+    place_taps();
+}
+
+// An effect reused from the last graph may have a port that is no longer
+// wired or routed. It would keep pointing into the buffers of the old graph
+// which are freed with it, so every audio port the graph has no other use
+// for is bound to a scratch buffer: inputs to one that is always silent and
+// outputs to one whose contents are thrown away.
+void graph::bind_unused()
+{
+    std::set<std::pair<effect *, effect::id_type>> used;
+    sample_type * silence = nullptr;
+    sample_type * discard = nullptr;
+
+    for (auto& i : bindings) {
+        used.insert(std::make_pair(i.target, i.port));
+    }
+
+    for (auto& i : routes) {
+        used.insert(std::make_pair(i.target, i.port));
+    }
+
+    for (auto step : steps) {
+        for (auto is_input : { true, false }) {
+            for (auto port : step->get_audio_ports(is_input)) {
+                if (used.count(std::make_pair(step, port)) != 0) {
+                    continue;
+                }
+
+                auto& scratch = is_input ? silence : discard;
+
+                if (scratch == nullptr) {
+                    scratch = make_buffer(buffer_size);
+                }
+
+                bindings.push_back({ step, port, scratch });
+            }
+        }
+    }
+}
+
+// finds the buffer behind every tapped audio port and groups the taps by
+// step
+void graph::place_taps()
+{
+    for (auto& i : taps) {
+        if (! i.is_audio) {
+            continue;
+        }
+
+        for (auto& j : bindings) {
+            if (j.target == steps[i.step] && j.port == i.port) {
+                i.buffer = j.buffer;
+            }
+        }
+
+        for (size_type j = 0; j < routes.size(); j++) {
+            if (routes[j].target == steps[i.step] && routes[j].port == i.port) {
+                i.route = j;
+            }
+        }
+    }
+
+    std::stable_sort(taps.begin(), taps.end(), [](const tap & a_in, const tap & b_in) -> bool {
+        return a_in.step < b_in.step;
+    });
+
+    tap_begin.assign(steps.size() + 1, 0);
+    for (auto& i : taps) {
+        tap_begin[i.step + 1]++;
+    }
+    for (size_type i = 0; i < steps.size(); i++) {
+        tap_begin[i + 1] += tap_begin[i];
+    }
+}
+
+// Gives every wire a buffer while sharing buffers between wires whose
+// lifetimes never overlap. A buffer can be handed to a new wire once its
+// last writer and every one of its readers are guaranteed to have finished
+// before the new wire is written. That is decided with the task graph
+// instead of the serial run order so the result is also safe when
+// branches run in parallel. The effect that writes a wire may also reuse
+// a buffer it reads itself unless the plugin can not process in place.
+//
+// Input ports with more than one wire, or a wire with a gain, become
+// junctions. A junction sums into a buffer of its own that is written at
+// the start of the step reading it unless one of its wires has no other
+// reader, in which case that wire's buffer is summed into in place.
+void graph::allocate_buffers(const size_type buffer_size_in)
+{
+    auto count = steps.size();
+    std::vector<std::vector<bool>> happens_before(count, std::vector<bool>(count, false));
+
+    // steps are topologically sorted so every successor is complete
+    // before the step itself is visited
+    for (auto i = count; i > 0; i--) {
+        auto step = i - 1;
+
+        for (auto j : tasks.get_successors(step)) {
+            happens_before[step][j] = true;
+
+            for (size_type k = 0; k < count; k++) {
+                if (happens_before[j][k]) {
+                    happens_before[step][k] = true;
+                }
+            }
+        }
+    }
+
+    struct input_plan {
+        size_type step;
+        effect::id_type port;
+        // wire numbers and the gain each one has into this input
+        std::vector<std::pair<size_type, sample_type>> sources;
+        // the wire whose buffer is summed into or SIZE_MAX
+        size_type fused = SIZE_MAX;
+    };
+
+    std::map<std::pair<size_type, effect::id_type>, input_plan> inputs;
+
+    for (size_type i = 0; i < wires.size(); i++) {
+        for (auto& j : wires[i].consumers) {
+            auto& input = inputs[std::make_pair(j.step, j.port)];
+            input.step = j.step;
+            input.port = j.port;
+            input.sources.push_back(std::make_pair(i, j.gain));
+        }
+    }
+
+    std::vector<input_plan> junction_plans;
+
+    for (auto& i : inputs) {
+        auto& input = i.second;
+
+        if (input.sources.size() == 1 && input.sources[0].second == 1) {
+            continue;
+        }
+
+        for (size_type j = 0; j < input.sources.size(); j++) {
+            if (wires[input.sources[j].first].consumers.size() == 1) {
+                input.fused = input.sources[j].first;
+                std::swap(input.sources[0], input.sources[j]);
+                break;
+            }
+        }
+
+        junction_plans.push_back(input);
+    }
+
+    auto is_junction_source = [&](const size_type step_in, const effect::id_type port_in) -> bool {
+        auto found = inputs.find(std::make_pair(step_in, port_in));
+        return found != inputs.end() && (found->second.sources.size() > 1 || found->second.sources[0].second != 1);
+    };
+
+    // each thing that needs a buffer is a wire or a junction with its own
+    // buffer; a junction is written by the step that reads it and is
+    // placed before the wires that step writes so they can run in place
+    struct allocation {
+        size_type producer;
+        bool is_junction;
+        size_type index;
+    };
+
+    std::vector<allocation> allocations;
+
+    for (size_type i = 0; i < wires.size(); i++) {
+        allocations.push_back({ wires[i].producer, false, i });
+    }
+
+    for (size_type i = 0; i < junction_plans.size(); i++) {
+        if (junction_plans[i].fused == SIZE_MAX) {
+            allocations.push_back({ junction_plans[i].step, true, i });
+        }
+    }
+
+    std::stable_sort(allocations.begin(), allocations.end(), [](const allocation & a_in, const allocation & b_in) -> bool {
+        if (a_in.producer != b_in.producer) {
+            return a_in.producer < b_in.producer;
+        }
+
+        return a_in.is_junction && ! b_in.is_junction;
+    });
+
+    struct buffer_user {
+        size_type writer;
+        std::vector<size_type> readers;
+        // written at the start of the writer step instead of while it runs
+        bool junction;
+    };
+
+    std::vector<buffer_user> users;
+    std::vector<sample_type *> wire_buffers(wires.size(), nullptr);
+    std::vector<sample_type *> junction_buffers(junction_plans.size(), nullptr);
+    size_type inplace_count = 0;
+
+    for (auto& i : allocations) {
+        auto producer = i.producer;
+        // the effect never sees the sources of a junction so only wires
+        // written by the effect care if it can run in place
+        auto inplace_ok = ! i.is_junction && ! steps[producer]->is_inplace_broken();
+        size_type chosen = users.size();
+        bool inplace = false;
+
+        for (size_type j = 0; j < users.size() && chosen == users.size(); j++) {
+            auto writer = users[j].writer;
+
+            if (! happens_before[writer][producer] && ! (users[j].junction && writer == producer && inplace_ok)) {
+                continue;
+            }
+
+            bool available = true;
+            bool reads_own_input = false;
+
+            for (auto reader : users[j].readers) {
+                if (reader == producer && inplace_ok) {
+                    reads_own_input = true;
+                } else if (! happens_before[reader][producer]) {
+                    available = false;
+                    break;
+                }
+            }
+
+            if (available) {
+                chosen = j;
+                inplace = reads_own_input;
+            }
+        }
+
+        if (chosen == users.size()) {
+            users.push_back({});
+            buffers.push_back(make_buffer(buffer_size_in));
+        }
+
+        if (inplace) {
+            inplace_count++;
+        }
+
+        users[chosen].writer = producer;
+        users[chosen].readers.clear();
+        users[chosen].junction = i.is_junction;
+
+        auto buffer = buffers[chosen];
+
+        if (i.is_junction) {
+            auto& plan = junction_plans[i.index];
+            junction_buffers[i.index] = buffer;
+            users[chosen].readers.push_back(plan.step);
+            bindings.push_back({ steps[plan.step], plan.port, buffer });
+            continue;
+        }
+
+        auto& wire = wires[i.index];
+        wire_buffers[i.index] = buffer;
+        bindings.push_back({ steps[producer], wire.source_port, buffer });
+
+        for (auto& j : wire.consumers) {
+            users[chosen].readers.push_back(j.step);
+
+            // a junction's output is what gets connected to its port
+            if (is_junction_source(j.step, j.port) && inputs[std::make_pair(j.step, j.port)].fused != i.index) {
+                continue;
+            }
+
+            bindings.push_back({ steps[j.step], j.port, buffer });
+        }
+    }
+
+    size_type fused_count = 0;
+
+    for (size_type i = 0; i < junction_plans.size(); i++) {
+        auto& plan = junction_plans[i];
+        junction new_junction;
+
+        new_junction.step = plan.step;
+        new_junction.fused = plan.fused != SIZE_MAX;
+        new_junction.output = new_junction.fused ? wire_buffers[plan.fused] : junction_buffers[i];
+        new_junction.source_begin = junction_sources.size();
+
+        for (auto& j : plan.sources) {
+            junction_sources.push_back({ wire_buffers[j.first], j.second });
+        }
+
+        new_junction.source_end = junction_sources.size();
+        junctions.push_back(new_junction);
+
+        if (new_junction.fused) {
+            fused_count++;
+        }
+    }
+
+    std::stable_sort(junctions.begin(), junctions.end(), [](const junction & a_in, const junction & b_in) -> bool {
+        return a_in.step < b_in.step;
+    });
+
+    junction_begin.assign(count + 1, 0);
+    for (auto& i : junctions) {
+        junction_begin[i.step + 1]++;
+    }
+    for (size_type i = 0; i < count; i++) {
+        junction_begin[i + 1] += junction_begin[i];
+    }
+
+    std::cout << "Wire buffers: " << wires.size() << " wires share " << buffers.size() << " buffers";
+    std::cout << " (" << inplace_count << " processed in place)" << std::endl;
+
+    if (junctions.size() > 0) {
+        std::cout << "Summing junctions: " << junctions.size() << " (" << fused_count << " summed in place)" << std::endl;
+    }
+}
+
+// inside jack audio thread or before the graph is handed to it
+void graph::bind()
+{
+    for (auto& i : bindings) {
+        i.target->connect(i.port, i.buffer);
+    }
+
+    // a chain the graph this one replaces had stopped stays stopped
+    for (auto& i : chains) {
+        auto suspended = i.chain->suspended.load(std::memory_order_relaxed);
+
+        if (suspended != chain::not_suspended) {
+            i.running = false;
+            i.stopped_by_ptt = suspended == chain::suspended_by_ptt;
+        }
+
+        // and does not wait out the hold again before it can be suspended
+        if (suspended == chain::suspended_by_silence) {
+            i.silent_frames = i.silence_frames;
+        }
+    }
+}
+
+// inside jack audio thread
+void graph::run(const backend::nframes_type nframes_in, worker_pool * workers_in, const bool transmitting_in)
+{
+    plugin_ns.store(0, std::memory_order_relaxed);
+
+    // if JACK grew the buffer size this graph keeps working by running in
+    // pieces until a graph with bigger buffers is swapped in
+    for (backend::nframes_type offset = 0; offset < nframes_in; offset += buffer_size) {
+        backend::nframes_type block_size = std::min(buffer_size, size_type(nframes_in - offset));
+        run_block(nframes_in, offset, block_size, transmitting_in, workers_in);
+    }
+}
+
+// inside jack audio thread
+timing::ns_type graph::get_plugin_time()
+{
+    return plugin_ns.load(std::memory_order_relaxed);
+}
+
+// inside jack audio thread
+void graph::run_block(const backend::nframes_type nframes_in, const backend::nframes_type offset_in, const backend::nframes_type block_size_in, const bool transmitting_in, worker_pool * workers_in)
+{
+    current_nframes = block_size_in;
+    current_start = timing::now();
+
+    // JACK does not gurantee buffers wont change between calls to the
+    // process handler
+    for (auto& i : routes) {
+        i.port_buffer = i.port_p->get_buffer(nframes_in) + offset_in;
+        i.target->connect(i.port, i.port_buffer);
+    }
+
+    for (auto& i : resampled) {
+        i.port_buffer = i.target.port_p->get_buffer(nframes_in) + offset_in;
+    }
+
+    // the silence detector needs the input buffers
+    update_running(transmitting_in);
+
+    for (auto& i : taps) {
+        if (i.route != SIZE_MAX) {
+            i.buffer = routes[i.route].port_p->get_buffer(nframes_in) + offset_in;
+        }
+    }
+
+    for (size_t i = 0; i < chains.size(); i++) {
+        auto& plan = chains[i];
+
+        chain_steps_left[i].store(plan.step_end - plan.step_begin, std::memory_order_relaxed);
+        chain_nframes[i] = resampler::get_low_count(plan.factor, plan.phase, block_size_in);
+
+        for (auto j = plan.resampled_begin; j < plan.resampled_end && plan.running; j++) {
+            auto& route = resampled[j];
+
+            if (route.target.is_input) {
+                route.converter->decimate(route.port_buffer, block_size_in, plan.phase, route.buffer);
+            }
+        }
+    }
+
+    if (workers_in == nullptr) {
+        for (size_type i = 0; i < steps.size(); i++) {
+            run_step(i);
+        }
+    } else {
+        workers_in->run(tasks, run_step_task, this);
+    }
+
+    for (auto& i : chains) {
+        i.phase = (i.phase + block_size_in) % i.factor;
+
+        if (i.fading_out) {
+            i.running = false;
+            i.stopped_by_ptt = true;
+
+            // before suspended so a suspended chain that is not pending
+            // was not stopped by PTT
+            if (i.chain->restart_effects) {
+                i.chain->restart_pending.store(true, std::memory_order_release);
+            }
+
+            i.chain->suspended.store(chain::suspended_by_ptt, std::memory_order_release);
+
+            silence_meters(i);
+        }
+
+        if (! i.running && sample_rate != 0) {
+            auto& suspended_ns = i.active ? i.chain->silence_suspended_ns : i.chain->ptt_suspended_ns;
+            suspended_ns.fetch_add(timing::ns_type(block_size_in) * 1000000000 / sample_rate, std::memory_order_relaxed);
+        }
+    }
+}
+
+// inside jack audio thread
+void graph::update_running(const bool transmitting_in)
+{
+    for (auto& plan : chains) {
+        plan.active = plan.chain->is_active(transmitting_in);
+        plan.fading_in = false;
+        plan.fading_out = false;
+
+        if (plan.silence_frames != 0) {
+            plan.silent_frames = is_silent(plan) ? plan.silent_frames + current_nframes : 0;
+        }
+
+        auto quiet = plan.silence_frames != 0 && plan.silent_frames >= plan.silence_frames;
+
+        if (plan.running && ! plan.active) {
+            // stops after this block
+            plan.fading_out = true;
+        } else if (plan.running && quiet) {
+            plan.running = false;
+            plan.chain->suspended.store(chain::suspended_by_silence, std::memory_order_release);
+            silence_meters(plan);
+        } else if (! plan.running && plan.active && ! quiet && ! plan.chain->restart_pending.load(std::memory_order_acquire)) {
+            plan.running = true;
+            plan.chain->suspended.store(chain::not_suspended, std::memory_order_relaxed);
+            plan.fading_in = plan.stopped_by_ptt;
+            plan.stopped_by_ptt = false;
+        }
+    }
+}
+
+// inside jack audio thread
+//
+// A chain with no inputs is never silent.
+bool graph::is_silent(const chain_plan & plan_in)
+{
+    auto threshold = plan_in.chain->silence_threshold;
+    bool has_input = false;
+
+    for (auto i = plan_in.route_begin; i < plan_in.route_end; i++) {
+        if (! routes[i].is_input) {
+            continue;
+        }
+
+        if (kernels.exceeds(routes[i].port_buffer, current_nframes, threshold)) {
+            return false;
+        }
+
+        has_input = true;
+    }
+
+    for (auto i = plan_in.resampled_begin; i < plan_in.resampled_end; i++) {
+        if (! resampled[i].target.is_input) {
+            continue;
+        }
+
+        if (kernels.exceeds(resampled[i].port_buffer, current_nframes, threshold)) {
+            return false;
+        }
+
+        has_input = true;
+    }
+
+    return has_input;
+}
+
+// inside jack audio thread or a worker thread
+void graph::run_step_task(void * graph_in, const size_t index_in)
+{
+    static_cast<graph *>(graph_in)->run_step(index_in);
+}
+
+// inside jack audio thread or a worker thread
+void graph::run_step(const size_type step_in)
+{
+    auto step = steps[step_in];
+    auto chain_num = step_chains[step_in];
+    auto nframes = chain_nframes[chain_num];
+    auto running = chains[chain_num].running;
+
+    if (running) {
+        for (auto i = junction_begin[step_in]; i < junction_begin[step_in + 1]; i++) {
+            sum_junction(junctions[i], nframes);
+        }
+
+        // an effect that runs in place overwrites its inputs
+        run_taps(step_in, true, nframes);
+
+        auto start = timing::now();
+
+        // a chain at a lower rate can have nothing to do in a short block
+        if (nframes > 0) {
+            step->run(nframes);
+        }
+
+        auto end = timing::now();
+
+        run_taps(step_in, false, nframes);
+        step->run_time.record(end - start);
+        plugin_ns.fetch_add(end - start, std::memory_order_relaxed);
+    } else {
+        silence_streams(step_in, nframes);
+    }
+
+    // the last step of a chain to finish records how long the chain took
+    // from the start of the period
+    if (chain_steps_left[chain_num].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        finish_chain(chain_num);
+
+        if (running) {
+            chains[chain_num].chain->run_time.record(timing::now() - current_start);
+        }
+    }
+}
+
+// inside jack audio thread or a worker thread
+void graph::finish_chain(const size_type chain_in)
+{
+    auto& plan = chains[chain_in];
+
+    if (! plan.running) {
+        silence_outputs(plan);
+        return;
+    }
+
+    for (auto i = plan.resampled_begin; i < plan.resampled_end; i++) {
+        auto& route = resampled[i];
+
+        if (! route.target.is_input) {
+            route.converter->interpolate(route.buffer, chain_nframes[chain_in], route.port_buffer, current_nframes, plan.phase);
+        }
+    }
+
+    if (plan.fading_in || plan.fading_out) {
+        fade_outputs(plan, plan.fading_in);
+    }
+}
+
+// inside jack audio thread or a worker thread
+void graph::fade_outputs(const chain_plan & plan_in, const bool fade_in_in)
+{
+    sample_type step = sample_type(1) / current_nframes;
+    sample_type gain = fade_in_in ? step : 1 - step;
+
+    auto fade = [&](sample_type * buffer_in) -> void {
+        kernels.ramp(buffer_in, buffer_in, gain, fade_in_in ? step : -step, current_nframes);
+    };
+
+    for (auto i = plan_in.route_begin; i < plan_in.route_end; i++) {
+        if (! routes[i].is_input) {
+            fade(routes[i].port_buffer);
+        }
+    }
+
+    for (auto i = plan_in.resampled_begin; i < plan_in.resampled_end; i++) {
+        if (! resampled[i].target.is_input) {
+            fade(resampled[i].port_buffer);
+        }
+    }
+}
+
+// inside jack audio thread or a worker thread
+//
+// JACK does not promise an output buffer still holds what was written to it
+// last period so the silence is written every period.
+void graph::silence_outputs(const chain_plan & plan_in)
+{
+    for (auto i = plan_in.route_begin; i < plan_in.route_end; i++) {
+        if (! routes[i].is_input) {
+            std::fill(routes[i].port_buffer, routes[i].port_buffer + current_nframes, 0);
+        }
+    }
+
+    for (auto i = plan_in.resampled_begin; i < plan_in.resampled_end; i++) {
+        if (! resampled[i].target.is_input) {
+            std::fill(resampled[i].port_buffer, resampled[i].port_buffer + current_nframes, 0);
+        }
+    }
+}
+
+// inside jack audio thread
+//
+// The meters of a chain that stopped running would otherwise keep showing
+// the last level they measured.
+void graph::silence_meters(const chain_plan & plan_in)
+{
+    for (auto i = tap_begin[plan_in.step_begin]; i < tap_begin[plan_in.step_end]; i++) {
+        if (taps[i].is_audio && taps[i].stream == nullptr) {
+            meter_readings->set_value(taps[i].slot, 0);
+        }
+    }
+}
+
+// inside jack audio thread or a worker thread
+void graph::run_taps(const size_type step_in, const bool inputs_in, const backend::nframes_type nframes_in)
+{
+    for (auto i = tap_begin[step_in]; i < tap_begin[step_in + 1]; i++) {
+        auto& tap = taps[i];
+
+        if (tap.is_input != inputs_in) {
+            continue;
+        }
+
+        if (! tap.is_audio) {
+            meter_readings->set_value(tap.slot, steps[step_in]->get_control(tap.port));
+        } else if (nframes_in == 0) {
+            continue;
+        } else if (tap.stream != nullptr) {
+            tap.stream->push(tap.buffer, nframes_in);
+        } else {
+            meter_readings->measure(tap.slot, tap.buffer, nframes_in);
+        }
+    }
+}
+
+// inside jack audio thread or a worker thread
+//
+// Recordings of a chain that is not running get silence so the files stay
+// as long as the time they cover.
+void graph::silence_streams(const size_type step_in, const backend::nframes_type nframes_in)
+{
+    if (nframes_in == 0) {
+        return;
+    }
+
+    for (auto i = tap_begin[step_in]; i < tap_begin[step_in + 1]; i++) {
+        if (taps[i].stream != nullptr) {
+            taps[i].stream->push_silence(nframes_in);
+        }
+    }
+}
+
+// inside jack audio thread or a worker thread
+void graph::sum_junction(const junction & junction_in, const backend::nframes_type nframes_in)
+{
+    auto output = junction_in.output;
+    auto& first = junction_sources[junction_in.source_begin];
+
+    if (! junction_in.fused) {
+        kernels.scale(output, first.buffer, first.gain, nframes_in);
+    } else if (first.gain != 1) {
+        kernels.scale(output, output, first.gain, nframes_in);
+    }
+
+    for (auto i = junction_in.source_begin + 1; i < junction_in.source_end; i++) {
+        kernels.mix(output, junction_sources[i].buffer, junction_sources[i].gain, nframes_in);
+    }
+}
+
+}
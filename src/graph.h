@@ -0,0 +1,228 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "arena.h"
+#include "backend.h"
+#include "chain.h"
+#include "effect.h"
+#include "meter.h"
+#include "recorder.h"
+#include "resampler.h"
+#include "simd.h"
+#include "workers.h"
+
+namespace modpro {
+
+// The compiled form of every chain. Everything the JACK process callback
+// needs is resolved ahead of time into flat arrays of raw pointers and
+// integer port numbers so running the graph never touches a string, a map
+// or a shared_ptr reference count.
+struct graph {
+    using sample_type = effect::sample_type;
+    using size_type = effect::size_type;
+
+    struct route {
+        effect * target;
+        effect::id_type port;
+        backend::audio_port * port_p;
+        bool is_input;
+        // the backend buffer for the block being processed
+        sample_type * port_buffer;
+    };
+
+    // a route of a chain that runs at a lower rate than the backend; the
+    // effect port is bound to buffer and the converter moves samples
+    // between it and the backend port
+    struct resampled_route {
+        route target;
+        std::unique_ptr<resampler> converter;
+        sample_type * buffer;
+        // the backend buffer for the block being processed
+        sample_type * port_buffer;
+    };
+
+    struct binding {
+        effect * target;
+        effect::id_type port;
+        sample_type * buffer;
+    };
+
+    struct wire_consumer {
+        size_type step;
+        effect::id_type port;
+        sample_type gain;
+    };
+
+    // a wire with the step numbers of the effect that writes it and of
+    // every effect that reads it
+    struct wire_plan {
+        size_type producer;
+        effect::id_type source_port;
+        std::vector<wire_consumer> consumers;
+    };
+
+    struct junction_source {
+        sample_type * buffer;
+        sample_type gain;
+    };
+
+    // An input port fed by more than one wire or by a wire with a gain.
+    // The sources are summed into the output buffer by the step that reads
+    // the port right before the effect runs. When one of the sources is a
+    // wire nothing else reads its buffer is used as the output and the
+    // sum is done in place; that source is always the first one.
+    struct junction {
+        size_type step;
+        sample_type * output;
+        size_type source_begin;
+        size_type source_end;
+        bool fused;
+    };
+
+    // an effect port that is metered or recorded; inputs are tapped
+    // before the step runs and outputs after
+    struct tap {
+        size_type step;
+        effect::id_type port;
+        // control ports have their value copied instead of measured
+        bool is_audio;
+        bool is_input;
+        sample_type * buffer;
+        // the route that brings a new buffer every block or SIZE_MAX
+        size_type route;
+        // the samples go to stream when it is set and to the meter_readings
+        // slot otherwise
+        size_type slot;
+        recorder::stream * stream;
+    };
+
+    struct chain_plan {
+        modpro::chain * chain;
+        size_type route_begin;
+        size_type route_end;
+        size_type step_begin;
+        size_type step_end;
+        size_type resampled_begin;
+        size_type resampled_end;
+        // backend samples per chain sample and where the next block
+        // starts on the resampler clock
+        size_type factor;
+        size_type phase;
+        // a chain that is not running has its steps skipped and its outputs
+        // filled with silence. When PTT starts or stops it the outputs fade
+        // in over the first block it runs again and out over the last block
+        // before it stops; silence starts and stops it right away.
+        bool running;
+        bool fading_in;
+        bool fading_out;
+        // if PTT lets the chain run and if PTT was what last stopped it
+        bool active;
+        bool stopped_by_ptt;
+        // backend samples of silent input before the chain is suspended or
+        // 0 to never suspend it, and how many there have been so far
+        size_type silence_frames;
+        size_type silent_frames;
+    };
+
+    std::vector<route> routes;
+    std::vector<resampled_route> resampled;
+    std::vector<effect *> steps;
+    // the chain_plan each step belongs to
+    std::vector<size_type> step_chains;
+    std::vector<chain_plan> chains;
+    // every step is a task; wires between effects are the edges
+    task_graph tasks;
+    std::vector<wire_plan> wires;
+    std::vector<binding> bindings;
+    std::vector<junction> junctions;
+    std::vector<junction_source> junction_sources;
+    // the junctions of step N are junction_begin[N] up to junction_begin[N + 1]
+    std::vector<size_type> junction_begin;
+    std::vector<sample_type *> buffers;
+    std::vector<tap> taps;
+    // the taps of step N are tap_begin[N] up to tap_begin[N + 1]
+    std::vector<size_type> tap_begin;
+    std::shared_ptr<meter_bank> meter_readings;
+    std::shared_ptr<arena> memory;
+    // the number of samples each wire buffer holds
+    size_type buffer_size = 0;
+    // the backend rate; only used to count how long chains are suspended
+    size_type sample_rate = 0;
+
+    // keeps everything referenced above alive for as long as the graph
+    // exists; never used from inside the jack audio thread
+    std::vector<std::shared_ptr<modpro::chain>> owned_chains;
+    std::vector<std::shared_ptr<effect>> owned_effects;
+    std::vector<std::shared_ptr<recorder::stream>> owned_streams;
+
+    private:
+    backend::nframes_type current_nframes = 0;
+    timing::ns_type current_start = 0;
+    std::unique_ptr<std::atomic<size_type>[]> chain_steps_left;
+    // how many samples each chain runs for in the current block
+    std::unique_ptr<backend::nframes_type[]> chain_nframes;
+    // time spent inside effects during the current call to run()
+    std::atomic<timing::ns_type> plugin_ns = ATOMIC_VAR_INIT(0);
+    const simd::kernels & kernels = simd::get();
+
+    static void run_step_task(void * graph_in, const size_t index_in);
+    void run_step(const size_type step_in);
+    void sum_junction(const junction & junction_in, const backend::nframes_type nframes_in);
+    void run_taps(const size_type step_in, const bool inputs_in, const backend::nframes_type nframes_in);
+    void silence_streams(const size_type step_in, const backend::nframes_type nframes_in);
+    tap make_tap(effect * target_in, const effect::id_type port_in, const bool is_audio_in);
+    void bind_unused();
+    void place_taps();
+    void finish_chain(const size_type chain_in);
+    void fade_outputs(const chain_plan & plan_in, const bool fade_in_in);
+    void silence_outputs(const chain_plan & plan_in);
+    void silence_meters(const chain_plan & plan_in);
+    bool is_silent(const chain_plan & plan_in);
+    void update_running(const bool transmitting_in);
+    void run_block(const backend::nframes_type nframes_in, const backend::nframes_type offset_in, const backend::nframes_type block_size_in, const bool transmitting_in, worker_pool * workers_in);
+    void allocate_buffers(const size_type buffer_size_in);
+
+    public:
+    sample_type * make_buffer(const size_type size_in);
+    // a factor above 1 runs the effects of the chain at the backend rate
+    // divided by it with resamplers on every route; silence_frames_in is
+    // how many backend samples every input has to stay at or below the
+    // silence threshold of the chain before it is suspended
+    void add_chain(std::shared_ptr<modpro::chain> chain_in, const std::vector<route> & routes_in, const size_type factor_in = 1, const size_type silence_frames_in = 0);
+    // meters a port of an effect in a chain that was already added; the
+    // port must be wired or routed if it is audio
+    void add_meter(effect * target_in, const effect::id_type port_in, const bool is_audio_in, const size_type slot_in);
+    // copies every block an audio port sees into the stream
+    void add_recording(effect * target_in, const effect::id_type port_in, std::shared_ptr<recorder::stream> stream_in);
+    void finalize(const size_type buffer_size_in, std::shared_ptr<arena> memory_in);
+    // connects every wire to its buffer; must be called before the graph
+    // runs for the first time
+    void bind();
+    // effects that do not depend on each other, including every effect in
+    // different chains, are run in parallel when there is a worker pool;
+    // chains that are only active on transmit or receive run according to
+    // transmitting_in
+    void run(const backend::nframes_type nframes_in, worker_pool * workers_in = nullptr, const bool transmitting_in = false);
+    // how long effects ran for during the last call to run()
+    timing::ns_type get_plugin_time();
+};
+
+}
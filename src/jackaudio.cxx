@@ -24,8 +24,8 @@
 
 namespace modpro {
 
-jackaudio::client::client(const std::string name_in, std::shared_ptr<handlers> handler_in)
-: handler(handler_in), name(name_in)
+jackaudio::client::client(const std::string name_in)
+: name(name_in)
 {
 
 }
@@ -50,6 +50,14 @@ static int wrap_nframes_cb(jack_nframes_t nframes, void * arg)
     return 0;
 }
 
+static int wrap_int_cb(void * arg)
+{
+    auto p = static_cast<std::function<void(void)> *>(arg);
+    auto cb = *p;
+    cb();
+    return 0;
+}
+
 static void wrap_void_cb(void * arg)
 {
     // FIXME what is the syntax to cast/dereference this well?
@@ -74,8 +82,9 @@ static void wrap_uint32_int_cb(const uint32_t uint32_in, const int register_in,
     cb(uint32_in, register_in);
 }
 
-void jackaudio::client::open()
+void jackaudio::client::open(std::shared_ptr<handlers> handler_in)
 {
+    handler = handler_in;
     client_p = jack_client_open(name.c_str(), options, 0);
 
     if (client_p == nullptr) {
@@ -90,7 +99,7 @@ void jackaudio::client::open()
         client_p,
         wrap_nframes_cb,
         static_cast<void *>(new std::function<void(jack_nframes_t)>([this](jack_nframes_t nframes_in) -> void {
-            auto lock = get_lock();
+            // never lock inside the audio thread; see audio::processor::command
             handler->handle_process(nframes_in);
     }))))
     {
@@ -127,6 +136,18 @@ void jackaudio::client::open()
         throw std::runtime_error("could not set jack buffer size callback");
     }
 
+    // FIXME leaks memory because the std::function never gets delete called
+    if(jack_set_xrun_callback(
+        client_p,
+        wrap_int_cb,
+        static_cast<void *>(new std::function<void(void)>([this]() -> void {
+            // never lock; this can run in the audio thread
+            this->handler->handle_xrun();
+    }))))
+    {
+        throw std::runtime_error("could not set jack xrun callback");
+    }
+
     // FIXME leaks memory because the std::function never gets delete called
     // does not have a return value
     jack_on_shutdown(
@@ -194,6 +215,11 @@ void jackaudio::client::activate()
     }
 }
 
+bool jackaudio::client::is_realtime()
+{
+    return true;
+}
+
 jackaudio::nframes_type jackaudio::client::get_sample_rate()
 {
     assert(client_p != nullptr);
@@ -206,6 +232,20 @@ jackaudio::nframes_type jackaudio::client::get_buffer_size()
     return buffer_size;
 }
 
+// returns 0 if JACK is not running realtime
+int jackaudio::client::get_realtime_priority()
+{
+    assert(client_p != nullptr);
+    auto priority = jack_client_real_time_priority(client_p);
+    return priority < 0 ? 0 : priority;
+}
+
+float jackaudio::client::get_dsp_load()
+{
+    assert(client_p != nullptr);
+    return jack_cpu_load(client_p);
+}
+
 std::vector<std::string> jackaudio::client::get_known_port_names()
 {
     const char ** known_ports = jack_get_ports(client_p, ".", ".", 0);
@@ -253,13 +293,13 @@ jackaudio::port_type * jackaudio::client::register_port(const std::string name_i
     return new_jack_port;
 }
 
-std::shared_ptr<jackaudio::audio_port> jackaudio::client::add_audio_input(const std::string name_in)
+std::shared_ptr<backend::audio_port> jackaudio::client::add_audio_input(const std::string name_in)
 {
     auto new_port = register_port(name_in, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput);
     return jackaudio::audio_port::make(this->shared_from_this(), new_port);
 }
 
-std::shared_ptr<jackaudio::audio_port> jackaudio::client::add_audio_output(const std::string name_in)
+std::shared_ptr<backend::audio_port> jackaudio::client::add_audio_output(const std::string name_in)
 {
     auto new_port = register_port(name_in, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput);
     return jackaudio::audio_port::make(this->shared_from_this(), new_port);
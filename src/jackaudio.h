@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -23,6 +24,8 @@ extern "C" {
 #include <jack/jack.h>
 }
 
+#include "backend.h"
+
 namespace modpro {
 
 struct jackaudio {
@@ -35,18 +38,9 @@ struct jackaudio {
     class audio_port;
     class port;
 
-    struct handlers {
-        virtual void handle_shutdown() = 0;
-        virtual void handle_process(nframes_type nframes_in) = 0;
-        virtual void handle_client_register(const std::string client_name_in) = 0;
-        virtual void handle_client_unregister(const std::string client_name_in) = 0;
-        virtual void handle_port_register(const uint32_t port_id_in) = 0;
-        virtual void handle_port_unregister(const uint32_t port_id_in) = 0;
-        virtual void handle_sample_rate_change(nframes_type rate_in) = 0;
-        virtual void handle_buffer_size_change(nframes_type buffer_size_in) = 0;
-    };
+    using handlers = backend::handlers;
 
-    class client : public std::enable_shared_from_this<client> {
+    class client : public backend, public std::enable_shared_from_this<client> {
         friend port;
 
         std::mutex jack_mutex;
@@ -57,12 +51,12 @@ struct jackaudio {
         port_type * register_port(const std::string name_in, const char * port_type_in, unsigned long flags_in, unsigned long buffer_size_in);
 
         public:
-        nframes_type sample_rate = 0;
-        nframes_type buffer_size = 0;
+        std::atomic<nframes_type> sample_rate = ATOMIC_VAR_INIT(0);
+        std::atomic<nframes_type> buffer_size = ATOMIC_VAR_INIT(0);
         const std::string name;
         const options_type options = JackNoStartServer;
 
-        client(const std::string name_in, std::shared_ptr<handlers> handler_in);
+        client(const std::string name_in);
         virtual ~client();
         template<typename... Args>
         static std::shared_ptr<client> make(Args... args)
@@ -70,15 +64,18 @@ struct jackaudio {
             return std::make_shared<client>(args...);
         }
         std::unique_lock<std::mutex> get_lock();
-        void open();
-        void activate();
-        nframes_type get_sample_rate();
-        nframes_type get_buffer_size();
+        virtual void open(std::shared_ptr<handlers> handler_in) override;
+        virtual void activate() override;
+        virtual bool is_realtime() override;
+        virtual nframes_type get_sample_rate() override;
+        virtual nframes_type get_buffer_size() override;
+        virtual int get_realtime_priority() override;
+        virtual float get_dsp_load() override;
         std::vector<std::string> get_known_client_names();
-        std::vector<std::string> get_known_port_names();
-        std::shared_ptr<audio_port> add_audio_input(const std::string name_in);
-        std::shared_ptr<audio_port> add_audio_output(const std::string name_in);
-        int connect_port(const std::string source_in, const std::string dest_in);
+        virtual std::vector<std::string> get_known_port_names() override;
+        virtual std::shared_ptr<backend::audio_port> add_audio_input(const std::string name_in) override;
+        virtual std::shared_ptr<backend::audio_port> add_audio_output(const std::string name_in) override;
+        virtual int connect_port(const std::string source_in, const std::string dest_in) override;
     };
 
     class port  {
@@ -93,7 +90,7 @@ struct jackaudio {
         virtual nframes_type get_buffer_bytes(const nframes_type buffer_size_in) = 0;
     };
 
-    struct audio_port : public port, std::enable_shared_from_this<audio_port> {
+    struct audio_port : public port, public backend::audio_port, std::enable_shared_from_this<audio_port> {
         audio_port(std::shared_ptr<jackaudio::client> client_in, port_type * port_p_in)
         : port(client_in, port_p_in) { }
         template<typename... Args>
@@ -101,7 +98,7 @@ struct jackaudio {
         {
             return std::make_shared<audio_port>(args...);
         }
-        audio_sample_type * get_buffer(const nframes_type nframes_in);
+        virtual audio_sample_type * get_buffer(const nframes_type nframes_in) override;
         virtual nframes_type get_buffer_bytes(const nframes_type buffer_size_in) override;
         void copy_into(audio_sample_type * dest_in, nframes_type nframes_in);
         void copy_into(std::shared_ptr<audio_port> dest_in, nframes_type nframes_in);
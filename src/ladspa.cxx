@@ -14,6 +14,7 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
 #include <dlfcn.h>
 #include <iostream>
@@ -21,50 +22,68 @@
 
 #include "event.h"
 #include "ladspa.h"
+#include "plugincache.h"
+#include "timing.h"
 
 #define DESCRIPTOR_SYMBOL "ladspa_descriptor"
 
 namespace modpro {
 
+void ladspa::set_cache(std::shared_ptr<plugin_cache> cache_in)
+{
+    cache = cache_in;
+}
+
 ladspa::file * ladspa::open(const std::string path_in)
 {
     if (loaded_files.count(path_in)) {
         throw std::runtime_error("attempt to open file twice: " + path_in);
     }
 
-    std::cout << "Loading plugin: " << path_in << std::endl;
-
     auto new_file = new ladspa::file(path_in);
+    std::vector<type_info> infos;
+
+    if (cache != nullptr && cache->lookup(path_in, infos)) {
+        std::cout << "Plugin metadata from cache: " << path_in;
+    } else {
+        infos = new_file->scan();
+        std::cout << "Scanned plugin: " << path_in;
+
+        if (cache != nullptr) {
+            cache->store(path_in, infos);
+        }
+    }
+
+    std::cout << " (" << infos.size() << " types)" << std::endl;
+
     loaded_files[path_in] = new_file;
 
-    for(auto i : new_file->get_types()) {
-        auto imported_id = i.second->get_id();
-        auto imported_name = i.second->get_name();
+    for(auto& i : infos) {
+        auto imported_id = i.id;
+        auto imported_name = i.name;
 
         if (loaded_types.count(imported_id) != 0) {
-            throw std::runtime_error("attempt to register duplicated id: " + imported_id);
+            throw std::runtime_error("attempt to register duplicated id: " + std::to_string(imported_id));
         }
 
         if (name_to_id.count(imported_name) != 0) {
             throw std::runtime_error("attempt to register duplicate name: " + imported_name);
         }
 
-        loaded_types.insert(std::make_pair(imported_id, i.second));
+        auto new_type = new ladspa::type(i, new_file);
+        new_file->types[imported_id] = new_type;
+        loaded_types.insert(std::make_pair(imported_id, new_type));
         name_to_id.insert(std::make_pair(imported_name, imported_id));
-
-        std::cout << "  " << i.second->get_id() << " " << i.second->get_name() << std::endl;
-        for(auto j : i.second->get_ports()) {
-            std::cout << "    Port # " << j->number << " " << j->get_name() << std::endl;
-        }
-
-        std::cout << std::endl;
     }
 
-    std::cout << std::endl;
-
     return new_file;
 }
 
+bool ladspa::has_type(const std::string name_in)
+{
+    return name_to_id.count(name_in) != 0;
+}
+
 ladspa::type * ladspa::get_type(const id_type id_in)
 {
     if (loaded_types.count(id_in) == 0) {
@@ -74,23 +93,44 @@ ladspa::type * ladspa::get_type(const id_type id_in)
     return loaded_types[id_in];
 }
 
-std::shared_ptr<ladspa::instance> ladspa::instantiate(const id_type id_in, const size_type sample_rate_in, const std::string dbus_name_in, std::shared_ptr<dbus> dbus_broker_in)
-{
-    return get_type(id_in)->instantiate(sample_rate_in, dbus_name_in, dbus_broker_in);
-}
-
-std::shared_ptr<ladspa::instance> ladspa::instantiate(const std::string name_in, const size_type sample_rate_in, const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in)
+ladspa::type * ladspa::get_type(const std::string name_in)
 {
     if (name_to_id.count(name_in) == 0) {
         throw std::runtime_error("could not find plugin by name: " + name_in);
     }
 
-    return instantiate(name_to_id[name_in], sample_rate_in, dbus_path_in, dbus_broker_in);
+    return get_type(name_to_id[name_in]);
+}
+
+std::shared_ptr<ladspa::instance> ladspa::instantiate(const id_type id_in, const size_type sample_rate_in, std::shared_ptr<arena> memory_in)
+{
+    return get_type(id_in)->instantiate(sample_rate_in, memory_in);
+}
+
+std::shared_ptr<ladspa::instance> ladspa::instantiate(const std::string name_in, const size_type sample_rate_in, std::shared_ptr<arena> memory_in)
+{
+    return get_type(name_in)->instantiate(sample_rate_in, memory_in);
 }
 
 ladspa::file::file(const std::string path_in) : path(path_in)
 {
-    handle = dlopen(path_in.c_str(), RTLD_NOW);
+
+}
+
+bool ladspa::file::is_loaded()
+{
+    return handle != nullptr;
+}
+
+void ladspa::file::load()
+{
+    if (is_loaded()) {
+        return;
+    }
+
+    auto start = timing::now();
+
+    handle = dlopen(path.c_str(), RTLD_NOW);
     if (handle == NULL) {
         throw std::runtime_error("could not dlopen(" + path + ")");
     }
@@ -102,9 +142,48 @@ ladspa::file::file(const std::string path_in) : path(path_in)
 
     const LADSPA_Descriptor * p;
     for(long i = 0; (p = descriptor_fn(i)) != NULL; i++) {
-        auto new_type = new ladspa::type(p, this);
-        types[new_type->get_id()] = new_type;
+        descriptors[p->UniqueID] = p;
+    }
+
+    std::cout << "Loaded plugin: " << path << " in " << (timing::now() - start) / 1000000.0 << " ms" << std::endl;
+}
+
+// loads the library and reads the metadata of every type in it
+std::vector<ladspa::type_info> ladspa::file::scan()
+{
+    std::vector<type_info> retval;
+
+    load();
+
+    for (auto& i : descriptors) {
+        auto descriptor = i.second;
+        type_info info;
+
+        info.id = descriptor->UniqueID;
+        info.name = descriptor->Name;
+        info.label = descriptor->Label;
+        info.properties = descriptor->Properties;
+
+        for (unsigned long j = 0; j < descriptor->PortCount; j++) {
+            auto& hint = descriptor->PortRangeHints[j];
+            info.ports.push_back({ descriptor->PortNames[j], descriptor->PortDescriptors[j], hint.HintDescriptor, hint.LowerBound, hint.UpperBound });
+        }
+
+        retval.push_back(info);
     }
+
+    return retval;
+}
+
+const LADSPA_Descriptor * ladspa::file::get_descriptor(const id_type id_in)
+{
+    load();
+
+    if (descriptors.count(id_in) == 0) {
+        throw std::runtime_error("plugin " + std::to_string(id_in) + " is no longer in " + path);
+    }
+
+    return descriptors[id_in];
 }
 
 const std::map<ladspa::id_type, ladspa::type *> ladspa::file::get_types()
@@ -112,8 +191,8 @@ const std::map<ladspa::id_type, ladspa::type *> ladspa::file::get_types()
     return types;
 }
 
-ladspa::type::type(const LADSPA_Descriptor * descriptor_in, ladspa::file * file_in)
-: descriptor(descriptor_in), file(file_in)
+ladspa::type::type(const type_info info_in, ladspa::file * file_in)
+: info(info_in), file(file_in)
 {
     ladspa::id_type port_count = get_port_count();
 
@@ -126,17 +205,17 @@ ladspa::type::type(const LADSPA_Descriptor * descriptor_in, ladspa::file * file_
 
 ladspa::id_type ladspa::type::get_id()
 {
-    return descriptor->UniqueID;
+    return info.id;
 }
 
 const std::string ladspa::type::get_name()
 {
-    return descriptor->Name;
+    return info.name;
 }
 
 const ladspa::id_type ladspa::type::get_port_count()
 {
-    return descriptor->PortCount;
+    return info.ports.size();
 }
 
 const std::vector<ladspa::port *> ladspa::type::get_ports()
@@ -144,6 +223,11 @@ const std::vector<ladspa::port *> ladspa::type::get_ports()
     return ports;
 }
 
+bool ladspa::type::has_port(const std::string port_name_in)
+{
+    return port_name_to_id.count(port_name_in) != 0;
+}
+
 ladspa::port * ladspa::type::get_port(const id_type number_in)
 {
     return ports[number_in];
@@ -154,10 +238,23 @@ ladspa::port * ladspa::type::get_port(const std::string port_name_in)
     return get_port(port_name_to_id[port_name_in]);
 }
 
-std::shared_ptr<ladspa::instance> ladspa::type::instantiate(const ladspa::size_type sample_rate_in, const std::string dbus_name_in, std::shared_ptr<dbus> dbus_broker_in)
+std::shared_ptr<ladspa::instance> ladspa::type::instantiate(const ladspa::size_type sample_rate_in, std::shared_ptr<arena> memory_in)
 {
+    if (descriptor == nullptr) {
+        descriptor = file->get_descriptor(get_id());
+
+        if (descriptor->PortCount != get_port_count()) {
+            throw std::runtime_error("plugin changed since its metadata was cached: " + get_name());
+        }
+    }
+
     auto new_handle = descriptor->instantiate(descriptor, sample_rate_in);
-    return std::make_shared<ladspa::instance>(new_handle, this, dbus_name_in, dbus_broker_in);
+
+    if (new_handle == nullptr) {
+        throw std::runtime_error("could not instantiate plugin: " + get_name());
+    }
+
+    return std::make_shared<ladspa::instance>(new_handle, this, memory_in);
 }
 
 ladspa::port::port(const id_type number_in, ladspa::type * type_in)
@@ -168,12 +265,12 @@ ladspa::port::port(const id_type number_in, ladspa::type * type_in)
 
 const std::string ladspa::port::get_name()
 {
-    return type->descriptor->PortNames[number];
+    return type->info.ports[number].name;
 }
 
 const int ladspa::port::get_descriptor()
 {
-    return type->descriptor->PortDescriptors[number];
+    return type->info.ports[number].descriptor;
 }
 
 bool ladspa::port::is_control()
@@ -196,13 +293,63 @@ bool ladspa::port::is_output()
     return LADSPA_IS_PORT_OUTPUT(get_descriptor());
 }
 
-ladspa::instance::instance(const LADSPA_Handle handle_in, ladspa::type * type_in, const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in)
-: effect(dbus_path_in, dbus_broker_in), handle(handle_in), type(type_in)
+ladspa::data_type ladspa::port::get_default(const size_type sample_rate_in)
 {
-    control_buffers = std::vector<data_type>(type->get_port_count());
+    auto& info = type->info.ports[number];
+    auto descriptor = info.hints;
+    double lower = info.lower;
+    double upper = info.upper;
+
+    if (LADSPA_IS_HINT_SAMPLE_RATE(descriptor)) {
+        lower *= sample_rate_in;
+        upper *= sample_rate_in;
+    }
+
+    auto between = [&](const double weight_in) -> data_type {
+        if (LADSPA_IS_HINT_LOGARITHMIC(descriptor) && lower > 0 && upper > 0) {
+            return exp(log(lower) * (1 - weight_in) + log(upper) * weight_in);
+        }
+
+        return lower * (1 - weight_in) + upper * weight_in;
+    };
+
+    switch(descriptor & LADSPA_HINT_DEFAULT_MASK) {
+        case LADSPA_HINT_DEFAULT_MINIMUM: return lower;
+        case LADSPA_HINT_DEFAULT_LOW: return between(0.25);
+        case LADSPA_HINT_DEFAULT_MIDDLE: return between(0.5);
+        case LADSPA_HINT_DEFAULT_HIGH: return between(0.75);
+        case LADSPA_HINT_DEFAULT_MAXIMUM: return upper;
+        case LADSPA_HINT_DEFAULT_1: return 1;
+        case LADSPA_HINT_DEFAULT_100: return 100;
+        case LADSPA_HINT_DEFAULT_440: return 440;
+    }
+
+    return 0;
+}
+
+ladspa::instance::instance(const LADSPA_Handle handle_in, ladspa::type * type_in, std::shared_ptr<arena> memory_in)
+: handle(handle_in), type(type_in), memory(memory_in)
+{
+    auto port_count = type->get_port_count();
+
+    control_buffers = memory->allocate_array<data_type>(port_count);
+    control_requests = memory->allocate_array<std::atomic<data_type>>(port_count);
+    control_snapshot = memory->allocate_array<std::atomic<data_type>>(port_count);
+    port_is_connected = std::vector<bool>(port_count);
+
+    for (ladspa::id_type i = 0; i < port_count; i++) {
+        control_requests[i].store(0);
+        control_snapshot[i].store(0);
+    }
 
     for (auto i : type->get_ports()) {
         if (i->is_control()) {
+            if (i->is_input()) {
+                control_inputs.push_back(i->number);
+            } else {
+                control_outputs.push_back(i->number);
+            }
+
             connect(i->number, &control_buffers[i->number]);
         } else if (i->is_audio()) {
             disconnect(i->number);
@@ -212,13 +359,23 @@ ladspa::instance::instance(const LADSPA_Handle handle_in, ladspa::type * type_in
     }
 }
 
-ladspa::data_type ladspa::instance::get_control(const ladspa::id_type id_in)
+// outside jack audio thread; the instance must not be part of a running graph
+ladspa::instance::~instance()
 {
-    auto lock = get_lock();
+    if (activated && type->descriptor->deactivate) {
+        type->descriptor->deactivate(handle);
+    }
+
+    if (type->descriptor->cleanup) {
+        type->descriptor->cleanup(handle);
+    }
+}
 
+ladspa::data_type ladspa::instance::get_control(const ladspa::id_type id_in)
+{
     assert(type->get_port(id_in)->is_control());
 
-    return control_buffers[id_in];
+    return control_snapshot[id_in].load(std::memory_order_relaxed);
 }
 
 ladspa::data_type ladspa::instance::get_control(const std::string name_in)
@@ -276,17 +433,37 @@ double ladspa::instance::knudge(const std::string & name_in, const double & valu
     return new_value;
 }
 
-void ladspa::instance::set_control(const ladspa::id_type id_in, ladspa::data_type value_in)
+void ladspa::instance::set_control(const ladspa::id_type id_in, const ladspa::data_type value_in)
 {
-    auto lock = get_lock();
-
     assert(type->get_port(id_in)->is_control());
     assert(type->get_port(id_in)->is_input());
 
-    control_buffers[id_in] = value_in;
+    control_requests[id_in].store(value_in, std::memory_order_relaxed);
+    control_snapshot[id_in].store(value_in, std::memory_order_relaxed);
+    controls_pending.store(true, std::memory_order_release);
 }
 
-void ladspa::instance::set_control(const std::string name_in, ladspa::data_type value_in)
+// inside jack audio thread
+void ladspa::instance::apply_controls()
+{
+    if (! controls_pending.exchange(false, std::memory_order_acquire)) {
+        return;
+    }
+
+    for (auto i : control_inputs) {
+        control_buffers[i] = control_requests[i].load(std::memory_order_relaxed);
+    }
+}
+
+// inside jack audio thread
+void ladspa::instance::publish_controls()
+{
+    for (auto i : control_outputs) {
+        control_snapshot[i].store(control_buffers[i], std::memory_order_relaxed);
+    }
+}
+
+void ladspa::instance::set_control(const std::string name_in, const ladspa::data_type value_in)
 {
     set_control(type->port_name_to_id[name_in], value_in);
 }
@@ -311,12 +488,24 @@ std::vector<ladspa::port *> ladspa::instance::get_ports()
     return type->get_ports();
 }
 
+std::vector<ladspa::id_type> ladspa::instance::get_audio_ports(const bool inputs_in)
+{
+    std::vector<id_type> retval;
+
+    for (auto i : get_ports()) {
+        if (i->is_audio() && i->is_input() == inputs_in) {
+            retval.push_back(i->number);
+        }
+    }
+
+    return retval;
+}
+
 std::vector<std::string> ladspa::instance::get_control_names()
 {
-    auto ports = get_ports();
-    std::vector<std::string> retval(ports.size());
+    std::vector<std::string> retval;
 
-    for(auto i : ports) {
+    for(auto i : get_ports()) {
         if (! i->is_control()) {
             continue;
         }
@@ -327,11 +516,31 @@ std::vector<std::string> ladspa::instance::get_control_names()
     return retval;
 }
 
+std::vector<std::string> ladspa::instance::get_input_control_names()
+{
+    std::vector<std::string> retval;
+
+    for(auto i : control_inputs) {
+        retval.push_back(type->get_port(i)->get_name());
+    }
+
+    return retval;
+}
+
 ladspa::port * ladspa::instance::get_port(const std::string port_name_in)
 {
     return type->get_port(port_name_in);
 }
 
+ladspa::id_type ladspa::instance::get_port_id(const std::string port_name_in)
+{
+    if (type->port_name_to_id.count(port_name_in) == 0) {
+        throw std::runtime_error("there is no known port named " + port_name_in);
+    }
+
+    return type->port_name_to_id[port_name_in];
+}
+
 void ladspa::instance::connect(const ladspa::id_type portnum_in, ladspa::data_type * buffer_in)
 {
     type->descriptor->connect_port(handle, portnum_in, buffer_in);
@@ -345,11 +554,7 @@ void ladspa::instance::connect(const ladspa::port * port_in, ladspa::data_type *
 
 void ladspa::instance::connect(const std::string name_in, data_type * buffer_in)
 {
-    if (type->port_name_to_id.count(name_in) == 0) {
-        throw std::runtime_error("there is no known port named " + name_in);
-    }
-
-    connect(type->port_name_to_id[name_in], buffer_in);
+    connect(get_port_id(name_in), buffer_in);
 }
 
 void ladspa::instance::disconnect(const ladspa::id_type portnum_in)
@@ -368,6 +573,11 @@ void ladspa::instance::disconnect(const std::string name_in)
     disconnect(type->port_name_to_id[name_in]);
 }
 
+bool ladspa::instance::is_inplace_broken()
+{
+    return LADSPA_IS_INPLACE_BROKEN(type->info.properties);
+}
+
 void ladspa::instance::activate()
 {
     for( auto i : type->get_ports()) {
@@ -377,15 +587,42 @@ void ladspa::instance::activate()
         }
     }
 
+    apply_controls();
+
+    if (type->descriptor->activate) {
+        type->descriptor->activate(handle);
+    }
+
+    activated = true;
+}
+
+double ladspa::instance::get_tail()
+{
+    return 0;
+}
+
+// outside jack audio thread
+void ladspa::instance::restart()
+{
+    if (! activated) {
+        return;
+    }
+
+    if (type->descriptor->deactivate) {
+        type->descriptor->deactivate(handle);
+    }
+
     if (type->descriptor->activate) {
         type->descriptor->activate(handle);
     }
 }
 
+// inside jack audio thread
 void ladspa::instance::run(ladspa::size_type num_samples_in)
 {
-    auto lock = get_lock();
+    apply_controls();
     type->descriptor->run(handle, num_samples_in);
+    publish_controls();
 }
 
 }
@@ -15,17 +15,21 @@
 
 #pragma once
 
+#include <atomic>
 #include <ladspa.h>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "arena.h"
 #include "dbus.h"
 #include "effect.h"
 
 namespace modpro {
 
+struct plugin_cache;
+
 struct ladspa : public std::enable_shared_from_this<ladspa> {
     class port;
     class type;
@@ -34,50 +38,99 @@ struct ladspa : public std::enable_shared_from_this<ladspa> {
     using id_type = unsigned long;
     using size_type = unsigned long;
 
+    // everything about a port that is needed before the library is loaded
+    struct port_info {
+        std::string name;
+        LADSPA_PortDescriptor descriptor;
+        LADSPA_PortRangeHintDescriptor hints;
+        data_type lower;
+        data_type upper;
+    };
+
+    struct type_info {
+        id_type id;
+        std::string name;
+        std::string label;
+        LADSPA_Properties properties;
+        std::vector<port_info> ports;
+    };
+
+    // The types in a file are known as soon as it is opened, either from
+    // the plugin cache or by loading it once to read its descriptors. The
+    // library itself is only loaded when one of its types is instantiated.
     class file {
         friend ladspa;
 
         void *handle = nullptr;
         LADSPA_Descriptor_Function descriptor_fn = nullptr;
         std::map<id_type, ladspa::type *> types;
+        std::map<id_type, const LADSPA_Descriptor *> descriptors;
         file(const std::string path_in);
+        std::vector<type_info> scan();
 
     public:
         const std::string path;
         // FIXME id_type should be const id_type
         const std::map<id_type, type *> get_types();
+        bool is_loaded();
+        void load();
+        const LADSPA_Descriptor * get_descriptor(const id_type id_in);
     };
 
     class instance : public modpro::effect {
         const std::string label;
         const LADSPA_Handle handle;
         ladspa::type * type;
-        std::vector<data_type> control_buffers;
-        std::map<const id_type, bool> port_is_connected;
+        // control_buffers is owned by the jack audio thread and is what the
+        // plugin reads from and writes to. Other threads never touch it:
+        // writes are staged in control_requests and picked up at the start
+        // of the next period and reads come from control_snapshot which
+        // holds the last requested value for inputs and the last value
+        // published by the plugin for outputs. All three live in memory.
+        std::shared_ptr<arena> memory;
+        data_type * control_buffers = nullptr;
+        std::atomic<data_type> * control_requests = nullptr;
+        std::atomic<data_type> * control_snapshot = nullptr;
+        std::atomic<bool> controls_pending = ATOMIC_VAR_INIT(false);
+        std::vector<id_type> control_inputs;
+        std::vector<id_type> control_outputs;
+        std::vector<bool> port_is_connected;
+        bool activated = false;
+
+        void apply_controls();
+        void publish_controls();
 
     public:
-        instance(const LADSPA_Handle handle_in, ladspa::type * type_in, const std::string dbus_prefix_in, std::shared_ptr<dbus> dbus_broker_in);
+        instance(const LADSPA_Handle handle_in, ladspa::type * type_in, std::shared_ptr<arena> memory_in);
+        virtual ~instance();
         std::vector<ladspa::port *> get_ports();
-        std::vector<std::string> get_control_names();
+        virtual std::vector<std::string> get_control_names() override;
+        virtual std::vector<std::string> get_input_control_names() override;
         virtual const std::string get_name() override;
         virtual const std::string get_label() override;
         ladspa::port * get_port(const std::string port_name_in);
+        virtual id_type get_port_id(const std::string port_name_in) override;
+        virtual std::vector<id_type> get_audio_ports(const bool inputs_in) override;
         ladspa::type * get_type();
-        data_type get_control(const id_type id_in);
-        data_type get_control(const std::string name_in);
-        virtual double read(const std::string & name_i);
-        std::map<std::string, double> read_all();
-        virtual void write(const std::string & name_in, const double & value_in);
-        virtual double knudge(const std::string & name_in, const double & value_in);
-        void set_control(const id_type id_in, ladspa::data_type value_in);
-        void set_control(const std::string name_in, ladspa::data_type value_in);
-        void connect(const id_type portnum_in, data_type * buffer_in);
+        virtual data_type get_control(const id_type id_in) override;
+        virtual data_type get_control(const std::string name_in) override;
+        virtual double read(const std::string & name_i) override;
+        virtual std::map<std::string, double> read_all() override;
+        virtual void write(const std::string & name_in, const double & value_in) override;
+        virtual double knudge(const std::string & name_in, const double & value_in) override;
+        virtual void set_control(const id_type id_in, const ladspa::data_type value_in) override;
+        virtual void set_control(const std::string name_in, const ladspa::data_type value_in) override;
+        virtual void connect(const id_type portnum_in, data_type * buffer_in) override;
         void connect(const port * port_in, data_type * buffer_in);
         void connect(const std::string name_in, data_type * buffer_in);
         void disconnect(const id_type portnum_in);
         void disconnect(const port * port_in);
         void disconnect(const std::string name_in);
+        virtual bool is_inplace_broken() override;
         void activate();
+        virtual void restart() override;
+        // LADSPA has no way to declare a tail so this is always 0
+        virtual double get_tail() override;
         void run(const size_type num_samples_in);
     };
 
@@ -85,20 +138,24 @@ struct ladspa : public std::enable_shared_from_this<ladspa> {
         friend instance;
         friend port;
 
-        const LADSPA_Descriptor * descriptor;
+        const type_info info;
+        // null until the library is loaded
+        const LADSPA_Descriptor * descriptor = nullptr;
         ladspa::file * file;
         std::vector<port *> ports;
         std::map<std::string, id_type> port_name_to_id;
 
     public:
-        type(const LADSPA_Descriptor * descriptor_in, ladspa::file * file_in);
+        type(const type_info info_in, ladspa::file * file_in);
         id_type get_id();
         const ladspa::id_type get_port_count();
         const std::vector<port *> get_ports();
         const std::string get_name();
+        bool has_port(const std::string port_name_in);
         port * get_port(const id_type number_in);
         port * get_port(const std::string port_name_in);
-        std::shared_ptr<instance> instantiate(const size_type sample_rate_in, const std::string dbus_path_in, std::shared_ptr<dbus> dbus_broker_in);
+        // loads the library the first time it is called
+        std::shared_ptr<instance> instantiate(const size_type sample_rate_in, std::shared_ptr<arena> memory_in);
     };
 
     struct port {
@@ -112,12 +169,15 @@ struct ladspa : public std::enable_shared_from_this<ladspa> {
         bool is_audio();
         bool is_input();
         bool is_output();
+        // the value the plugin suggests for a control or 0 if it has none
+        data_type get_default(const size_type sample_rate_in);
     };
 
     private:
     std::map<const std::string, file *> loaded_files;
     std::map<const id_type, type *> loaded_types;
     std::map<const std::string, const id_type> name_to_id;
+    std::shared_ptr<plugin_cache> cache;
 
     public:
     template<typename... Args>
@@ -126,10 +186,14 @@ struct ladspa : public std::enable_shared_from_this<ladspa> {
         return std::make_shared<ladspa>(args...);
     }
 
+    // files opened after this use the cache for their metadata
+    void set_cache(std::shared_ptr<plugin_cache> cache_in);
     file * open(const std::string path_in);
+    bool has_type(const std::string name_in);
     type * get_type(const id_type id_in);
-    std::shared_ptr<instance> instantiate(const id_type id_in, const size_type sample_rate_in, const std::string dbus_name_in, std::shared_ptr<dbus> dbus_broker_in);
-    std::shared_ptr<instance> instantiate(const std::string name_in, const size_type sample_rate_in, const std::string dbus_name_in, std::shared_ptr<dbus> dbus_broker_in);
+    type * get_type(const std::string name_in);
+    std::shared_ptr<instance> instantiate(const id_type id_in, const size_type sample_rate_in, std::shared_ptr<arena> memory_in);
+    std::shared_ptr<instance> instantiate(const std::string name_in, const size_type sample_rate_in, std::shared_ptr<arena> memory_in);
 };
 
 }
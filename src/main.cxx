@@ -13,18 +13,33 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "audio.h"
 #include "dbus.h"
 #include "event.h"
+#include "fileaudio.h"
+#include "jackaudio.h"
+#include "timing.h"
 
 using namespace std;
 using namespace modpro;
 
+// when main() started so the time until audio is running can be logged
+static timing::ns_type launch_time;
+
 void handle_audio_started()
 {
-    cout << "Audio system has started" << endl;
+    cout << "Audio system has started " << (timing::now() - launch_time) / 1000000.0 << " ms after launch" << endl;
 }
 
 void handle_audio_stopped(bool * should_run_p_in)
@@ -38,6 +53,14 @@ void handle_audio_client_changed(shared_ptr<audio::processor> processor_in)
     processor_in->check_auto_connect();
 }
 
+static shared_ptr<event::broker> signal_broker;
+
+// only queues an event; the reload runs from the main loop
+void handle_sighup(int)
+{
+    signal_broker->send_event(event::name::reload_requested);
+}
+
 void process_audio(const char * conf_path)
 {
     bool should_run = true;
@@ -46,26 +69,173 @@ void process_audio(const char * conf_path)
     dbus_broker->start();
 
     auto event_broker = make_shared<event::broker>();
-    auto processor = audio::processor::make(conf_path, event_broker, dbus_broker);
+    event_broker->subscribe(event::name::audio_started);
+    event_broker->subscribe(event::name::audio_stopped);
+    event_broker->subscribe(event::name::audio_client_change);
+    event_broker->subscribe(event::name::graph_retired);
+    event_broker->subscribe(event::name::buffer_size_change);
+    event_broker->subscribe(event::name::sample_rate_change);
+    event_broker->subscribe(event::name::reload_requested);
+
+    auto jack = jackaudio::client::make("ModPro");
+    auto processor = audio::processor::make(conf_path, event_broker, dbus_broker, jack);
+    auto processor_object = make_shared<audio::processor_object>(dbus_broker, processor);
 
     processor->start();
 
+    signal_broker = event_broker;
+    struct sigaction reload_action = {};
+    reload_action.sa_handler = handle_sighup;
+    reload_action.sa_flags = SA_RESTART;
+    sigemptyset(&reload_action.sa_mask);
+    sigaction(SIGHUP, &reload_action, nullptr);
+
     while(should_run) {
         auto event = event_broker->get_event();
 
-        switch (event) {
+        switch (event.type) {
             case event::name::audio_started: handle_audio_started(); break;
             case event::name::audio_stopped: handle_audio_stopped(&should_run); break;
-            case event::name::audio_processed: break;
             case event::name::audio_client_change: handle_audio_client_changed(processor); break;
+            case event::name::graph_retired: processor->reap(); break;
+            case event::name::buffer_size_change: processor->rebuild_graph(); break;
+            case event::name::sample_rate_change: processor->change_sample_rate(event.payload.number); break;
+            case event::name::reload_requested: processor->begin_reload(); break;
         }
     }
 }
 
+struct render_options {
+    unsigned int jobs = thread::hardware_concurrency();
+    backend::nframes_type block_size = fileaudio::default_block_size;
+    backend::nframes_type raw_sample_rate = 48000;
+    const char * conf_path = nullptr;
+    vector<pair<string, string>> files;
+};
+
+// runs one input file through its own processor; nothing is shared with
+// the other files being rendered so they can run on different cores
+void render_file(const render_options & options_in, const string input_path_in, const string output_path_in)
+{
+    auto event_broker = make_shared<event::broker>();
+    auto file_backend = make_shared<fileaudio::client>(input_path_in, output_path_in, options_in.block_size, options_in.raw_sample_rate);
+    auto processor = audio::processor::make(options_in.conf_path, event_broker, nullptr, file_backend);
+    auto start = timing::now();
+
+    processor->start();
+    file_backend->run();
+
+    double seconds = (timing::now() - start) / 1000000000.0;
+    double audio_seconds = double(file_backend->get_frames_done()) / file_backend->get_sample_rate();
+    cout << "Rendered " << input_path_in << " to " << output_path_in << ": " << audio_seconds << " seconds of audio in ";
+    cout << seconds << " seconds (" << audio_seconds / seconds << "x realtime)" << endl;
+}
+
+int render_audio(const render_options & options_in)
+{
+    atomic<size_t> next_file(0);
+    atomic<int> failures(0);
+    vector<thread> threads;
+    auto num_threads = min(size_t(max(options_in.jobs, 1u)), options_in.files.size());
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.push_back(thread([&]() -> void {
+            while(true) {
+                auto file_num = next_file++;
+
+                if (file_num >= options_in.files.size()) {
+                    return;
+                }
+
+                auto& file = options_in.files[file_num];
+
+                try {
+                    render_file(options_in, file.first, file.second);
+                } catch (std::exception & e) {
+                    cerr << "Could not render " << file.first << ": " << e.what() << endl;
+                    failures++;
+                }
+            }
+        }));
+    }
+
+    for (auto& i : threads) {
+        i.join();
+    }
+
+    return failures == 0 ? 0 : 1;
+}
+
+// a whole number greater than 0 that fits in 32 bits and nothing else
+bool parse_count(const char * text_in, unsigned long & value_out)
+{
+    char * end = nullptr;
+
+    if (*text_in < '0' || *text_in > '9') {
+        return false;
+    }
+
+    errno = 0;
+    value_out = strtoul(text_in, &end, 10);
+
+    return errno == 0 && *end == '\0' && value_out > 0 && value_out <= UINT32_MAX;
+}
+
+void usage()
+{
+    cerr << "usage: modpro <config.yml>" << endl;
+    cerr << "       modpro --render [--jobs N] [--block N] [--rate N] <config.yml> <in.wav> <out.wav> [<in> <out> ...]" << endl;
+    cerr << endl;
+    cerr << "Files that do not end in .wav are mono 32 bit float; --rate gives their sample rate." << endl;
+    cerr << "Rendering leaves ptt, recorder, metrics and meters shm to the daemon and can not use UDP effects." << endl;
+}
+
 int main(int argc, const char *argv[])
 {
+    launch_time = timing::now();
+
+    if (argc >= 2 && ! strcmp(argv[1], "--render")) {
+        render_options options;
+        int arg_num = 2;
+
+        for (; arg_num + 1 < argc && ! strncmp(argv[arg_num], "--", 2); arg_num += 2) {
+            unsigned long value;
+
+            if (! parse_count(argv[arg_num + 1], value)) {
+                cerr << "modpro: bad value for " << argv[arg_num] << ": " << argv[arg_num + 1] << endl;
+                usage();
+                return 1;
+            }
+
+            if (! strcmp(argv[arg_num], "--jobs")) {
+                options.jobs = value;
+            } else if (! strcmp(argv[arg_num], "--block")) {
+                options.block_size = value;
+            } else if (! strcmp(argv[arg_num], "--rate")) {
+                options.raw_sample_rate = value;
+            } else {
+                usage();
+                return 1;
+            }
+        }
+
+        if (argc - arg_num < 3 || (argc - arg_num - 1) % 2 != 0) {
+            usage();
+            return 1;
+        }
+
+        options.conf_path = argv[arg_num++];
+
+        for (; arg_num < argc; arg_num += 2) {
+            options.files.push_back(make_pair(argv[arg_num], argv[arg_num + 1]));
+        }
+
+        return render_audio(options);
+    }
+
     if (argc != 2) {
-        throw std::runtime_error("specify a configuration file");
+        usage();
+        return 1;
     }
 
     cout << "Starting" << endl;
@@ -0,0 +1,185 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "meter.h"
+
+namespace modpro {
+
+std::shared_ptr<meter_bank> meter_bank::make()
+{
+    return std::make_shared<meter_bank>();
+}
+
+// outside jack audio thread
+meter_bank::size_type meter_bank::add(const std::string & name_in, const size_type window_in)
+{
+    slots.emplace_back();
+    slots.back().name = name_in;
+    slots.back().window = window_in;
+
+    return slots.size() - 1;
+}
+
+meter_bank::size_type meter_bank::size()
+{
+    return slots.size();
+}
+
+// only one thread ever writes a slot so the sequence is a plain seqlock
+void meter_bank::publish(slot & slot_in, const sample_type peak_in, const sample_type rms_in)
+{
+    auto sequence = slot_in.sequence.load(std::memory_order_relaxed);
+
+    slot_in.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot_in.peak.store(peak_in, std::memory_order_relaxed);
+    slot_in.rms.store(rms_in, std::memory_order_relaxed);
+    slot_in.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// inside jack audio thread or a worker thread
+void meter_bank::measure(const size_type slot_in, const sample_type * buffer_in, const size_type count_in)
+{
+    auto& slot = slots[slot_in];
+    sample_type power = 0;
+
+    kernels.level(buffer_in, count_in, &slot.window_peak, &power);
+    slot.window_power += power;
+    slot.window_count += count_in;
+
+    if (slot.window_count < slot.window) {
+        return;
+    }
+
+    publish(slot, slot.window_peak, std::sqrt(slot.window_power / slot.window_count));
+
+    slot.window_peak = 0;
+    slot.window_power = 0;
+    slot.window_count = 0;
+}
+
+// inside jack audio thread or a worker thread
+void meter_bank::set_value(const size_type slot_in, const sample_type value_in)
+{
+    publish(slots[slot_in], value_in, value_in);
+}
+
+std::vector<meter_bank::reading> meter_bank::read()
+{
+    std::vector<reading> retval;
+
+    for (auto& i : slots) {
+        uint32_t before, after;
+        sample_type peak, rms;
+
+        do {
+            before = i.sequence.load(std::memory_order_acquire);
+            peak = i.peak.load(std::memory_order_relaxed);
+            rms = i.rms.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = i.sequence.load(std::memory_order_relaxed);
+        } while((before & 1) != 0 || before != after);
+
+        retval.push_back({ i.name, peak, rms });
+    }
+
+    return retval;
+}
+
+meter_shm::meter_shm(const std::string & name_in)
+: name(name_in)
+{
+    fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+
+    if (fd == -1) {
+        throw std::runtime_error("could not open shared memory " + name + ": " + strerror(errno));
+    }
+
+    map(sizeof(header));
+    std::memcpy(static_cast<header *>(block)->magic, "MODPROM1", 8);
+}
+
+meter_shm::~meter_shm()
+{
+    if (block != nullptr) {
+        munmap(block, block_size);
+    }
+
+    close(fd);
+    shm_unlink(name.c_str());
+}
+
+std::shared_ptr<meter_shm> meter_shm::make(const std::string & name_in)
+{
+    return std::make_shared<meter_shm>(name_in);
+}
+
+// readers map the object again when count grows past what they mapped
+void meter_shm::map(const size_t size_in)
+{
+    if (ftruncate(fd, size_in) != 0) {
+        throw std::runtime_error("could not size shared memory " + name + ": " + strerror(errno));
+    }
+
+    if (block != nullptr) {
+        munmap(block, block_size);
+    }
+
+    block = mmap(nullptr, size_in, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (block == MAP_FAILED) {
+        block = nullptr;
+        throw std::runtime_error("could not map shared memory " + name + ": " + strerror(errno));
+    }
+
+    block_size = size_in;
+}
+
+void meter_shm::write(const std::vector<meter_bank::reading> & readings_in)
+{
+    auto size = sizeof(header) + readings_in.size() * sizeof(entry);
+
+    if (size > block_size) {
+        map(size);
+    }
+
+    auto head = static_cast<header *>(block);
+    auto entries = reinterpret_cast<entry *>(head + 1);
+    auto sequence = head->sequence.load(std::memory_order_relaxed);
+
+    head->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    head->count = readings_in.size();
+
+    for (size_t i = 0; i < readings_in.size(); i++) {
+        std::strncpy(entries[i].name, readings_in[i].name.c_str(), name_size - 1);
+        entries[i].name[name_size - 1] = '\0';
+        entries[i].peak = readings_in[i].peak;
+        entries[i].rms = readings_in[i].rms;
+    }
+
+    head->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+}
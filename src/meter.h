@@ -0,0 +1,116 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "simd.h"
+
+namespace modpro {
+
+// Levels of the ports a chain meters. The step that owns a slot adds every
+// block it runs to the slot's window and publishes the peak and RMS when
+// the window is full; any other thread can read the last published values
+// without locking. Control ports are published every block as they are.
+// Slots are only added before the bank is handed to a graph.
+class meter_bank {
+    public:
+    using sample_type = simd::sample_type;
+    using size_type = unsigned long;
+
+    struct reading {
+        std::string name;
+        double peak;
+        double rms;
+    };
+
+    private:
+    struct alignas(64) slot {
+        std::string name;
+        // samples per published reading
+        size_type window = 0;
+        // odd while peak and rms are being written
+        std::atomic<uint32_t> sequence = ATOMIC_VAR_INIT(0);
+        std::atomic<sample_type> peak = ATOMIC_VAR_INIT(0);
+        std::atomic<sample_type> rms = ATOMIC_VAR_INIT(0);
+        // only touched by the thread running the step
+        sample_type window_peak = 0;
+        double window_power = 0;
+        size_type window_count = 0;
+    };
+
+    std::deque<slot> slots;
+    const simd::kernels & kernels = simd::get();
+
+    void publish(slot & slot_in, const sample_type peak_in, const sample_type rms_in);
+
+    public:
+    static std::shared_ptr<meter_bank> make();
+    size_type add(const std::string & name_in, const size_type window_in);
+    size_type size();
+    // inside jack audio thread or a worker thread
+    void measure(const size_type slot_in, const sample_type * buffer_in, const size_type count_in);
+    void set_value(const size_type slot_in, const sample_type value_in);
+    // from any thread
+    std::vector<reading> read();
+};
+
+// The published readings in a POSIX shared memory object so other programs
+// can draw meters without going through DBus. The object starts with
+//
+//     struct { char magic[8]; uint32_t sequence; uint32_t count; }
+//
+// where magic is "MODPROM1" and sequence is odd while the block is being
+// written, followed by count entries of
+//
+//     struct { char name[56]; float peak; float rms; }
+//
+// in the order the chains list their meters.
+class meter_shm {
+    static const size_t name_size = 56;
+
+    struct header {
+        char magic[8];
+        std::atomic<uint32_t> sequence;
+        uint32_t count;
+    };
+
+    struct entry {
+        char name[name_size];
+        float peak;
+        float rms;
+    };
+
+    const std::string name;
+    int fd = -1;
+    void * block = nullptr;
+    size_t block_size = 0;
+
+    void map(const size_t size_in);
+
+    public:
+    meter_shm(const std::string & name_in);
+    ~meter_shm();
+    static std::shared_ptr<meter_shm> make(const std::string & name_in);
+    void write(const std::vector<meter_bank::reading> & readings_in);
+};
+
+}
@@ -0,0 +1,240 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <ctime>
+#include <sstream>
+
+#include "metrics.h"
+
+namespace modpro {
+
+static timing::ns_type wall_now()
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<timing::ns_type>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+metrics::metrics()
+{
+    reset();
+}
+
+// inside the JACK xrun callback
+void metrics::record_xrun()
+{
+    auto xrun_num = xruns.fetch_add(1, std::memory_order_relaxed);
+    xrun_times[xrun_num % xrun_history].store(wall_now(), std::memory_order_relaxed);
+}
+
+// inside jack audio thread
+void metrics::record_period(const timing::ns_type process_ns_in, const timing::ns_type plugin_ns_in, const timing::ns_type budget_ns_in)
+{
+    process_time.record(process_ns_in);
+    plugin_time.record(plugin_ns_in);
+    period_budget_ns.store(budget_ns_in, std::memory_order_relaxed);
+
+    if (budget_ns_in > 0) {
+        auto bin = std::min(process_ns_in * (budget_bins - 1) / budget_ns_in, timing::ns_type(budget_bins - 1));
+        budget_counts[bin].fetch_add(1, std::memory_order_relaxed);
+        budget_used_millionths.fetch_add(process_ns_in * 1000000 / budget_ns_in, std::memory_order_relaxed);
+    }
+
+    auto second = timing::now() / 1000000000;
+    auto& slot = window[second % window_seconds];
+
+    if (slot.second.load(std::memory_order_relaxed) != second) {
+        slot.max_ns.store(process_ns_in, std::memory_order_relaxed);
+        slot.second.store(second, std::memory_order_relaxed);
+    } else if (process_ns_in > slot.max_ns.load(std::memory_order_relaxed)) {
+        slot.max_ns.store(process_ns_in, std::memory_order_relaxed);
+    }
+}
+
+void metrics::reset()
+{
+    xruns.store(0);
+
+    for (auto& i : xrun_times) {
+        i.store(0);
+    }
+
+    for (auto& i : budget_counts) {
+        i.store(0);
+    }
+
+    budget_used_millionths.store(0);
+
+    for (auto& i : window) {
+        i.second.store(0);
+        i.max_ns.store(0);
+    }
+
+    process_time.reset();
+    plugin_time.reset();
+}
+
+timing::ns_type metrics::get_worst_period(const size_t seconds_in)
+{
+    auto now = timing::now() / 1000000000;
+    timing::ns_type retval = 0;
+
+    for (auto& i : window) {
+        auto second = i.second.load(std::memory_order_relaxed);
+
+        if (second + seconds_in > now) {
+            retval = std::max(retval, i.max_ns.load(std::memory_order_relaxed));
+        }
+    }
+
+    return retval;
+}
+
+std::vector<double> metrics::get_xrun_times()
+{
+    std::vector<double> retval;
+    auto count = xruns.load();
+    auto first = count > xrun_history ? count - xrun_history : 0;
+
+    for (auto i = first; i < count; i++) {
+        retval.push_back(xrun_times[i % xrun_history].load() / 1000000000.0);
+    }
+
+    return retval;
+}
+
+std::map<std::string, double> metrics::get_summary()
+{
+    std::map<std::string, double> retval;
+    auto xrun_list = get_xrun_times();
+
+    retval["xruns"] = xruns.load();
+    retval["last_xrun_time"] = xrun_list.size() > 0 ? xrun_list.back() : 0;
+    retval["period_budget_ns"] = period_budget_ns.load();
+    retval["worst_period_10s_ns"] = get_worst_period(10);
+    retval["worst_period_60s_ns"] = get_worst_period(window_seconds);
+
+    for (auto& i : process_time.get_summary()) {
+        retval["process_" + i.first] = i.second;
+    }
+
+    for (auto& i : plugin_time.get_summary()) {
+        retval["plugin_" + i.first] = i.second;
+    }
+
+    for (size_t i = 0; i < budget_bins; i++) {
+        std::string name = "budget_";
+
+        if (i + 1 < budget_bins) {
+            name += std::to_string(i * 10) + "_" + std::to_string(i * 10 + 10) + "_percent";
+        } else {
+            name += "over";
+        }
+
+        retval[name] = budget_counts[i].load();
+    }
+
+    return retval;
+}
+
+std::string metrics::get_prometheus(const std::map<std::string, double> & extra_in, const std::vector<labeled_sample> & labeled_in)
+{
+    std::ostringstream out;
+    auto budget = period_budget_ns.load();
+
+    // enough digits for a timestamp down to the microsecond
+    out.precision(16);
+
+    out << "# TYPE modpro_xruns_total counter" << std::endl;
+    out << "modpro_xruns_total " << xruns.load() << std::endl;
+
+    auto xrun_list = get_xrun_times();
+    out << "# TYPE modpro_last_xrun_timestamp_seconds gauge" << std::endl;
+    out << "modpro_last_xrun_timestamp_seconds " << (xrun_list.size() > 0 ? xrun_list.back() : 0) << std::endl;
+
+    out << "# TYPE modpro_period_budget_seconds gauge" << std::endl;
+    out << "modpro_period_budget_seconds " << budget / 1e9 << std::endl;
+
+    out << "# TYPE modpro_worst_period_seconds gauge" << std::endl;
+    out << "modpro_worst_period_seconds{window=\"10s\"} " << get_worst_period(10) / 1e9 << std::endl;
+    out << "modpro_worst_period_seconds{window=\"60s\"} " << get_worst_period(window_seconds) / 1e9 << std::endl;
+
+    // Prometheus histograms are cumulative
+    out << "# TYPE modpro_period_budget_used histogram" << std::endl;
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < budget_bins; i++) {
+        cumulative += budget_counts[i].load();
+
+        if (i + 1 < budget_bins) {
+            out << "modpro_period_budget_used_bucket{le=\"" << (i + 1) / 10.0 << "\"} " << cumulative << std::endl;
+        } else {
+            out << "modpro_period_budget_used_bucket{le=\"+Inf\"} " << cumulative << std::endl;
+        }
+    }
+    out << "modpro_period_budget_used_sum " << budget_used_millionths.load() / 1e6 << std::endl;
+    out << "modpro_period_budget_used_count " << cumulative << std::endl;
+
+    for (auto stats : { std::make_pair("process", &process_time), std::make_pair("plugin", &plugin_time) }) {
+        auto summary = stats.second->get_summary();
+        std::string name = std::string("modpro_") + stats.first + "_seconds";
+
+        out << "# TYPE " << name << " summary" << std::endl;
+        out << name << "{quantile=\"0.5\"} " << summary["p50_ns"] / 1e9 << std::endl;
+        out << name << "{quantile=\"0.99\"} " << summary["p99_ns"] / 1e9 << std::endl;
+        out << name << "{quantile=\"1\"} " << summary["max_ns"] / 1e9 << std::endl;
+        out << name << "_sum " << stats.second->total_ns.load() / 1e9 << std::endl;
+        out << name << "_count " << stats.second->count.load() << std::endl;
+    }
+
+    for (auto& i : extra_in) {
+        out << "# TYPE modpro_" << i.first << " gauge" << std::endl;
+        out << "modpro_" << i.first << " " << i.second << std::endl;
+    }
+
+    for (size_t i = 0; i < labeled_in.size(); i++) {
+        auto& sample = labeled_in[i];
+        std::string separator;
+
+        if (i == 0 || labeled_in[i - 1].name != sample.name) {
+            out << "# TYPE modpro_" << sample.name << " " << sample.type << std::endl;
+        }
+
+        out << "modpro_" << sample.name << "{";
+
+        for (auto& j : sample.labels) {
+            out << separator << j.first << "=\"";
+
+            for (auto c : j.second) {
+                if (c == '\\' || c == '"') {
+                    out << '\\' << c;
+                } else if (c == '\n') {
+                    out << "\\n";
+                } else {
+                    out << c;
+                }
+            }
+
+            out << "\"";
+            separator = ",";
+        }
+
+        out << "} " << sample.value << std::endl;
+    }
+
+    return out.str();
+}
+
+}
@@ -0,0 +1,84 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "timing.h"
+
+namespace modpro {
+
+// How well the audio thread is keeping up. Everything is recorded from the
+// jack audio thread, or the JACK xrun callback, with relaxed atomic
+// operations and read from any other thread.
+struct metrics {
+    static const size_t xrun_history = 64;
+    static const size_t window_seconds = 60;
+    // periods are counted in tenths of the period budget with one more bin
+    // for periods that went over
+    static const size_t budget_bins = 11;
+
+    // a sample kept by someone else that has labels, like one for each
+    // chain; samples with the same name must be next to each other
+    struct labeled_sample {
+        std::string name;
+        // counter or gauge
+        std::string type;
+        std::map<std::string, std::string> labels;
+        double value;
+    };
+
+    std::atomic<uint64_t> xruns = ATOMIC_VAR_INIT(0);
+    // wall clock time of the most recent xruns in ns since the epoch
+    std::atomic<timing::ns_type> xrun_times[xrun_history];
+    // the whole process callback
+    timing::stats process_time;
+    // only the time spent inside plugins; more than process_time when
+    // effects run in parallel
+    timing::stats plugin_time;
+    std::atomic<uint64_t> budget_counts[budget_bins];
+    // the budget used by every period added together in millionths
+    std::atomic<uint64_t> budget_used_millionths = ATOMIC_VAR_INIT(0);
+    std::atomic<timing::ns_type> period_budget_ns = ATOMIC_VAR_INIT(0);
+
+    private:
+    // the slowest period seen during each of the last window_seconds; only
+    // written by the jack audio thread
+    struct second_slot {
+        std::atomic<uint64_t> second = ATOMIC_VAR_INIT(0);
+        std::atomic<timing::ns_type> max_ns = ATOMIC_VAR_INIT(0);
+    };
+
+    second_slot window[window_seconds];
+
+    public:
+    metrics();
+    void record_xrun();
+    void record_period(const timing::ns_type process_ns_in, const timing::ns_type plugin_ns_in, const timing::ns_type budget_ns_in);
+    void reset();
+    // the slowest period in the last seconds_in seconds
+    timing::ns_type get_worst_period(const size_t seconds_in);
+    // oldest first, in seconds since the epoch
+    std::vector<double> get_xrun_times();
+    std::map<std::string, double> get_summary();
+    // everything in the Prometheus text exposition format
+    std::string get_prometheus(const std::map<std::string, double> & extra_in, const std::vector<labeled_sample> & labeled_in = {});
+};
+
+}
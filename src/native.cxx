@@ -0,0 +1,660 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include "native.h"
+#include "netaudio.h"
+
+namespace modpro {
+
+using sample_type = effect::sample_type;
+
+// "modpro gain"; the gain follows changes to the control with a one pole
+// curve that is applied as a linear ramp across each period
+class native_gain : public native::instance {
+    enum { input, output, gain_db, smoothing_ms };
+
+    data_type current_db = 0;
+    data_type target = 1;
+    data_type current = 1;
+
+    public:
+    native_gain(const size_type sample_rate_in, std::shared_ptr<arena> memory_in)
+    : instance("modpro gain", {
+        { "Input", true, true, 0 },
+        { "Output", true, false, 0 },
+        { "Gain (dB)", false, true, 0 },
+        { "Smoothing (ms)", false, true, 10 },
+    }, sample_rate_in, memory_in) { }
+
+    protected:
+    virtual void reset() override
+    {
+        current_db = control(gain_db);
+        target = current = pow(10, current_db / 20);
+    }
+
+    virtual void process(const size_type num_samples_in) override
+    {
+        auto in = buffer(input);
+        auto out = buffer(output);
+
+        if (control(gain_db) != current_db) {
+            current_db = control(gain_db);
+            target = pow(10, current_db / 20);
+        }
+
+        auto next = target;
+        auto smoothing_samples = control(smoothing_ms) * sample_rate / 1000;
+
+        if (current != target && smoothing_samples >= 1) {
+            next = target + (current - target) * exp(-data_type(num_samples_in) / smoothing_samples);
+
+            if (fabs(next - target) < 1e-6) {
+                next = target;
+            }
+        }
+
+        if (out == nullptr) {
+            current = next;
+            return;
+        }
+
+        if (in == nullptr) {
+            std::fill(out, out + num_samples_in, 0);
+        } else if (current == next) {
+            kernels.scale(out, in, next, num_samples_in);
+        } else {
+            kernels.ramp(out, in, current, (next - current) / num_samples_in, num_samples_in);
+        }
+
+        current = next;
+    }
+};
+
+// "modpro mixer"; sums up to four inputs into one output
+class native_mixer : public native::instance {
+    static const size_t channels = 4;
+
+    public:
+    native_mixer(const size_type sample_rate_in, std::shared_ptr<arena> memory_in)
+    : instance("modpro mixer", {
+        { "Input 1", true, true, 0 },
+        { "Input 2", true, true, 0 },
+        { "Input 3", true, true, 0 },
+        { "Input 4", true, true, 0 },
+        { "Output", true, false, 0 },
+        { "Level 1", false, true, 1 },
+        { "Level 2", false, true, 1 },
+        { "Level 3", false, true, 1 },
+        { "Level 4", false, true, 1 },
+    }, sample_rate_in, memory_in) { }
+
+    // the output is written before every input has been read
+    virtual bool is_inplace_broken() override
+    {
+        return true;
+    }
+
+    protected:
+    virtual void process(const size_type num_samples_in) override
+    {
+        auto out = buffer(channels);
+        bool first = true;
+
+        if (out == nullptr) {
+            return;
+        }
+
+        for (size_t i = 0; i < channels; i++) {
+            auto in = buffer(i);
+
+            if (in == nullptr) {
+                continue;
+            }
+
+            if (first) {
+                kernels.scale(out, in, control(channels + 1 + i), num_samples_in);
+                first = false;
+            } else {
+                kernels.mix(out, in, control(channels + 1 + i), num_samples_in);
+            }
+        }
+
+        if (first) {
+            std::fill(out, out + num_samples_in, 0);
+        }
+    }
+};
+
+// "modpro splitter"; copies one input to up to four outputs
+class native_splitter : public native::instance {
+    static const size_t channels = 4;
+
+    public:
+    native_splitter(const size_type sample_rate_in, std::shared_ptr<arena> memory_in)
+    : instance("modpro splitter", {
+        { "Input", true, true, 0 },
+        { "Output 1", true, false, 0 },
+        { "Output 2", true, false, 0 },
+        { "Output 3", true, false, 0 },
+        { "Output 4", true, false, 0 },
+        { "Level 1", false, true, 1 },
+        { "Level 2", false, true, 1 },
+        { "Level 3", false, true, 1 },
+        { "Level 4", false, true, 1 },
+    }, sample_rate_in, memory_in) { }
+
+    // the input is still needed after the first output is written
+    virtual bool is_inplace_broken() override
+    {
+        return true;
+    }
+
+    protected:
+    virtual void process(const size_type num_samples_in) override
+    {
+        auto in = buffer(0);
+
+        for (size_t i = 0; i < channels; i++) {
+            auto out = buffer(1 + i);
+
+            if (out == nullptr) {
+                continue;
+            }
+
+            if (in == nullptr) {
+                std::fill(out, out + num_samples_in, 0);
+            } else {
+                kernels.scale(out, in, control(1 + channels + i), num_samples_in);
+            }
+        }
+    }
+};
+
+// "modpro delay"; a delay of up to two seconds with linear interpolation
+// between samples. The input is copied into a ring first so the output can
+// be built from two contiguous runs of the ring with the vector kernels.
+class native_delay : public native::instance {
+    enum { input, output, delay_ms };
+
+    static constexpr double max_delay_seconds = 2;
+    // periods longer than this are processed in pieces
+    static constexpr size_type max_block = 4096;
+
+    sample_type * history = nullptr;
+    size_type mask = 0;
+    size_type write_pos = 0;
+
+    // dest = history[pos...] * gain, or += when mix_in is true
+    void read_history(sample_type * dest_in, size_type pos_in, size_type count_in, const sample_type gain_in, const bool mix_in)
+    {
+        while (count_in > 0) {
+            auto offset = pos_in & mask;
+            auto chunk = std::min(count_in, mask + 1 - offset);
+
+            if (mix_in) {
+                kernels.mix(dest_in, history + offset, gain_in, chunk);
+            } else {
+                kernels.scale(dest_in, history + offset, gain_in, chunk);
+            }
+
+            dest_in += chunk;
+            pos_in += chunk;
+            count_in -= chunk;
+        }
+    }
+
+    void process_block(const sample_type * in_in, sample_type * out_in, const size_type num_samples_in)
+    {
+        for (size_type i = 0; i < num_samples_in; i++) {
+            history[(write_pos + i) & mask] = in_in == nullptr ? 0 : in_in[i];
+        }
+
+        if (out_in != nullptr) {
+            double delay = std::min(double(control(delay_ms)), max_delay_seconds * 1000) * sample_rate / 1000;
+            delay = std::max(delay, 0.0);
+            auto whole = size_type(delay);
+            sample_type fraction = delay - whole;
+            // the history has room for the longest delay plus a block so
+            // reading whole + 1 samples back is always valid
+            auto read_pos = write_pos - whole;
+
+            read_history(out_in, read_pos, num_samples_in, 1 - fraction, false);
+
+            if (fraction != 0) {
+                read_history(out_in, read_pos - 1, num_samples_in, fraction, true);
+            }
+        }
+
+        write_pos += num_samples_in;
+    }
+
+    public:
+    native_delay(const size_type sample_rate_in, std::shared_ptr<arena> memory_in)
+    : instance("modpro delay", {
+        { "Input", true, true, 0 },
+        { "Output", true, false, 0 },
+        { "Delay (ms)", false, true, 0 },
+    }, sample_rate_in, memory_in)
+    {
+        size_type needed = max_delay_seconds * sample_rate + max_block + 2;
+        size_type size = 1;
+
+        while (size < needed) {
+            size *= 2;
+        }
+
+        mask = size - 1;
+        history = get_memory()->allocate_array<sample_type>(size);
+    }
+
+    // the delay can be turned up at any time so the whole history counts
+    virtual double get_tail() override
+    {
+        return max_delay_seconds;
+    }
+
+    protected:
+    virtual void reset() override
+    {
+        std::fill(history, history + mask + 1, 0);
+        write_pos = 0;
+    }
+
+    virtual void process(const size_type num_samples_in) override
+    {
+        auto in = buffer(input);
+        auto out = buffer(output);
+
+        for (size_type offset = 0; offset < num_samples_in; offset += max_block) {
+            auto count = std::min(max_block, num_samples_in - offset);
+            process_block(in == nullptr ? nullptr : in + offset, out == nullptr ? nullptr : out + offset, count);
+        }
+    }
+};
+
+// "modpro dc blocker"; a one pole high pass filter. Every sample depends
+// on the one before it so this one stays scalar.
+class native_dc_blocker : public native::instance {
+    enum { input, output, cutoff_hz };
+
+    data_type last_cutoff = -1;
+    double pole = 0;
+    double last_in = 0;
+    double last_out = 0;
+
+    public:
+    native_dc_blocker(const size_type sample_rate_in, std::shared_ptr<arena> memory_in)
+    : instance("modpro dc blocker", {
+        { "Input", true, true, 0 },
+        { "Output", true, false, 0 },
+        { "Cutoff (Hz)", false, true, 10 },
+    }, sample_rate_in, memory_in) { }
+
+    protected:
+    virtual void reset() override
+    {
+        last_in = last_out = 0;
+    }
+
+    virtual void process(const size_type num_samples_in) override
+    {
+        auto in = buffer(input);
+        auto out = buffer(output);
+
+        if (control(cutoff_hz) != last_cutoff) {
+            last_cutoff = control(cutoff_hz);
+            pole = exp(-2 * M_PI * std::max(last_cutoff, data_type(0)) / sample_rate);
+        }
+
+        for (size_type i = 0; i < num_samples_in; i++) {
+            double sample = in == nullptr ? 0 : in[i];
+            last_out = sample - last_in + pole * last_out;
+            last_in = sample;
+
+            if (out != nullptr) {
+                out[i] = last_out;
+            }
+        }
+
+        // keep denormals out of the feedback path once the input is silent
+        if (fabs(last_out) < 1e-30) {
+            last_out = 0;
+        }
+    }
+};
+
+template<typename T>
+static native::factory_type make_factory()
+{
+    return [](const native::size_type sample_rate_in, std::shared_ptr<arena> memory_in, const native::options_type & options_in) -> std::shared_ptr<native::instance> {
+        if (options_in.size() > 0) {
+            throw std::runtime_error("effect does not take options");
+        }
+
+        return std::make_shared<T>(sample_rate_in, memory_in);
+    };
+}
+
+native::native()
+{
+    types["modpro gain"] = make_factory<native_gain>();
+    types["modpro mixer"] = make_factory<native_mixer>();
+    types["modpro splitter"] = make_factory<native_splitter>();
+    types["modpro delay"] = make_factory<native_delay>();
+    types["modpro dc blocker"] = make_factory<native_dc_blocker>();
+    types["modpro udp source"] = netaudio::make_source;
+    types["modpro udp sink"] = netaudio::make_sink;
+
+    option_types.insert("modpro udp source");
+    option_types.insert("modpro udp sink");
+
+    std::cout << "Native effects use " << simd::get().name << " kernels" << std::endl;
+}
+
+bool native::has_type(const std::string & name_in)
+{
+    return types.count(name_in) != 0;
+}
+
+bool native::needs_options(const std::string & name_in)
+{
+    return option_types.count(name_in) != 0;
+}
+
+std::vector<std::string> native::get_type_names()
+{
+    std::vector<std::string> retval;
+
+    for (auto& i : types) {
+        retval.push_back(i.first);
+    }
+
+    return retval;
+}
+
+std::shared_ptr<native::instance> native::instantiate(const std::string name_in, const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const options_type & options_in)
+{
+    if (! has_type(name_in)) {
+        throw std::runtime_error("could not find native effect by name: " + name_in);
+    }
+
+    auto new_instance = types[name_in](sample_rate_in, memory_in, options_in);
+    new_instance->options = options_in;
+
+    return new_instance;
+}
+
+native::instance::instance(const std::string name_in, const std::vector<port> ports_in, const size_type sample_rate_in, std::shared_ptr<arena> memory_in)
+: name(name_in), ports(ports_in), memory(memory_in), sample_rate(sample_rate_in), kernels(simd::get())
+{
+    auto port_count = ports.size();
+
+    control_buffers = memory->allocate_array<data_type>(port_count);
+    control_requests = memory->allocate_array<std::atomic<data_type>>(port_count);
+    control_snapshot = memory->allocate_array<std::atomic<data_type>>(port_count);
+    audio_buffers = std::vector<sample_type *>(port_count, nullptr);
+
+    for (id_type i = 0; i < port_count; i++) {
+        auto& port = ports[i];
+        port_name_to_id[port.name] = i;
+
+        if (port.is_audio) {
+            continue;
+        }
+
+        if (port.is_input) {
+            control_inputs.push_back(i);
+        } else {
+            control_outputs.push_back(i);
+        }
+
+        control_buffers[i] = port.default_value;
+        control_requests[i].store(port.default_value);
+        control_snapshot[i].store(port.default_value);
+    }
+}
+
+std::shared_ptr<arena> native::instance::get_memory()
+{
+    return memory;
+}
+
+// inside jack audio thread
+native::data_type & native::instance::control(const id_type id_in)
+{
+    assert(! ports[id_in].is_audio);
+    return control_buffers[id_in];
+}
+
+// inside jack audio thread
+sample_type * native::instance::buffer(const id_type id_in)
+{
+    assert(ports[id_in].is_audio);
+    return audio_buffers[id_in];
+}
+
+native::id_type native::instance::get_control_id(const std::string & name_in)
+{
+    if (port_name_to_id.count(name_in) == 0 || ports[port_name_to_id[name_in]].is_audio) {
+        throw DBus::Error("hamradio.modpro.errors.ControlNameUnknown", "unknown control name");
+    }
+
+    return port_name_to_id[name_in];
+}
+
+const std::string native::instance::get_name()
+{
+    return name;
+}
+
+const std::string native::instance::get_label()
+{
+    return name;
+}
+
+const std::vector<native::port> & native::instance::get_ports()
+{
+    return ports;
+}
+
+const native::options_type & native::instance::get_options()
+{
+    return options;
+}
+
+native::data_type native::instance::get_control(const std::string name_in)
+{
+    return get_control(get_control_id(name_in));
+}
+
+void native::instance::set_control(const std::string name_in, const sample_type value_in)
+{
+    auto id = get_control_id(name_in);
+
+    if (! ports[id].is_input) {
+        throw std::runtime_error("can not set control output: " + name_in);
+    }
+
+    set_control(id, value_in);
+}
+
+native::data_type native::instance::get_control(const id_type id_in)
+{
+    assert(! ports[id_in].is_audio);
+    return control_snapshot[id_in].load(std::memory_order_relaxed);
+}
+
+void native::instance::set_control(const id_type id_in, const data_type value_in)
+{
+    assert(! ports[id_in].is_audio && ports[id_in].is_input);
+
+    control_requests[id_in].store(value_in, std::memory_order_relaxed);
+    control_snapshot[id_in].store(value_in, std::memory_order_relaxed);
+    controls_pending.store(true, std::memory_order_release);
+}
+
+double native::instance::read(const std::string & name_in)
+{
+    std::cout << "get control request: " << name_in << std::endl;
+    return get_control(name_in);
+}
+
+std::map<std::string, double> native::instance::read_all()
+{
+    std::map<std::string, double> retval;
+
+    for (auto& i : get_control_names()) {
+        retval[i] = get_control(i);
+    }
+
+    return retval;
+}
+
+void native::instance::write(const std::string & name_in, const double & value_in)
+{
+    std::cout << "set control request: " << name_in << " = " << value_in << std::endl;
+    set_control(name_in, value_in);
+}
+
+double native::instance::knudge(const std::string & name_in, const double & value_in)
+{
+    auto new_value = get_control(name_in) + value_in;
+    set_control(name_in, new_value);
+    return new_value;
+}
+
+std::vector<std::string> native::instance::get_control_names()
+{
+    std::vector<std::string> retval;
+
+    for (auto& i : ports) {
+        if (! i.is_audio) {
+            retval.push_back(i.name);
+        }
+    }
+
+    return retval;
+}
+
+std::vector<std::string> native::instance::get_input_control_names()
+{
+    std::vector<std::string> retval;
+
+    for (auto i : control_inputs) {
+        retval.push_back(ports[i].name);
+    }
+
+    return retval;
+}
+
+native::id_type native::instance::get_port_id(const std::string name_in)
+{
+    if (port_name_to_id.count(name_in) == 0) {
+        throw std::runtime_error("there is no known port named " + name_in);
+    }
+
+    return port_name_to_id[name_in];
+}
+
+std::vector<native::id_type> native::instance::get_audio_ports(const bool inputs_in)
+{
+    std::vector<id_type> retval;
+
+    for (id_type i = 0; i < ports.size(); i++) {
+        if (ports[i].is_audio && ports[i].is_input == inputs_in) {
+            retval.push_back(i);
+        }
+    }
+
+    return retval;
+}
+
+void native::instance::connect(const id_type port_id_in, sample_type * buffer_in)
+{
+    if (! ports.at(port_id_in).is_audio) {
+        throw std::runtime_error("can not connect a control port: " + ports[port_id_in].name);
+    }
+
+    audio_buffers[port_id_in] = buffer_in;
+}
+
+void native::instance::connect(const std::string name_in, sample_type * buffer_in)
+{
+    connect(get_port_id(name_in), buffer_in);
+}
+
+void native::instance::disconnect(const std::string name_in)
+{
+    connect(get_port_id(name_in), nullptr);
+}
+
+bool native::instance::is_inplace_broken()
+{
+    return false;
+}
+
+void native::instance::activate()
+{
+    apply_controls();
+    reset();
+}
+
+// outside jack audio thread
+void native::instance::restart()
+{
+    reset();
+}
+
+double native::instance::get_tail()
+{
+    return 0;
+}
+
+// inside jack audio thread
+void native::instance::run(const size_type num_samples_in)
+{
+    apply_controls();
+    process(num_samples_in);
+    publish_controls();
+}
+
+// inside jack audio thread
+void native::instance::apply_controls()
+{
+    if (! controls_pending.exchange(false, std::memory_order_acquire)) {
+        return;
+    }
+
+    for (auto i : control_inputs) {
+        control_buffers[i] = control_requests[i].load(std::memory_order_relaxed);
+    }
+}
+
+// inside jack audio thread
+void native::instance::publish_controls()
+{
+    for (auto i : control_outputs) {
+        control_snapshot[i].store(control_buffers[i], std::memory_order_relaxed);
+    }
+}
+
+}
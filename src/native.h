@@ -0,0 +1,141 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "effect.h"
+#include "simd.h"
+
+namespace modpro {
+
+// Effects that are built into modpro instead of being loaded from a LADSPA
+// plugin. They cover the simple stages nearly every chain has and run on
+// the vector kernels in simd.h. A config selects them by type name exactly
+// like a LADSPA type; the names all start with "modpro " so they do not
+// collide with plugins.
+struct native : public std::enable_shared_from_this<native> {
+    using data_type = effect::data_type;
+    using id_type = effect::id_type;
+    using size_type = effect::size_type;
+    // settings an effect is made with that are not controls, like the
+    // address a network effect talks to
+    using options_type = std::map<std::string, std::string>;
+
+    struct port {
+        const std::string name;
+        const bool is_audio;
+        const bool is_input;
+        const data_type default_value;
+    };
+
+    class instance : public modpro::effect {
+        const std::string name;
+        const std::vector<port> ports;
+        std::map<std::string, id_type> port_name_to_id;
+        // works the same as the control buffers in ladspa::instance: only
+        // the jack audio thread touches control_buffers, requests are
+        // staged in control_requests and control_snapshot is what other
+        // threads read
+        std::shared_ptr<arena> memory;
+        data_type * control_buffers = nullptr;
+        std::atomic<data_type> * control_requests = nullptr;
+        std::atomic<data_type> * control_snapshot = nullptr;
+        std::atomic<bool> controls_pending = ATOMIC_VAR_INIT(false);
+        std::vector<id_type> control_inputs;
+        std::vector<id_type> control_outputs;
+        std::vector<sample_type *> audio_buffers;
+        options_type options;
+
+        friend struct native;
+
+        void apply_controls();
+        void publish_controls();
+        id_type get_control_id(const std::string & name_in);
+
+    protected:
+        const size_type sample_rate;
+        const simd::kernels & kernels;
+
+        instance(const std::string name_in, const std::vector<port> ports_in, const size_type sample_rate_in, std::shared_ptr<arena> memory_in);
+        std::shared_ptr<arena> get_memory();
+        // the current value of a control port from inside the jack audio
+        // thread; effects may also set their control outputs with it
+        data_type & control(const id_type id_in);
+        // the buffer connected to an audio port or nullptr; an input that
+        // is not connected is silent and an output that is not connected
+        // is not written to
+        sample_type * buffer(const id_type id_in);
+        // called from activate() so effects can clear their state
+        virtual void reset() { }
+        virtual void process(const size_type num_samples_in) = 0;
+
+    public:
+        virtual const std::string get_name() override;
+        virtual const std::string get_label() override;
+        virtual data_type get_control(const std::string name_in) override;
+        virtual void set_control(const std::string name_in, const sample_type value_in) override;
+        virtual data_type get_control(const id_type id_in) override;
+        virtual void set_control(const id_type id_in, const data_type value_in) override;
+        virtual std::vector<std::string> get_control_names() override;
+        virtual std::vector<std::string> get_input_control_names() override;
+        virtual id_type get_port_id(const std::string name_in) override;
+        virtual std::vector<id_type> get_audio_ports(const bool inputs_in) override;
+        virtual void connect(const id_type port_id_in, sample_type * buffer_in) override;
+        virtual void connect(const std::string name_in, sample_type * buffer_in) override;
+        virtual void disconnect(const std::string name_in) override;
+        virtual bool is_inplace_broken() override;
+        virtual void activate() override;
+        virtual void restart() override;
+        virtual double get_tail() override;
+        virtual void run(const size_type num_samples_in) override;
+        virtual double read(const std::string & name_in) override;
+        virtual std::map<std::string, double> read_all() override;
+        virtual void write(const std::string & name_in, const double & value_in) override;
+        virtual double knudge(const std::string & name_in, const double & value_in) override;
+        const std::vector<port> & get_ports();
+        const options_type & get_options();
+    };
+
+    using factory_type = std::function<std::shared_ptr<instance> (const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const options_type & options_in)>;
+
+    private:
+    std::map<std::string, factory_type> types;
+    // types that can not be made without options
+    std::set<std::string> option_types;
+
+    public:
+    template<typename... Args>
+    static std::shared_ptr<native> make(Args... args)
+    {
+        return std::make_shared<native>(args...);
+    }
+
+    native();
+    bool has_type(const std::string & name_in);
+    bool needs_options(const std::string & name_in);
+    std::vector<std::string> get_type_names();
+    std::shared_ptr<instance> instantiate(const std::string name_in, const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const options_type & options_in = {});
+};
+
+}
@@ -0,0 +1,598 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <netdb.h>
+#include <random>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#include "netaudio.h"
+
+namespace modpro {
+
+using sample_type = netaudio::sample_type;
+using size_type = netaudio::size_type;
+
+static const char packet_magic[4] = { 'M', 'P', 'A', '1' };
+
+std::mutex netaudio::receiver::registry_mutex;
+std::map<std::string, std::weak_ptr<netaudio::receiver>> netaudio::receiver::registry;
+std::mutex netaudio::sender::registry_mutex;
+std::map<std::string, std::weak_ptr<netaudio::sender>> netaudio::sender::registry;
+
+static std::string get_option(const netaudio::options_type & options_in, const std::string & name_in, const std::string & default_in)
+{
+    auto found = options_in.find(name_in);
+
+    if (found == options_in.end()) {
+        return default_in;
+    }
+
+    return found->second;
+}
+
+static std::string get_required_option(const netaudio::options_type & options_in, const std::string & name_in)
+{
+    if (options_in.count(name_in) == 0) {
+        throw std::runtime_error("missing option: " + name_in);
+    }
+
+    return options_in.at(name_in);
+}
+
+static void check_options(const netaudio::options_type & options_in, const std::vector<std::string> & known_in)
+{
+    for (auto& i : options_in) {
+        if (std::find(known_in.begin(), known_in.end(), i.first) == known_in.end()) {
+            throw std::runtime_error("unknown option: " + i.first);
+        }
+    }
+}
+
+static addrinfo * resolve(const std::string & address_in, const std::string & port_in, const bool passive_in)
+{
+    addrinfo hints;
+    addrinfo * result;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = passive_in ? AI_PASSIVE : 0;
+
+    auto error = getaddrinfo(address_in.c_str(), port_in.c_str(), &hints, &result);
+
+    if (error != 0) {
+        throw std::runtime_error("could not resolve " + address_in + ":" + port_in + ": " + gai_strerror(error));
+    }
+
+    return result;
+}
+
+netaudio::receiver::receiver(const std::string & address_in, const std::string & port_in)
+: address(address_in), port(port_in)
+{
+    auto addresses = resolve(address, port, true);
+
+    fd = socket(addresses->ai_family, addresses->ai_socktype | SOCK_CLOEXEC, addresses->ai_protocol);
+
+    if (fd == -1 || bind(fd, addresses->ai_addr, addresses->ai_addrlen) != 0) {
+        auto error = std::string(strerror(errno));
+
+        freeaddrinfo(addresses);
+        if (fd != -1) {
+            close(fd);
+        }
+
+        throw std::runtime_error("could not listen on " + address + ":" + port + ": " + error);
+    }
+
+    freeaddrinfo(addresses);
+
+    // wake up often enough to notice the receiver is going away
+    timeval timeout = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::cout << "Receiving audio on UDP " << address << ":" << port << std::endl;
+
+    thread = std::thread([this]() -> void {
+        run();
+    });
+}
+
+netaudio::receiver::~receiver()
+{
+    stop.store(true);
+    thread.join();
+    close(fd);
+}
+
+std::shared_ptr<netaudio::receiver> netaudio::receiver::get(const std::string & address_in, const std::string & port_in)
+{
+    std::unique_lock<std::mutex> lock(registry_mutex);
+    auto key = address_in + ":" + port_in;
+    auto existing = registry[key].lock();
+
+    if (existing != nullptr) {
+        return existing;
+    }
+
+    auto new_receiver = std::make_shared<receiver>(address_in, port_in);
+    registry[key] = new_receiver;
+
+    return new_receiver;
+}
+
+// on the receiver thread
+void netaudio::receiver::run()
+{
+    uint8_t bytes[max_packet_size];
+    packet incoming;
+    bool have_transit = false;
+    double last_transit = 0;
+
+    while(! stop.load()) {
+        auto size = recv(fd, bytes, sizeof(bytes), 0);
+
+        if (size < 0) {
+            continue;
+        }
+
+        header head;
+        memcpy(&head, bytes, sizeof(head));
+
+        incoming.frames = ntohs(head.frames);
+
+        if (size_t(size) < sizeof(head) || memcmp(head.magic, packet_magic, sizeof(packet_magic)) != 0 || incoming.frames > max_frames || size_t(size) != sizeof(head) + incoming.frames * sizeof(int16_t)) {
+            invalid.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        incoming.sequence = ntohl(head.sequence);
+        incoming.sample_rate = ntohl(head.sample_rate);
+        incoming.arrival = timing::now();
+
+        for (size_t i = 0; i < incoming.frames; i++) {
+            uint16_t raw;
+            memcpy(&raw, bytes + sizeof(head) + i * sizeof(raw), sizeof(raw));
+            incoming.samples[i] = int16_t(ntohs(raw)) / 32768.0f;
+        }
+
+        // the sender clock is the sequence number times the packet size
+        if (incoming.sample_rate > 0) {
+            double sent_ns = double(incoming.sequence) * incoming.frames * 1000000000 / incoming.sample_rate;
+            double transit = incoming.arrival - sent_ns;
+
+            if (have_transit) {
+                auto jitter = jitter_ns.load(std::memory_order_relaxed);
+                jitter += (fabs(transit - last_transit) - jitter) / 16;
+                jitter_ns.store(jitter, std::memory_order_relaxed);
+            }
+
+            last_transit = transit;
+            have_transit = true;
+        }
+
+        received.fetch_add(1, std::memory_order_relaxed);
+
+        if (! packets.push(incoming)) {
+            overflows.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+netaudio::sender::sender(const std::string & address_in, const std::string & port_in, const size_type sample_rate_in, const size_t frames_in, const double loss_in, const double jitter_ms_in)
+: address(address_in), port(port_in), sample_rate(sample_rate_in), frames(frames_in), loss(loss_in), jitter_ns(jitter_ms_in * 1000000), samples(65536)
+{
+    if (frames == 0 || frames > max_frames) {
+        throw std::runtime_error("packets must hold between 1 and " + std::to_string(max_frames) + " samples");
+    }
+
+    auto addresses = resolve(address, port, false);
+
+    fd = socket(addresses->ai_family, addresses->ai_socktype | SOCK_CLOEXEC, addresses->ai_protocol);
+
+    if (fd == -1) {
+        freeaddrinfo(addresses);
+        throw std::runtime_error("could not make a socket for " + address + ":" + port + ": " + strerror(errno));
+    }
+
+    memcpy(&destination, addresses->ai_addr, addresses->ai_addrlen);
+    destination_size = addresses->ai_addrlen;
+    freeaddrinfo(addresses);
+
+    std::cout << "Sending audio to UDP " << address << ":" << port << " in packets of " << frames << " samples";
+    if (loss > 0 || jitter_ns > 0) {
+        std::cout << " with " << loss * 100 << "% simulated loss and " << jitter_ns / 1000000.0 << " ms simulated jitter";
+    }
+    std::cout << std::endl;
+
+    thread = std::thread([this]() -> void {
+        run();
+    });
+}
+
+netaudio::sender::~sender()
+{
+    stop.store(true);
+    thread.join();
+    close(fd);
+}
+
+std::shared_ptr<netaudio::sender> netaudio::sender::get(const std::string & address_in, const std::string & port_in, const size_type sample_rate_in, const size_t frames_in, const double loss_in, const double jitter_ms_in)
+{
+    std::unique_lock<std::mutex> lock(registry_mutex);
+    auto key = address_in + ":" + port_in + "/" + std::to_string(sample_rate_in) + "/" + std::to_string(frames_in);
+    key += "/" + std::to_string(loss_in) + "/" + std::to_string(jitter_ms_in);
+    auto existing = registry[key].lock();
+
+    if (existing != nullptr) {
+        return existing;
+    }
+
+    auto new_sender = std::make_shared<sender>(address_in, port_in, sample_rate_in, frames_in, loss_in, jitter_ms_in);
+    registry[key] = new_sender;
+
+    return new_sender;
+}
+
+// on the sender thread; a packet is sent as soon as the jack audio thread
+// has produced enough samples for it
+void netaudio::sender::run()
+{
+    std::vector<sample_type> block(frames);
+    std::vector<uint8_t> bytes(sizeof(header) + frames * sizeof(int16_t));
+    // packets held back to simulate jitter by when they are due
+    std::multimap<timing::ns_type, std::vector<uint8_t>> delayed;
+    std::mt19937 random(std::random_device{}());
+    std::uniform_real_distribution<double> chance(0, 1);
+    uint32_t sequence = 0;
+
+    auto transmit = [&](const std::vector<uint8_t> & bytes_in) -> void {
+        if (sendto(fd, bytes_in.data(), bytes_in.size(), 0, reinterpret_cast<sockaddr *>(&destination), destination_size) >= 0) {
+            sent.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    while(! stop.load()) {
+        while(samples.get_readable() >= frames) {
+            samples.pop(block.data(), frames);
+
+            header head;
+            memcpy(head.magic, packet_magic, sizeof(packet_magic));
+            head.sequence = htonl(sequence++);
+            head.sample_rate = htonl(sample_rate);
+            head.frames = htons(frames);
+            head.reserved = 0;
+            memcpy(bytes.data(), &head, sizeof(head));
+
+            for (size_t i = 0; i < frames; i++) {
+                auto clipped = std::max(-1.0f, std::min(1.0f, block[i]));
+                uint16_t raw = htons(uint16_t(int16_t(lrintf(clipped * 32767))));
+                memcpy(bytes.data() + sizeof(head) + i * sizeof(raw), &raw, sizeof(raw));
+            }
+
+            if (loss > 0 && chance(random) < loss) {
+                continue;
+            }
+
+            if (jitter_ns > 0) {
+                delayed.emplace(timing::now() + timing::ns_type(chance(random) * jitter_ns), bytes);
+            } else {
+                transmit(bytes);
+            }
+        }
+
+        auto now = timing::now();
+        while(delayed.size() > 0 && delayed.begin()->first <= now) {
+            transmit(delayed.begin()->second);
+            delayed.erase(delayed.begin());
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+}
+
+// "modpro udp source"; plays the packets from a receiver in sequence order
+// after holding enough of them to ride out the jitter the receiver has
+// measured. A lost packet is covered by repeating the last one at half the
+// level each time, which fades to silence over a few packets. When the
+// buffer has grown well past what the jitter calls for a packet is dropped
+// so a sender with a slightly fast clock does not build up latency.
+class native_udp_source : public native::instance {
+    enum { output, min_buffer_ms, max_buffer_ms, buffer_ms, jitter_ms, lost_packets, late_packets, underruns, loss_percent };
+
+    static const size_t slot_count = 64;
+
+    std::shared_ptr<netaudio::receiver> source;
+    std::vector<netaudio::packet> slots;
+    std::vector<bool> filled;
+    netaudio::packet incoming;
+    netaudio::packet last;
+    bool have_sequence = false;
+    bool playing = false;
+    uint32_t next_sequence = 0;
+    uint32_t newest = 0;
+    size_t play_offset = 0;
+    size_t packet_frames = 0;
+    uint64_t played_count = 0;
+    uint64_t lost_count = 0;
+    uint64_t late_count = 0;
+    uint64_t underrun_count = 0;
+
+    void restart(const uint32_t sequence_in)
+    {
+        std::fill(filled.begin(), filled.end(), false);
+        next_sequence = newest = sequence_in;
+        play_offset = 0;
+        playing = false;
+    }
+
+    void accept(const netaudio::packet & packet_in)
+    {
+        if (packet_in.sample_rate != sample_rate || packet_in.frames == 0) {
+            return;
+        }
+
+        if (! have_sequence) {
+            have_sequence = true;
+            restart(packet_in.sequence);
+        }
+
+        auto ahead = int32_t(packet_in.sequence - next_sequence);
+
+        // the sender started over or the link was down for a while
+        if (ahead >= int32_t(slot_count) || ahead < -int32_t(slot_count)) {
+            restart(packet_in.sequence);
+            ahead = 0;
+        }
+
+        auto index = packet_in.sequence % slot_count;
+
+        if (ahead < 0 || (ahead == 0 && play_offset > 0) || (filled[index] && slots[index].sequence == packet_in.sequence)) {
+            late_count++;
+            return;
+        }
+
+        slots[index] = packet_in;
+        filled[index] = true;
+        packet_frames = packet_in.frames;
+
+        if (int32_t(packet_in.sequence - newest) > 0) {
+            newest = packet_in.sequence;
+        }
+    }
+
+    size_t get_buffered()
+    {
+        if (! have_sequence) {
+            return 0;
+        }
+
+        return size_t(int32_t(newest - next_sequence) + 1) * packet_frames - play_offset;
+    }
+
+    size_t get_target()
+    {
+        double jitter = source->jitter_ns.load(std::memory_order_relaxed) * sample_rate / 1000000000;
+        double wanted = packet_frames + 3 * jitter;
+        double lowest = double(control(min_buffer_ms)) * sample_rate / 1000;
+        double highest = std::max(lowest, double(control(max_buffer_ms)) * sample_rate / 1000);
+
+        return size_t(std::min(std::max(wanted, lowest), highest));
+    }
+
+    // replaces the missing packet with a quieter copy of the last one
+    void conceal()
+    {
+        auto index = next_sequence % slot_count;
+
+        slots[index].sequence = next_sequence;
+        slots[index].sample_rate = sample_rate;
+        slots[index].frames = packet_frames;
+        slots[index].arrival = 0;
+
+        for (size_t i = 0; i < packet_frames; i++) {
+            slots[index].samples[i] = i < last.frames ? last.samples[i] * 0.5f : 0;
+        }
+
+        filled[index] = true;
+        lost_count++;
+    }
+
+    public:
+    native_udp_source(const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const netaudio::options_type & options_in)
+    : instance("modpro udp source", {
+        { "Output", true, false, 0 },
+        { "Minimum buffer (ms)", false, true, 20 },
+        { "Maximum buffer (ms)", false, true, 200 },
+        { "Buffer (ms)", false, false, 0 },
+        { "Jitter (ms)", false, false, 0 },
+        { "Lost packets", false, false, 0 },
+        { "Late packets", false, false, 0 },
+        { "Underruns", false, false, 0 },
+        { "Loss (%)", false, false, 0 },
+    }, sample_rate_in, memory_in), slots(slot_count), filled(slot_count, false)
+    {
+        check_options(options_in, { "address", "port" });
+        source = netaudio::receiver::get(get_option(options_in, "address", "0.0.0.0"), get_required_option(options_in, "port"));
+        last.frames = 0;
+    }
+
+    // plays what arrives from the network whatever the chain inputs do
+    virtual double get_tail() override
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    protected:
+    virtual void reset() override
+    {
+        have_sequence = false;
+        playing = false;
+        last.frames = 0;
+
+        // anything that queued up before the chain started is stale
+        while(source->packets.pop(incoming)) { }
+    }
+
+    virtual void process(const size_type num_samples_in) override
+    {
+        auto out = buffer(output);
+        size_t done = 0;
+
+        while(source->packets.pop(incoming)) {
+            accept(incoming);
+        }
+
+        if (! playing && have_sequence && get_buffered() >= get_target()) {
+            playing = true;
+        }
+
+        while(done < num_samples_in) {
+            auto index = next_sequence % slot_count;
+
+            if (! playing) {
+                if (out != nullptr) {
+                    std::fill(out + done, out + num_samples_in, 0);
+                }
+
+                break;
+            }
+
+            if (! filled[index] || slots[index].sequence != next_sequence) {
+                if (int32_t(newest - next_sequence) <= 0) {
+                    // nothing to play until more arrives
+                    underrun_count++;
+                    playing = false;
+                    continue;
+                }
+
+                conceal();
+            }
+
+            auto& current = slots[index];
+            auto count = std::min(num_samples_in - done, current.frames - play_offset);
+
+            if (out != nullptr) {
+                std::copy(current.samples + play_offset, current.samples + play_offset + count, out + done);
+            }
+
+            play_offset += count;
+            done += count;
+
+            if (play_offset == current.frames) {
+                if (current.arrival != 0) {
+                    played_count++;
+                }
+
+                last = current;
+                filled[index] = false;
+                next_sequence++;
+                play_offset = 0;
+            }
+        }
+
+        auto target = get_target();
+
+        if (playing && play_offset == 0 && get_buffered() > std::max(2 * target, target + 2 * packet_frames)) {
+            filled[next_sequence % slot_count] = false;
+            next_sequence++;
+        }
+
+        control(buffer_ms) = get_buffered() * 1000.0 / sample_rate;
+        control(jitter_ms) = source->jitter_ns.load(std::memory_order_relaxed) / 1000000;
+        control(lost_packets) = lost_count;
+        control(late_packets) = late_count;
+        control(underruns) = underrun_count;
+        control(loss_percent) = played_count + lost_count == 0 ? 0 : 100.0 * lost_count / (played_count + lost_count);
+    }
+};
+
+// "modpro udp sink"; hands every block to a sender
+class native_udp_sink : public native::instance {
+    enum { input, sent_packets, overruns };
+
+    std::shared_ptr<netaudio::sender> destination;
+    uint64_t overrun_count = 0;
+
+    public:
+    native_udp_sink(const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const netaudio::options_type & options_in)
+    : instance("modpro udp sink", {
+        { "Input", true, true, 0 },
+        { "Sent packets", false, false, 0 },
+        { "Overruns", false, false, 0 },
+    }, sample_rate_in, memory_in)
+    {
+        check_options(options_in, { "address", "port", "packet_ms", "simulate_loss", "simulate_jitter_ms" });
+
+        auto packet_ms = std::stod(get_option(options_in, "packet_ms", "10"));
+        auto loss = std::stod(get_option(options_in, "simulate_loss", "0")) / 100;
+        auto jitter_ms = std::stod(get_option(options_in, "simulate_jitter_ms", "0"));
+
+        destination = netaudio::sender::get(get_required_option(options_in, "address"), get_required_option(options_in, "port"), sample_rate, size_t(packet_ms * sample_rate / 1000), loss, jitter_ms);
+    }
+
+    // the far end expects a steady stream of packets, silent or not
+    virtual double get_tail() override
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    protected:
+    virtual void process(const size_type num_samples_in) override
+    {
+        auto in = buffer(input);
+
+        if (in != nullptr && ! destination->samples.push(in, num_samples_in)) {
+            overrun_count++;
+        }
+
+        control(sent_packets) = destination->sent.load(std::memory_order_relaxed);
+        control(overruns) = overrun_count;
+    }
+};
+
+// a port can only be bound once whatever the address
+std::string netaudio::get_endpoint(const std::string & type_in, const options_type & options_in)
+{
+    if (type_in == "modpro udp source") {
+        return "UDP port " + get_option(options_in, "port", "");
+    } else if (type_in == "modpro udp sink") {
+        return "UDP destination " + get_option(options_in, "address", "") + ":" + get_option(options_in, "port", "");
+    }
+
+    return "";
+}
+
+std::shared_ptr<native::instance> netaudio::make_source(const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const options_type & options_in)
+{
+    return std::make_shared<native_udp_source>(sample_rate_in, memory_in, options_in);
+}
+
+std::shared_ptr<native::instance> netaudio::make_sink(const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const options_type & options_in)
+{
+    return std::make_shared<native_udp_sink>(sample_rate_in, memory_in, options_in);
+}
+
+}
@@ -0,0 +1,134 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+
+#include "native.h"
+#include "ring.h"
+#include "timing.h"
+
+namespace modpro {
+
+// Sends and receives mono audio over UDP so a remote station does not need
+// a network audio JACK client of its own. Every packet carries a sequence
+// number and 16 bit PCM. The sockets belong to a thread per endpoint which
+// only talks to the jack audio thread through lock-free rings; an endpoint
+// is shared by every effect using the same address so an effect made again
+// for a new sample rate or a reload does not have to wait for the old one
+// to let go of the port.
+struct netaudio {
+    using sample_type = effect::sample_type;
+    using size_type = effect::size_type;
+    using options_type = native::options_type;
+
+    // on the wire every field is in network byte order and is followed by
+    // frames 16 bit samples, also in network byte order
+    struct header {
+        char magic[4];
+        uint32_t sequence;
+        uint32_t sample_rate;
+        uint16_t frames;
+        uint16_t reserved;
+    };
+
+    // keeps a packet under the 1500 byte ethernet MTU
+    static const size_t max_frames = 640;
+    static const size_t max_packet_size = sizeof(header) + max_frames * sizeof(int16_t);
+
+    // a received packet after the samples were converted to float
+    struct packet {
+        uint32_t sequence;
+        uint32_t sample_rate;
+        size_t frames;
+        // when it arrived or 0 when it was made up to cover a lost packet
+        timing::ns_type arrival;
+        sample_type samples[max_frames];
+    };
+
+    class receiver {
+        static std::mutex registry_mutex;
+        static std::map<std::string, std::weak_ptr<receiver>> registry;
+
+        const std::string address;
+        const std::string port;
+        int fd = -1;
+        std::thread thread;
+        std::atomic<bool> stop = ATOMIC_VAR_INIT(false);
+
+        void run();
+
+        public:
+        ring<packet> packets = ring<packet>(64);
+        std::atomic<uint64_t> received = ATOMIC_VAR_INIT(0);
+        // packets that were not ours or were dropped because the ring was full
+        std::atomic<uint64_t> invalid = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> overflows = ATOMIC_VAR_INIT(0);
+        // the interarrival jitter from RFC 3550 in ns
+        std::atomic<double> jitter_ns = ATOMIC_VAR_INIT(0);
+
+        receiver(const std::string & address_in, const std::string & port_in);
+        ~receiver();
+        static std::shared_ptr<receiver> get(const std::string & address_in, const std::string & port_in);
+    };
+
+    class sender {
+        static std::mutex registry_mutex;
+        static std::map<std::string, std::weak_ptr<sender>> registry;
+
+        const std::string address;
+        const std::string port;
+        const size_type sample_rate;
+        const size_t frames;
+        // for testing over loopback: the share of packets that are not
+        // sent and the most a packet is held back for
+        const double loss;
+        const timing::ns_type jitter_ns;
+        int fd = -1;
+        sockaddr_storage destination;
+        socklen_t destination_size = 0;
+        std::thread thread;
+        std::atomic<bool> stop = ATOMIC_VAR_INIT(false);
+
+        void run();
+
+        public:
+        sample_ring<sample_type> samples;
+        std::atomic<uint64_t> sent = ATOMIC_VAR_INIT(0);
+
+        sender(const std::string & address_in, const std::string & port_in, const size_type sample_rate_in, const size_t frames_in, const double loss_in, const double jitter_ms_in);
+        ~sender();
+        static std::shared_ptr<sender> get(const std::string & address_in, const std::string & port_in, const size_type sample_rate_in, const size_t frames_in, const double loss_in, const double jitter_ms_in);
+    };
+
+    // What the endpoint of an effect is shared by; every receiver ring has
+    // one consumer and every sender ring one producer so no two effects in
+    // a configuration may have the same one. Empty for other types.
+    static std::string get_endpoint(const std::string & type_in, const options_type & options_in);
+
+    // "modpro udp source" and "modpro udp sink"
+    static std::shared_ptr<native::instance> make_source(const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const options_type & options_in);
+    static std::shared_ptr<native::instance> make_sink(const size_type sample_rate_in, std::shared_ptr<arena> memory_in, const options_type & options_in);
+};
+
+}
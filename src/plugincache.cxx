@@ -0,0 +1,211 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include <yaml-cpp/yaml.h>
+
+#include "plugincache.h"
+
+#define CACHE_VERSION 1
+
+namespace modpro {
+
+plugin_cache::plugin_cache(const std::string path_in)
+: path(path_in)
+{
+    try {
+        load();
+    } catch (std::exception & e) {
+        std::cout << "Ignoring plugin cache " << path << ": " << e.what() << std::endl;
+        entries.clear();
+    }
+}
+
+std::string plugin_cache::get_default_path()
+{
+    auto cache_home = getenv("XDG_CACHE_HOME");
+
+    if (cache_home != nullptr && cache_home[0] != '\0') {
+        return std::string(cache_home) + "/modpro/plugins.yml";
+    }
+
+    auto home = getenv("HOME");
+
+    if (home != nullptr && home[0] != '\0') {
+        return std::string(home) + "/.cache/modpro/plugins.yml";
+    }
+
+    return "";
+}
+
+bool plugin_cache::get_file_stamp(const std::string & path_in, int64_t & mtime_out, int64_t & size_out)
+{
+    struct stat info;
+
+    if (stat(path_in.c_str(), &info) != 0) {
+        return false;
+    }
+
+    mtime_out = int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    size_out = info.st_size;
+
+    return true;
+}
+
+void plugin_cache::load()
+{
+    struct stat info;
+
+    if (stat(path.c_str(), &info) != 0) {
+        return;
+    }
+
+    auto root = YAML::LoadFile(path);
+
+    if (root["version"].as<int>(0) != CACHE_VERSION) {
+        return;
+    }
+
+    for (auto i : root["files"]) {
+        entry new_entry;
+
+        new_entry.mtime = i["mtime"].as<int64_t>();
+        new_entry.size = i["size"].as<int64_t>();
+
+        for (auto j : i["types"]) {
+            ladspa::type_info type;
+
+            type.id = j["id"].as<ladspa::id_type>();
+            type.name = j["name"].as<std::string>();
+            type.label = j["label"].as<std::string>();
+            type.properties = j["properties"].as<int>();
+
+            for (auto k : j["ports"]) {
+                type.ports.push_back({
+                    k["name"].as<std::string>(),
+                    k["descriptor"].as<int>(),
+                    k["hints"].as<int>(),
+                    k["lower"].as<ladspa::data_type>(),
+                    k["upper"].as<ladspa::data_type>(),
+                });
+            }
+
+            new_entry.types.push_back(type);
+        }
+
+        entries[i["path"].as<std::string>()] = new_entry;
+    }
+}
+
+bool plugin_cache::lookup(const std::string & plugin_path_in, std::vector<ladspa::type_info> & types_out)
+{
+    int64_t mtime, size;
+
+    if (entries.count(plugin_path_in) == 0 || ! get_file_stamp(plugin_path_in, mtime, size)) {
+        return false;
+    }
+
+    auto& found = entries[plugin_path_in];
+
+    if (found.mtime != mtime || found.size != size) {
+        return false;
+    }
+
+    types_out = found.types;
+    return true;
+}
+
+void plugin_cache::store(const std::string & plugin_path_in, const std::vector<ladspa::type_info> & types_in)
+{
+    int64_t mtime, size;
+
+    if (! get_file_stamp(plugin_path_in, mtime, size)) {
+        return;
+    }
+
+    entries[plugin_path_in] = { mtime, size, types_in };
+    dirty = true;
+}
+
+// the cache is only an optimization so failing to write it is not an error
+void plugin_cache::save()
+{
+    if (! dirty) {
+        return;
+    }
+
+    YAML::Emitter out;
+
+    out << YAML::BeginMap;
+    out << YAML::Key << "version" << YAML::Value << CACHE_VERSION;
+    out << YAML::Key << "files" << YAML::Value << YAML::BeginSeq;
+
+    for (auto& i : entries) {
+        out << YAML::BeginMap;
+        out << YAML::Key << "path" << YAML::Value << i.first;
+        out << YAML::Key << "mtime" << YAML::Value << i.second.mtime;
+        out << YAML::Key << "size" << YAML::Value << i.second.size;
+        out << YAML::Key << "types" << YAML::Value << YAML::BeginSeq;
+
+        for (auto& j : i.second.types) {
+            out << YAML::BeginMap;
+            out << YAML::Key << "id" << YAML::Value << j.id;
+            out << YAML::Key << "name" << YAML::Value << j.name;
+            out << YAML::Key << "label" << YAML::Value << j.label;
+            out << YAML::Key << "properties" << YAML::Value << j.properties;
+            out << YAML::Key << "ports" << YAML::Value << YAML::BeginSeq;
+
+            for (auto& k : j.ports) {
+                out << YAML::Flow << YAML::BeginMap;
+                out << YAML::Key << "name" << YAML::Value << k.name;
+                out << YAML::Key << "descriptor" << YAML::Value << k.descriptor;
+                out << YAML::Key << "hints" << YAML::Value << k.hints;
+                out << YAML::Key << "lower" << YAML::Value << k.lower;
+                out << YAML::Key << "upper" << YAML::Value << k.upper;
+                out << YAML::EndMap;
+            }
+
+            out << YAML::EndSeq << YAML::EndMap;
+        }
+
+        out << YAML::EndSeq << YAML::EndMap;
+    }
+
+    out << YAML::EndSeq << YAML::EndMap;
+
+    // only the last directory is made; ~/.cache is expected to exist
+    auto slash = path.rfind('/');
+    if (slash != std::string::npos && slash > 0) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+
+    auto temp_path = path + ".tmp";
+    std::ofstream file(temp_path);
+    file << out.c_str() << std::endl;
+    file.close();
+
+    if (! file || rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::cout << "Could not write plugin cache " << path << std::endl;
+        return;
+    }
+
+    dirty = false;
+}
+
+}
@@ -0,0 +1,66 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ladspa.h"
+
+namespace modpro {
+
+// Remembers the types and ports in each plugin file so starting up does
+// not have to load every library in the configuration just to read its
+// descriptors. An entry is only used while the file still has the same
+// modification time and size it had when it was scanned.
+struct plugin_cache : public std::enable_shared_from_this<plugin_cache> {
+    private:
+    struct entry {
+        int64_t mtime;
+        int64_t size;
+        std::vector<ladspa::type_info> types;
+    };
+
+    std::map<std::string, entry> entries;
+    bool dirty = false;
+
+    static bool get_file_stamp(const std::string & path_in, int64_t & mtime_out, int64_t & size_out);
+    void load();
+
+    public:
+    const std::string path;
+
+    template<typename... Args>
+    static std::shared_ptr<plugin_cache> make(Args... args)
+    {
+        return std::make_shared<plugin_cache>(args...);
+    }
+
+    // an unreadable cache is treated as empty
+    plugin_cache(const std::string path_in);
+    // $XDG_CACHE_HOME/modpro/plugins.yml or ~/.cache/modpro/plugins.yml;
+    // empty if neither variable is set
+    static std::string get_default_path();
+    bool lookup(const std::string & plugin_path_in, std::vector<ladspa::type_info> & types_out);
+    void store(const std::string & plugin_path_in, const std::vector<ladspa::type_info> & types_in);
+    // writes the cache out if anything was stored since it was read
+    void save();
+};
+
+}
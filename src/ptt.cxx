@@ -0,0 +1,260 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ptt.h"
+
+namespace modpro {
+
+// the thread checks if it should stop this often
+static const int poll_timeout_ms = 100;
+// a client that sends this much without a newline is not talking rigctld
+static const size_t max_line_size = 256;
+
+ptt_server::ptt_server(const std::string & unix_path_in, const std::string & tcp_address_in, setter_type setter_in, getter_type getter_in)
+: unix_path(unix_path_in), tcp_address(tcp_address_in), setter(setter_in), getter(getter_in)
+{
+    try {
+        if (unix_path != "") {
+            listen_unix();
+        }
+
+        if (tcp_address != "") {
+            listen_tcp();
+        }
+    } catch (...) {
+        for (auto i : listeners) {
+            close(i);
+        }
+
+        throw;
+    }
+
+    thread = std::thread([this]() -> void {
+        run();
+    });
+}
+
+ptt_server::~ptt_server()
+{
+    stop.store(true);
+    thread.join();
+
+    for (auto& i : clients) {
+        close(i.first);
+    }
+
+    for (auto i : listeners) {
+        close(i);
+    }
+
+    if (unix_path != "") {
+        unlink(unix_path.c_str());
+    }
+}
+
+void ptt_server::listen_unix()
+{
+    sockaddr_un address;
+
+    if (unix_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("PTT socket path is too long: " + unix_path);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, unix_path.c_str());
+
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd == -1) {
+        throw std::runtime_error("could not make PTT socket: " + std::string(strerror(errno)));
+    }
+
+    listeners.push_back(fd);
+
+    // a socket left behind by an earlier run that did not exit cleanly
+    unlink(unix_path.c_str());
+
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 4) != 0) {
+        throw std::runtime_error("could not listen for PTT on " + unix_path + ": " + strerror(errno));
+    }
+
+    std::cout << "  Listening for PTT on " << unix_path << std::endl;
+}
+
+void ptt_server::listen_tcp()
+{
+    auto separator = tcp_address.rfind(':');
+
+    if (separator == std::string::npos) {
+        throw std::runtime_error("PTT TCP address must be host:port: " + tcp_address);
+    }
+
+    auto host = tcp_address.substr(0, separator);
+    auto port = tcp_address.substr(separator + 1);
+
+    // [::1]:4532
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    addrinfo hints;
+    addrinfo * addresses;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    auto error = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+
+    if (error != 0) {
+        throw std::runtime_error("could not resolve PTT address " + tcp_address + ": " + gai_strerror(error));
+    }
+
+    auto fd = socket(addresses->ai_family, addresses->ai_socktype | SOCK_CLOEXEC, addresses->ai_protocol);
+
+    if (fd == -1) {
+        freeaddrinfo(addresses);
+        throw std::runtime_error("could not make PTT socket: " + std::string(strerror(errno)));
+    }
+
+    listeners.push_back(fd);
+
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    auto bound = bind(fd, addresses->ai_addr, addresses->ai_addrlen) == 0 && listen(fd, 4) == 0;
+    freeaddrinfo(addresses);
+
+    if (! bound) {
+        throw std::runtime_error("could not listen for PTT on " + tcp_address + ": " + strerror(errno));
+    }
+
+    std::cout << "  Listening for PTT on TCP " << tcp_address << std::endl;
+}
+
+// on the PTT thread
+void ptt_server::run()
+{
+    std::vector<pollfd> fds;
+    char bytes[max_line_size];
+
+    while(! stop.load()) {
+        fds.clear();
+
+        for (auto i : listeners) {
+            fds.push_back({ i, POLLIN, 0 });
+        }
+
+        for (auto& i : clients) {
+            fds.push_back({ i.first, POLLIN, 0 });
+        }
+
+        if (poll(fds.data(), fds.size(), poll_timeout_ms) <= 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            auto fd = fds[i].fd;
+
+            if (fds[i].revents == 0) {
+                continue;
+            }
+
+            if (i < listeners.size()) {
+                auto client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+
+                if (client != -1) {
+                    // answers go out as soon as they are written
+                    int enable = 1;
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                    clients[client] = "";
+                }
+
+                continue;
+            }
+
+            auto size = read(fd, bytes, sizeof(bytes));
+            bool keep = size > 0;
+            auto& pending = clients[fd];
+
+            for (ssize_t j = 0; keep && j < size; j++) {
+                if (bytes[j] == '\n') {
+                    keep = handle_line(fd, pending);
+                    pending.clear();
+                } else if (bytes[j] != '\r') {
+                    pending += bytes[j];
+                }
+            }
+
+            if (pending.size() >= max_line_size) {
+                keep = false;
+            }
+
+            if (! keep) {
+                close(fd);
+                clients.erase(fd);
+            }
+        }
+    }
+}
+
+// on the PTT thread; returns false if the client should be dropped
+bool ptt_server::handle_line(const int fd_in, const std::string & line_in)
+{
+    std::istringstream words(line_in);
+    std::string command, argument;
+
+    words >> command >> argument;
+
+    if (command == "") {
+        return true;
+    }
+
+    std::string reply;
+
+    if ((command == "T" || command == "\\set_ptt") && (argument == "0" || argument == "1")) {
+        setter(argument == "1");
+        reply = "RPRT 0\n";
+    } else if (command == "T" || command == "\\set_ptt") {
+        // RIG_EINVAL
+        reply = "RPRT -1\n";
+    } else if (command == "t" || command == "\\get_ptt") {
+        reply = getter() ? "1\n" : "0\n";
+    } else if (command == "q" || command == "Q") {
+        return false;
+    } else {
+        // RIG_ENIMPL
+        reply = "RPRT -4\n";
+    }
+
+    return send(fd_in, reply.data(), reply.size(), MSG_NOSIGNAL) == ssize_t(reply.size());
+}
+
+}
@@ -0,0 +1,71 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace modpro {
+
+// Takes the PTT state from local programs over a unix socket, TCP or both.
+// It speaks the part of the rigctld protocol that keyboard-ptt uses, one
+// command per line:
+//
+//     T 1 or T 0      key or unkey; answered with RPRT 0
+//     t               answered with the current state, 1 or 0
+//
+// plus the long forms \set_ptt and \get_ptt. Anything else is answered
+// with RPRT -4 which is what rigctld says about a command it does not
+// implement. Every socket is served by one thread that waits in poll() so
+// a change is handed to the setter as soon as its line arrives.
+class ptt_server {
+    public:
+    using setter_type = std::function<void (const bool)>;
+    using getter_type = std::function<bool ()>;
+
+    private:
+    const std::string unix_path;
+    const std::string tcp_address;
+    setter_type setter;
+    getter_type getter;
+    std::vector<int> listeners;
+    // a partial line from each client
+    std::map<int, std::string> clients;
+    std::thread thread;
+    std::atomic<bool> stop = ATOMIC_VAR_INIT(false);
+
+    void listen_unix();
+    void listen_tcp();
+    void run();
+    bool handle_line(const int fd_in, const std::string & line_in);
+
+    public:
+    // either address can be empty; tcp_address_in is host:port
+    ptt_server(const std::string & unix_path_in, const std::string & tcp_address_in, setter_type setter_in, getter_type getter_in);
+    ~ptt_server();
+    template<typename... Args>
+    static std::shared_ptr<ptt_server> make(Args... args)
+    {
+        return std::make_shared<ptt_server>(args...);
+    }
+};
+
+}
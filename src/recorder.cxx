@@ -0,0 +1,356 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "recorder.h"
+#include "wavfile.h"
+
+namespace modpro {
+
+recorder::stream::stream(const std::string & name_in, const size_type sample_rate_in, const size_t capacity_in)
+: name(name_in), sample_rate(sample_rate_in), samples(capacity_in)
+{
+    void * buffer;
+
+    if (posix_memalign(&buffer, direct_alignment, staging_size) != 0) {
+        throw std::runtime_error("could not allocate recorder buffer for " + name);
+    }
+
+    staging.reset(static_cast<uint8_t *>(buffer));
+}
+
+// inside jack audio thread or a worker thread
+void recorder::stream::push(const sample_type * samples_in, const size_type count_in)
+{
+    if (! samples.push(samples_in, count_in)) {
+        overruns.fetch_add(1, std::memory_order_relaxed);
+        dropped_samples.fetch_add(count_in, std::memory_order_relaxed);
+    }
+}
+
+// inside jack audio thread or a worker thread
+void recorder::stream::push_silence(const size_type count_in)
+{
+    if (! samples.push_silence(count_in)) {
+        overruns.fetch_add(1, std::memory_order_relaxed);
+        dropped_samples.fetch_add(count_in, std::memory_order_relaxed);
+    }
+}
+
+recorder::recorder(const std::string & directory_in, const format format_in, const double rotate_seconds_in, const bool direct_io_in, const double buffer_seconds_in)
+: directory(directory_in), file_format(format_in), rotate_ns(rotate_seconds_in * 1000000000), direct_io(direct_io_in), buffer_seconds(buffer_seconds_in)
+{
+    if (buffer_seconds <= 0) {
+        throw std::runtime_error("recorder buffer must be greater than 0 seconds");
+    }
+}
+
+recorder::~recorder()
+{
+    if (writer_thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(writer_mutex);
+            writer_stop = true;
+        }
+
+        writer_wakeup.notify_all();
+        writer_thread.join();
+    }
+}
+
+recorder::format recorder::parse_format(const std::string & name_in)
+{
+    if (name_in == "wav") {
+        return format::wav;
+    }
+
+    if (name_in == "raw") {
+        return format::raw;
+    }
+
+    throw std::runtime_error("unknown recording format: " + name_in);
+}
+
+// outside jack audio thread
+std::shared_ptr<recorder::stream> recorder::get_stream(const std::string & name_in, const size_type sample_rate_in)
+{
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    auto found = streams.find(name_in);
+
+    if (found != streams.end()) {
+        if (found->second->sample_rate == sample_rate_in) {
+            return found->second;
+        }
+
+        retired.push_back(found->second);
+    }
+
+    size_t capacity = 4096;
+    while(capacity < buffer_seconds * sample_rate_in) {
+        capacity *= 2;
+    }
+
+    auto new_stream = std::make_shared<stream>(name_in, sample_rate_in, capacity);
+    streams[name_in] = new_stream;
+
+    return new_stream;
+}
+
+void recorder::start()
+{
+    writer_thread = std::thread([this]() -> void {
+        run_writer();
+    });
+}
+
+void recorder::rotate()
+{
+    rotations.fetch_add(1, std::memory_order_relaxed);
+    writer_wakeup.notify_all();
+}
+
+std::map<std::string, double> recorder::get_stats()
+{
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    std::map<std::string, double> retval;
+
+    for (auto& i : streams) {
+        retval[i.first + "_overruns"] = i.second->overruns.load(std::memory_order_relaxed);
+        retval[i.first + "_dropped_samples"] = i.second->dropped_samples.load(std::memory_order_relaxed);
+        retval[i.first + "_written_bytes"] = i.second->written_bytes.load(std::memory_order_relaxed);
+    }
+
+    return retval;
+}
+
+// on the writer thread; the rings are drained without holding the mutex
+// so a reload is never held up by the disk
+void recorder::run_writer()
+{
+    uint64_t seen_rotations = rotations.load(std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(writer_mutex);
+
+    while(true) {
+        writer_wakeup.wait_for(lock, std::chrono::milliseconds(100));
+
+        auto stopping = writer_stop;
+        std::vector<std::shared_ptr<stream>> work(retired);
+
+        for (auto& i : streams) {
+            work.push_back(i.second);
+        }
+
+        lock.unlock();
+
+        auto rotation = rotations.load(std::memory_order_relaxed);
+        auto rotate_now = rotation != seen_rotations;
+        seen_rotations = rotation;
+
+        for (auto& i : work) {
+            try {
+                // what was recorded before the rotation was asked for
+                // still belongs in the old file
+                drain(*i);
+
+                if (rotate_now) {
+                    close_file(*i);
+                }
+            } catch (std::exception & e) {
+                std::cout << "Recorder: " << e.what() << std::endl;
+
+                if (i->fd != -1) {
+                    close(i->fd);
+                    i->fd = -1;
+                }
+
+                i->failed_at = timing::now();
+            }
+        }
+
+        work.clear();
+        lock.lock();
+
+        for (auto i = retired.begin(); i != retired.end();) {
+            if ((*i)->samples.get_readable() == 0 && i->use_count() == 1) {
+                close_file(**i);
+                i = retired.erase(i);
+            } else {
+                i++;
+            }
+        }
+
+        if (stopping) {
+            for (auto& i : streams) {
+                close_file(*i.second);
+            }
+
+            break;
+        }
+    }
+}
+
+// on the writer thread
+void recorder::drain(stream & stream_in)
+{
+    if (stream_in.fd != -1 && rotate_ns > 0 && timing::now() - stream_in.opened_at >= rotate_ns) {
+        close_file(stream_in);
+    }
+
+    // a broken disk is tried again every few seconds instead of every pass
+    if (stream_in.fd == -1 && timing::now() - stream_in.failed_at < retry_ns) {
+        auto buffer = reinterpret_cast<sample_type *>(stream_in.staging.get());
+        size_type count;
+
+        while((count = stream_in.samples.pop(buffer, staging_size / sizeof(sample_type))) > 0) {
+            stream_in.dropped_samples.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        return;
+    }
+
+    while(stream_in.samples.get_readable() > 0) {
+        if (stream_in.fd == -1) {
+            open_file(stream_in);
+        }
+
+        auto space = (staging_size - stream_in.staged) / sizeof(sample_type);
+        auto count = stream_in.samples.pop(reinterpret_cast<sample_type *>(stream_in.staging.get() + stream_in.staged), space);
+
+        stream_in.staged += count * sizeof(sample_type);
+
+        if (stream_in.staged == staging_size) {
+            flush(stream_in);
+        }
+    }
+}
+
+static void write_all(const int fd_in, const uint8_t * bytes_in, const size_t size_in, const std::string & path_in)
+{
+    size_t done = 0;
+
+    while(done < size_in) {
+        auto result = write(fd_in, bytes_in + done, size_in - done);
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw std::runtime_error("could not write to " + path_in + ": " + strerror(errno));
+        }
+
+        done += result;
+    }
+}
+
+// on the writer thread
+void recorder::open_file(stream & stream_in)
+{
+    char stamp[32];
+    timespec wall_clock;
+    struct tm local;
+
+    clock_gettime(CLOCK_REALTIME, &wall_clock);
+    localtime_r(&wall_clock.tv_sec, &local);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+    auto millis = std::to_string(wall_clock.tv_nsec / 1000000);
+    auto extension = file_format == format::wav ? ".wav" : ".raw";
+
+    stream_in.path = directory + "/" + stream_in.name + "-" + stamp + "." + std::string(3 - millis.size(), '0') + millis + extension;
+    stream_in.is_direct = false;
+
+    auto flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if (direct_io) {
+        stream_in.fd = open(stream_in.path.c_str(), flags | O_DIRECT, 0644);
+        stream_in.is_direct = stream_in.fd != -1;
+    }
+
+    // tmpfs and some other filesystems refuse O_DIRECT
+    if (stream_in.fd == -1) {
+        stream_in.fd = open(stream_in.path.c_str(), flags, 0644);
+    }
+
+    if (stream_in.fd == -1) {
+        throw std::runtime_error("could not open " + stream_in.path + ": " + strerror(errno));
+    }
+
+    stream_in.staged = 0;
+    stream_in.file_bytes = 0;
+    stream_in.opened_at = timing::now();
+
+    if (file_format == format::wav) {
+        wavfile::make_header(stream_in.staging.get(), 1, stream_in.sample_rate, 0);
+        stream_in.staged = wavfile::header_size;
+    }
+
+    std::cout << "Recording " << stream_in.name << " to " << stream_in.path;
+    if (stream_in.is_direct) {
+        std::cout << " with direct I/O";
+    }
+    std::cout << std::endl;
+}
+
+// on the writer thread; only ever called with a full staging buffer so
+// every write stays aligned for O_DIRECT
+void recorder::flush(stream & stream_in)
+{
+    write_all(stream_in.fd, stream_in.staging.get(), stream_in.staged, stream_in.path);
+
+    stream_in.file_bytes += stream_in.staged;
+    stream_in.written_bytes.fetch_add(stream_in.staged, std::memory_order_relaxed);
+    stream_in.staged = 0;
+}
+
+// on the writer thread; the tail and the WAV header are not aligned so
+// direct I/O is turned off for them
+void recorder::close_file(stream & stream_in)
+{
+    if (stream_in.fd == -1) {
+        return;
+    }
+
+    if (stream_in.is_direct) {
+        fcntl(stream_in.fd, F_SETFL, fcntl(stream_in.fd, F_GETFL) & ~O_DIRECT);
+    }
+
+    if (stream_in.staged > 0) {
+        flush(stream_in);
+    }
+
+    if (file_format == format::wav) {
+        uint8_t header[wavfile::header_size];
+        wavfile::make_header(header, 1, stream_in.sample_rate, stream_in.file_bytes - wavfile::header_size);
+
+        if (pwrite(stream_in.fd, header, sizeof(header), 0) != sizeof(header)) {
+            std::cout << "Recorder: could not update the header of " << stream_in.path << std::endl;
+        }
+    }
+
+    close(stream_in.fd);
+    stream_in.fd = -1;
+
+    std::cout << "Closed recording " << stream_in.path << std::endl;
+}
+
+}
@@ -0,0 +1,121 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ring.h"
+#include "timing.h"
+
+namespace modpro {
+
+// Records ports to disk without a separate JACK client. Every stream is fed
+// by a graph tap with one memcpy into its ring; a stream whose ring is full
+// drops the block and counts an overrun instead of waiting. A writer thread
+// drains the rings into one file per stream with large writes that bypass
+// the page cache when the filesystem allows it and starts new files after
+// a set time or when rotate() is called.
+class recorder {
+    public:
+    using sample_type = float;
+    using size_type = unsigned long;
+
+    enum class format { wav, raw };
+
+    struct stream {
+        const std::string name;
+        const size_type sample_rate;
+        sample_ring<sample_type> samples;
+        std::atomic<uint64_t> overruns = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> dropped_samples = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> written_bytes = ATOMIC_VAR_INIT(0);
+
+        stream(const std::string & name_in, const size_type sample_rate_in, const size_t capacity_in);
+        // inside jack audio thread or a worker thread
+        void push(const sample_type * samples_in, const size_type count_in);
+        // keeps the file in step with the clock while nothing is recorded
+        void push_silence(const size_type count_in);
+
+        private:
+        friend class recorder;
+
+        // only touched by the writer thread
+        int fd = -1;
+        std::string path;
+        bool is_direct = false;
+        std::unique_ptr<uint8_t, void (*)(void *)> staging = std::unique_ptr<uint8_t, void (*)(void *)>(nullptr, free);
+        size_t staged = 0;
+        uint64_t file_bytes = 0;
+        timing::ns_type opened_at = 0;
+        // when writing last failed; samples are dropped for a while after
+        timing::ns_type failed_at = 0;
+    };
+
+    private:
+    // O_DIRECT needs every write to start and end on a block boundary
+    static const size_t staging_size = 1 << 20;
+    static const size_t direct_alignment = 4096;
+    static const timing::ns_type retry_ns = 5000000000;
+
+    const std::string directory;
+    const format file_format;
+    const timing::ns_type rotate_ns;
+    const bool direct_io;
+    const double buffer_seconds;
+    std::map<std::string, std::shared_ptr<stream>> streams;
+    // streams a new graph no longer uses; closed once the old graph is
+    // gone and their rings are empty
+    std::vector<std::shared_ptr<stream>> retired;
+    std::atomic<uint64_t> rotations = ATOMIC_VAR_INIT(0);
+    std::thread writer_thread;
+    std::mutex writer_mutex;
+    std::condition_variable writer_wakeup;
+    bool writer_stop = false;
+
+    void run_writer();
+    void drain(stream & stream_in);
+    void open_file(stream & stream_in);
+    void flush(stream & stream_in);
+    void close_file(stream & stream_in);
+
+    public:
+    recorder(const std::string & directory_in, const format format_in, const double rotate_seconds_in, const bool direct_io_in, const double buffer_seconds_in);
+    ~recorder();
+    template<typename... Args>
+    static std::shared_ptr<recorder> make(Args... args)
+    {
+        return std::make_shared<recorder>(args...);
+    }
+
+    static format parse_format(const std::string & name_in);
+    // outside jack audio thread; a stream asked for at a new rate replaces
+    // the old one which finishes its file
+    std::shared_ptr<stream> get_stream(const std::string & name_in, const size_type sample_rate_in);
+    void start();
+    // every stream starts a new file the next time it has samples
+    void rotate();
+    std::map<std::string, double> get_stats();
+};
+
+}
@@ -0,0 +1,145 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "resampler.h"
+
+namespace modpro {
+
+// Blackman windowed sinc low pass with its cutoff a little under the
+// Nyquist frequency of the low rate, normalized to unity gain
+static std::vector<double> make_lowpass(const resampler::size_type factor_in, const resampler::size_type length_in)
+{
+    std::vector<double> taps(length_in);
+    double cutoff = 0.45 / factor_in;
+    double center = (length_in - 1) / 2.0;
+    double sum = 0;
+
+    for (resampler::size_type i = 0; i < length_in; i++) {
+        double x = i - center;
+        double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        double window = 0.42 - 0.5 * cos(2 * M_PI * i / (length_in - 1)) + 0.08 * cos(4 * M_PI * i / (length_in - 1));
+
+        taps[i] = sinc * window;
+        sum += taps[i];
+    }
+
+    for (auto& i : taps) {
+        i /= sum;
+    }
+
+    return taps;
+}
+
+resampler::resampler(const direction mode_in, const size_type factor_in, const size_type max_block_in, std::shared_ptr<arena> memory_in)
+: mode(mode_in), factor(factor_in), max_block(max_block_in), kernels(simd::get())
+{
+    assert(factor > 1);
+
+    auto length = factor * taps_per_phase;
+    auto taps = make_lowpass(factor, length);
+
+    filter = memory_in->allocate_array<sample_type>(length);
+
+    if (mode == direction::down) {
+        for (size_type i = 0; i < length; i++) {
+            filter[i] = taps[length - 1 - i];
+        }
+
+        history_size = length - 1;
+        history = memory_in->allocate_array<sample_type>(history_size + max_block);
+    } else {
+        for (size_type phase = 0; phase < factor; phase++) {
+            for (size_type i = 0; i < taps_per_phase; i++) {
+                filter[phase * taps_per_phase + taps_per_phase - 1 - i] = factor * taps[phase + i * factor];
+            }
+        }
+
+        history_size = taps_per_phase;
+        history = memory_in->allocate_array<sample_type>(history_size + get_max_low_count(factor, max_block));
+    }
+}
+
+resampler::size_type resampler::get_low_count(const size_type factor_in, const size_type phase_in, const size_type count_in)
+{
+    return (phase_in + count_in) / factor_in;
+}
+
+resampler::size_type resampler::get_max_low_count(const size_type factor_in, const size_type count_in)
+{
+    return (factor_in - 1 + count_in) / factor_in;
+}
+
+resampler::size_type resampler::get_latency(const size_type factor_in)
+{
+    // each filter is linear phase with (length - 1) / 2 samples of delay
+    return factor_in * taps_per_phase - 1;
+}
+
+// inside jack audio thread
+resampler::size_type resampler::decimate(const sample_type * in_in, const size_type count_in, const size_type phase_in, sample_type * out_in)
+{
+    assert(mode == direction::down);
+    assert(count_in <= max_block);
+
+    auto length = factor * taps_per_phase;
+    size_type written = 0;
+
+    std::memcpy(history + history_size, in_in, count_in * sizeof(sample_type));
+
+    // the first input that completes a low rate sample
+    for (auto i = (factor - 1 - phase_in % factor) % factor; i < count_in; i += factor) {
+        out_in[written++] = kernels.dot(filter, history + i, length);
+    }
+
+    std::memmove(history, history + count_in, history_size * sizeof(sample_type));
+
+    return written;
+}
+
+// inside jack audio thread
+void resampler::interpolate(const sample_type * in_in, const size_type low_count_in, sample_type * out_in, const size_type count_in, const size_type phase_in)
+{
+    assert(mode == direction::up);
+    assert(low_count_in == get_low_count(factor, phase_in, count_in));
+
+    std::memcpy(history + history_size, in_in, low_count_in * sizeof(sample_type));
+
+    // the low rate samples that have arrived so far in this block and how
+    // far into the current one the output is
+    size_type arrived = 0;
+    auto offset = (phase_in + 1) % factor;
+
+    for (size_type i = 0; i < count_in; i++) {
+        if (offset == 0) {
+            arrived++;
+        }
+
+        out_in[i] = kernels.dot(filter + offset * taps_per_phase, history + arrived, taps_per_phase);
+
+        if (++offset == factor) {
+            offset = 0;
+        }
+    }
+
+    std::memmove(history, history + low_count_in, history_size * sizeof(sample_type));
+}
+
+}
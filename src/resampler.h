@@ -0,0 +1,74 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <memory>
+
+#include "arena.h"
+#include "effect.h"
+#include "simd.h"
+
+namespace modpro {
+
+// Polyphase FIR sample rate conversion by a whole number factor for chains
+// that run at a lower internal rate. Only the outputs that are kept are
+// ever computed so decimating costs taps_per_phase multiplies per input
+// sample and interpolating the same per output sample.
+//
+// Both directions follow the same clock: sample k at the low rate belongs
+// to high rate sample k * factor + factor - 1. The caller passes in where
+// the block starts on that clock as phase, which is the number of high
+// rate samples processed so far modulo the factor. Every resampler of a
+// chain shares the phase so they all agree on how many low rate samples a
+// block holds.
+class resampler {
+    public:
+    using sample_type = effect::sample_type;
+    using size_type = effect::size_type;
+
+    enum class direction { down, up };
+
+    static const size_type taps_per_phase = 32;
+
+    private:
+    const direction mode;
+    const size_type factor;
+    const size_type max_block;
+    const simd::kernels & kernels;
+    // down: the whole filter in reverse; up: one reversed sub filter for
+    // each phase back to back, already scaled by the factor
+    sample_type * filter = nullptr;
+    // the input of the previous blocks the filter still reaches back into
+    // followed by room for one block
+    sample_type * history = nullptr;
+    size_type history_size = 0;
+
+    public:
+    resampler(const direction mode_in, const size_type factor_in, const size_type max_block_in, std::shared_ptr<arena> memory_in);
+    // how many low rate samples a block of count_in high rate samples
+    // starting at phase_in holds
+    static size_type get_low_count(const size_type factor_in, const size_type phase_in, const size_type count_in);
+    // the most low rate samples any block up to count_in long can hold
+    static size_type get_max_low_count(const size_type factor_in, const size_type count_in);
+    // high rate samples of delay from decimating and interpolating again
+    static size_type get_latency(const size_type factor_in);
+    // returns the number of samples written to out_in
+    size_type decimate(const sample_type * in_in, const size_type count_in, const size_type phase_in, sample_type * out_in);
+    // low_count_in must be get_low_count() for the same block
+    void interpolate(const sample_type * in_in, const size_type low_count_in, sample_type * out_in, const size_type count_in, const size_type phase_in);
+};
+
+}
@@ -0,0 +1,201 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace modpro {
+
+// Bounded lock-free queue that is safe for any number of producers and
+// consumers (Dmitry Vyukov's bounded MPMC queue). All storage is allocated
+// when the ring is created so push() and pop() never allocate, block or
+// make a syscall which makes them safe to use from the jack audio thread.
+template<typename T>
+class ring {
+    struct cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    const size_t mask;
+    std::unique_ptr<cell[]> cells;
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+
+    public:
+    // capacity must be a power of two
+    ring(const size_t capacity_in)
+    : mask(capacity_in - 1), cells(new cell[capacity_in])
+    {
+        assert(capacity_in >= 2);
+        assert((capacity_in & mask) == 0);
+
+        for (size_t i = 0; i < capacity_in; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        enqueue_pos.store(0, std::memory_order_relaxed);
+        dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    size_t capacity()
+    {
+        return mask + 1;
+    }
+
+    // returns false if the ring is full
+    bool push(const T & data_in)
+    {
+        auto pos = enqueue_pos.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto& slot = cells[pos & mask];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.data = data_in;
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // returns false if the ring is empty
+    bool pop(T & data_out)
+    {
+        auto pos = dequeue_pos.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto& slot = cells[pos & mask];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    data_out = slot.data;
+                    slot.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Bounded lock-free queue of samples for exactly one producer and one
+// consumer. Blocks of samples go in and out with memcpy so the producer
+// can be the jack audio thread and the consumer a thread that does I/O.
+template<typename T>
+class sample_ring {
+    const size_t mask;
+    std::unique_ptr<T[]> samples;
+    alignas(64) std::atomic<size_t> write_pos = ATOMIC_VAR_INIT(0);
+    alignas(64) std::atomic<size_t> read_pos = ATOMIC_VAR_INIT(0);
+
+    public:
+    // capacity must be a power of two
+    sample_ring(const size_t capacity_in)
+    : mask(capacity_in - 1), samples(new T[capacity_in]())
+    {
+        assert(capacity_in >= 2);
+        assert((capacity_in & mask) == 0);
+    }
+
+    size_t capacity()
+    {
+        return mask + 1;
+    }
+
+    // how many samples pop() could return right now
+    size_t get_readable()
+    {
+        return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_relaxed);
+    }
+
+    // all or nothing; returns false without writing anything if there is
+    // not room for every sample
+    bool push(const T * samples_in, const size_t count_in)
+    {
+        auto write = write_pos.load(std::memory_order_relaxed);
+        auto read = read_pos.load(std::memory_order_acquire);
+
+        if (capacity() - (write - read) < count_in) {
+            return false;
+        }
+
+        auto offset = write & mask;
+        auto first = std::min(count_in, capacity() - offset);
+
+        std::memcpy(samples.get() + offset, samples_in, first * sizeof(T));
+        std::memcpy(samples.get(), samples_in + first, (count_in - first) * sizeof(T));
+        write_pos.store(write + count_in, std::memory_order_release);
+
+        return true;
+    }
+
+    // push() of count_in zeros
+    bool push_silence(const size_t count_in)
+    {
+        auto write = write_pos.load(std::memory_order_relaxed);
+        auto read = read_pos.load(std::memory_order_acquire);
+
+        if (capacity() - (write - read) < count_in) {
+            return false;
+        }
+
+        auto offset = write & mask;
+        auto first = std::min(count_in, capacity() - offset);
+
+        std::memset(samples.get() + offset, 0, first * sizeof(T));
+        std::memset(samples.get(), 0, (count_in - first) * sizeof(T));
+        write_pos.store(write + count_in, std::memory_order_release);
+
+        return true;
+    }
+
+    // returns how many samples were copied which is at most count_in
+    size_t pop(T * samples_out, const size_t count_in)
+    {
+        auto read = read_pos.load(std::memory_order_relaxed);
+        auto count = std::min(count_in, write_pos.load(std::memory_order_acquire) - read);
+        auto offset = read & mask;
+        auto first = std::min(count, capacity() - offset);
+
+        std::memcpy(samples_out, samples.get() + offset, first * sizeof(T));
+        std::memcpy(samples_out + first, samples.get(), (count - first) * sizeof(T));
+        read_pos.store(read + count, std::memory_order_release);
+
+        return count;
+    }
+};
+
+}
@@ -0,0 +1,432 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cmath>
+
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MODPRO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MODPRO_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace modpro {
+
+using sample_type = simd::sample_type;
+
+static void scale_generic(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in)
+{
+    for (size_t i = 0; i < count_in; i++) {
+        out_in[i] = in_in[i] * gain_in;
+    }
+}
+
+static void ramp_generic(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const sample_type step_in, const size_t count_in)
+{
+    for (size_t i = 0; i < count_in; i++) {
+        out_in[i] = in_in[i] * (gain_in + step_in * i);
+    }
+}
+
+static void mix_generic(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in)
+{
+    for (size_t i = 0; i < count_in; i++) {
+        out_in[i] += in_in[i] * gain_in;
+    }
+}
+
+static sample_type dot_generic(const sample_type * a_in, const sample_type * b_in, const size_t count_in)
+{
+    sample_type sum = 0;
+
+    for (size_t i = 0; i < count_in; i++) {
+        sum += a_in[i] * b_in[i];
+    }
+
+    return sum;
+}
+
+static void level_generic(const sample_type * in_in, const size_t count_in, sample_type * peak_inout, sample_type * power_inout)
+{
+    sample_type peak = *peak_inout;
+    sample_type power = 0;
+
+    for (size_t i = 0; i < count_in; i++) {
+        peak = std::max(peak, std::fabs(in_in[i]));
+        power += in_in[i] * in_in[i];
+    }
+
+    *peak_inout = peak;
+    *power_inout += power;
+}
+
+static bool exceeds_generic(const sample_type * in_in, const size_t count_in, const sample_type threshold_in)
+{
+    for (size_t i = 0; i < count_in; i++) {
+        if (std::fabs(in_in[i]) > threshold_in) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static const simd::kernels generic_kernels = { "generic", scale_generic, ramp_generic, mix_generic, dot_generic, level_generic, exceeds_generic };
+
+#ifdef MODPRO_SIMD_X86
+
+// the tails of every x86 version are left to the generic code
+
+__attribute__((target("sse2")))
+static void scale_sse2(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in)
+{
+    auto gain = _mm_set1_ps(gain_in);
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        _mm_storeu_ps(out_in + i, _mm_mul_ps(_mm_loadu_ps(in_in + i), gain));
+    }
+
+    scale_generic(out_in + i, in_in + i, gain_in, count_in - i);
+}
+
+__attribute__((target("sse2")))
+static void ramp_sse2(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const sample_type step_in, const size_t count_in)
+{
+    auto gain = _mm_add_ps(_mm_set1_ps(gain_in), _mm_mul_ps(_mm_set1_ps(step_in), _mm_setr_ps(0, 1, 2, 3)));
+    auto step = _mm_set1_ps(step_in * 4);
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        _mm_storeu_ps(out_in + i, _mm_mul_ps(_mm_loadu_ps(in_in + i), gain));
+        gain = _mm_add_ps(gain, step);
+    }
+
+    ramp_generic(out_in + i, in_in + i, gain_in + step_in * i, step_in, count_in - i);
+}
+
+__attribute__((target("sse2")))
+static void mix_sse2(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in)
+{
+    auto gain = _mm_set1_ps(gain_in);
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        auto mixed = _mm_add_ps(_mm_loadu_ps(out_in + i), _mm_mul_ps(_mm_loadu_ps(in_in + i), gain));
+        _mm_storeu_ps(out_in + i, mixed);
+    }
+
+    mix_generic(out_in + i, in_in + i, gain_in, count_in - i);
+}
+
+__attribute__((target("sse2")))
+static sample_type dot_sse2(const sample_type * a_in, const sample_type * b_in, const size_t count_in)
+{
+    auto sum = _mm_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a_in + i), _mm_loadu_ps(b_in + i)));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_generic(a_in + i, b_in + i, count_in - i);
+}
+
+__attribute__((target("sse2")))
+static void level_sse2(const sample_type * in_in, const size_t count_in, sample_type * peak_inout, sample_type * power_inout)
+{
+    // clearing the sign bit is the absolute value
+    auto mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    auto peak = _mm_setzero_ps();
+    auto power = _mm_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        auto samples = _mm_loadu_ps(in_in + i);
+        peak = _mm_max_ps(peak, _mm_and_ps(samples, mask));
+        power = _mm_add_ps(power, _mm_mul_ps(samples, samples));
+    }
+
+    float peak_lanes[4];
+    float power_lanes[4];
+    _mm_storeu_ps(peak_lanes, peak);
+    _mm_storeu_ps(power_lanes, power);
+
+    *peak_inout = std::max({ *peak_inout, peak_lanes[0], peak_lanes[1], peak_lanes[2], peak_lanes[3] });
+    *power_inout += power_lanes[0] + power_lanes[1] + power_lanes[2] + power_lanes[3];
+    level_generic(in_in + i, count_in - i, peak_inout, power_inout);
+}
+
+__attribute__((target("sse2")))
+static bool exceeds_sse2(const sample_type * in_in, const size_t count_in, const sample_type threshold_in)
+{
+    auto mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    auto threshold = _mm_set1_ps(threshold_in);
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        auto magnitude = _mm_and_ps(_mm_loadu_ps(in_in + i), mask);
+
+        if (_mm_movemask_ps(_mm_cmpgt_ps(magnitude, threshold)) != 0) {
+            return true;
+        }
+    }
+
+    return exceeds_generic(in_in + i, count_in - i, threshold_in);
+}
+
+static const simd::kernels sse2_kernels = { "sse2", scale_sse2, ramp_sse2, mix_sse2, dot_sse2, level_sse2, exceeds_sse2 };
+
+__attribute__((target("avx2,fma")))
+static void scale_avx2(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in)
+{
+    auto gain = _mm256_set1_ps(gain_in);
+    size_t i = 0;
+
+    for (; i + 8 <= count_in; i += 8) {
+        _mm256_storeu_ps(out_in + i, _mm256_mul_ps(_mm256_loadu_ps(in_in + i), gain));
+    }
+
+    scale_generic(out_in + i, in_in + i, gain_in, count_in - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void ramp_avx2(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const sample_type step_in, const size_t count_in)
+{
+    auto gain = _mm256_fmadd_ps(_mm256_set1_ps(step_in), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps(gain_in));
+    auto step = _mm256_set1_ps(step_in * 8);
+    size_t i = 0;
+
+    for (; i + 8 <= count_in; i += 8) {
+        _mm256_storeu_ps(out_in + i, _mm256_mul_ps(_mm256_loadu_ps(in_in + i), gain));
+        gain = _mm256_add_ps(gain, step);
+    }
+
+    ramp_generic(out_in + i, in_in + i, gain_in + step_in * i, step_in, count_in - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void mix_avx2(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in)
+{
+    auto gain = _mm256_set1_ps(gain_in);
+    size_t i = 0;
+
+    for (; i + 8 <= count_in; i += 8) {
+        auto mixed = _mm256_fmadd_ps(_mm256_loadu_ps(in_in + i), gain, _mm256_loadu_ps(out_in + i));
+        _mm256_storeu_ps(out_in + i, mixed);
+    }
+
+    mix_generic(out_in + i, in_in + i, gain_in, count_in - i);
+}
+
+__attribute__((target("avx2,fma")))
+static sample_type dot_avx2(const sample_type * a_in, const sample_type * b_in, const size_t count_in)
+{
+    auto sum = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= count_in; i += 8) {
+        sum = _mm256_fmadd_ps(_mm256_loadu_ps(a_in + i), _mm256_loadu_ps(b_in + i), sum);
+    }
+
+    auto half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, half);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_generic(a_in + i, b_in + i, count_in - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void level_avx2(const sample_type * in_in, const size_t count_in, sample_type * peak_inout, sample_type * power_inout)
+{
+    auto mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    auto peak = _mm256_setzero_ps();
+    auto power = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= count_in; i += 8) {
+        auto samples = _mm256_loadu_ps(in_in + i);
+        peak = _mm256_max_ps(peak, _mm256_and_ps(samples, mask));
+        power = _mm256_fmadd_ps(samples, samples, power);
+    }
+
+    auto peak_half = _mm_max_ps(_mm256_castps256_ps128(peak), _mm256_extractf128_ps(peak, 1));
+    auto power_half = _mm_add_ps(_mm256_castps256_ps128(power), _mm256_extractf128_ps(power, 1));
+    float peak_lanes[4];
+    float power_lanes[4];
+    _mm_storeu_ps(peak_lanes, peak_half);
+    _mm_storeu_ps(power_lanes, power_half);
+
+    *peak_inout = std::max({ *peak_inout, peak_lanes[0], peak_lanes[1], peak_lanes[2], peak_lanes[3] });
+    *power_inout += power_lanes[0] + power_lanes[1] + power_lanes[2] + power_lanes[3];
+    level_generic(in_in + i, count_in - i, peak_inout, power_inout);
+}
+
+__attribute__((target("avx2,fma")))
+static bool exceeds_avx2(const sample_type * in_in, const size_t count_in, const sample_type threshold_in)
+{
+    auto mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    auto threshold = _mm256_set1_ps(threshold_in);
+    size_t i = 0;
+
+    for (; i + 8 <= count_in; i += 8) {
+        auto magnitude = _mm256_and_ps(_mm256_loadu_ps(in_in + i), mask);
+
+        if (_mm256_movemask_ps(_mm256_cmp_ps(magnitude, threshold, _CMP_GT_OQ)) != 0) {
+            return true;
+        }
+    }
+
+    return exceeds_generic(in_in + i, count_in - i, threshold_in);
+}
+
+static const simd::kernels avx2_kernels = { "avx2", scale_avx2, ramp_avx2, mix_avx2, dot_avx2, level_avx2, exceeds_avx2 };
+
+#endif
+
+#ifdef MODPRO_SIMD_NEON
+
+static void scale_neon(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        vst1q_f32(out_in + i, vmulq_n_f32(vld1q_f32(in_in + i), gain_in));
+    }
+
+    scale_generic(out_in + i, in_in + i, gain_in, count_in - i);
+}
+
+static void ramp_neon(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const sample_type step_in, const size_t count_in)
+{
+    const float offsets[4] = { 0, 1, 2, 3 };
+    auto gain = vmlaq_n_f32(vdupq_n_f32(gain_in), vld1q_f32(offsets), step_in);
+    auto step = vdupq_n_f32(step_in * 4);
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        vst1q_f32(out_in + i, vmulq_f32(vld1q_f32(in_in + i), gain));
+        gain = vaddq_f32(gain, step);
+    }
+
+    ramp_generic(out_in + i, in_in + i, gain_in + step_in * i, step_in, count_in - i);
+}
+
+static void mix_neon(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        vst1q_f32(out_in + i, vmlaq_n_f32(vld1q_f32(out_in + i), vld1q_f32(in_in + i), gain_in));
+    }
+
+    mix_generic(out_in + i, in_in + i, gain_in, count_in - i);
+}
+
+static sample_type dot_neon(const sample_type * a_in, const sample_type * b_in, const size_t count_in)
+{
+    auto sum = vdupq_n_f32(0);
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        sum = vmlaq_f32(sum, vld1q_f32(a_in + i), vld1q_f32(b_in + i));
+    }
+
+    float lanes[4];
+    vst1q_f32(lanes, sum);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_generic(a_in + i, b_in + i, count_in - i);
+}
+
+static void level_neon(const sample_type * in_in, const size_t count_in, sample_type * peak_inout, sample_type * power_inout)
+{
+    auto peak = vdupq_n_f32(0);
+    auto power = vdupq_n_f32(0);
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        auto samples = vld1q_f32(in_in + i);
+        peak = vmaxq_f32(peak, vabsq_f32(samples));
+        power = vmlaq_f32(power, samples, samples);
+    }
+
+    float peak_lanes[4];
+    float power_lanes[4];
+    vst1q_f32(peak_lanes, peak);
+    vst1q_f32(power_lanes, power);
+
+    *peak_inout = std::max({ *peak_inout, peak_lanes[0], peak_lanes[1], peak_lanes[2], peak_lanes[3] });
+    *power_inout += power_lanes[0] + power_lanes[1] + power_lanes[2] + power_lanes[3];
+    level_generic(in_in + i, count_in - i, peak_inout, power_inout);
+}
+
+static bool exceeds_neon(const sample_type * in_in, const size_t count_in, const sample_type threshold_in)
+{
+    auto threshold = vdupq_n_f32(threshold_in);
+    size_t i = 0;
+
+    for (; i + 4 <= count_in; i += 4) {
+        auto above = vcagtq_f32(vld1q_f32(in_in + i), threshold);
+        auto halves = vorr_u32(vget_low_u32(above), vget_high_u32(above));
+
+        if (vget_lane_u64(vreinterpret_u64_u32(halves), 0) != 0) {
+            return true;
+        }
+    }
+
+    return exceeds_generic(in_in + i, count_in - i, threshold_in);
+}
+
+static const simd::kernels neon_kernels = { "neon", scale_neon, ramp_neon, mix_neon, dot_neon, level_neon, exceeds_neon };
+
+#endif
+
+static const simd::kernels & pick_kernels()
+{
+#ifdef MODPRO_SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return avx2_kernels;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return sse2_kernels;
+    }
+#endif
+
+#ifdef MODPRO_SIMD_NEON
+    return neon_kernels;
+#endif
+
+    return generic_kernels;
+}
+
+const simd::kernels & simd::get()
+{
+    static const kernels & chosen = pick_kernels();
+    return chosen;
+}
+
+}
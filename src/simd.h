@@ -0,0 +1,50 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+
+namespace modpro {
+
+// Vector kernels for the native effects and meters. The best version the
+// CPU supports is picked once at startup: AVX2 or SSE2 on x86 and NEON on
+// ARM, with a plain C++ version everywhere else. None of them allocate, lock
+// or care about alignment so they are safe inside the jack audio thread.
+struct simd {
+    using sample_type = float;
+
+    struct kernels {
+        const char * name;
+        // out = in * gain
+        void (*scale)(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in);
+        // out = in * (gain + step * n) for sample n
+        void (*ramp)(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const sample_type step_in, const size_t count_in);
+        // out += in * gain
+        void (*mix)(sample_type * out_in, const sample_type * in_in, const sample_type gain_in, const size_t count_in);
+        // sum of a * b
+        sample_type (*dot)(const sample_type * a_in, const sample_type * b_in, const size_t count_in);
+        // raises peak to the largest absolute value of in and adds the sum
+        // of its squares to power
+        void (*level)(const sample_type * in_in, const size_t count_in, sample_type * peak_inout, sample_type * power_inout);
+        // true if the absolute value of any sample is above threshold;
+        // stops looking at the first one that is
+        bool (*exceeds)(const sample_type * in_in, const size_t count_in, const sample_type threshold_in);
+    };
+
+    static const kernels & get();
+};
+
+}
@@ -0,0 +1,148 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+
+#include "timing.h"
+
+namespace modpro {
+
+timing::ns_type timing::now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<ns_type>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+timing::histogram::histogram()
+{
+    reset();
+}
+
+unsigned int timing::histogram::get_bucket(const ns_type value_in)
+{
+    if (value_in < sub_buckets) {
+        return value_in;
+    }
+
+    unsigned int top_bit = 63 - __builtin_clzll(value_in);
+    unsigned int shift = top_bit - sub_bucket_bits;
+
+    return (shift + 1) * sub_buckets + ((value_in >> shift) & (sub_buckets - 1));
+}
+
+timing::ns_type timing::histogram::get_bucket_start(const unsigned int bucket_in)
+{
+    if (bucket_in < sub_buckets) {
+        return bucket_in;
+    }
+
+    unsigned int shift = bucket_in / sub_buckets - 1;
+    return ns_type(sub_buckets + bucket_in % sub_buckets) << shift;
+}
+
+void timing::histogram::record(const ns_type value_in)
+{
+    buckets[get_bucket(value_in)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void timing::histogram::reset()
+{
+    for (auto& i : buckets) {
+        i.store(0, std::memory_order_relaxed);
+    }
+}
+
+// returns the middle of the bucket the percentile falls in
+timing::ns_type timing::histogram::get_percentile(const double fraction_in)
+{
+    uint64_t total = 0;
+
+    for (auto& i : buckets) {
+        total += i.load(std::memory_order_relaxed);
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t wanted = fraction_in * total;
+    uint64_t seen = 0;
+
+    if (wanted == 0) {
+        wanted = 1;
+    }
+
+    for (unsigned int i = 0; i < num_buckets; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+
+        if (seen >= wanted) {
+            auto start = get_bucket_start(i);
+            auto end = i + 1 < num_buckets ? get_bucket_start(i + 1) : UINT64_MAX;
+            return start + (end - start) / 2;
+        }
+    }
+
+    return get_bucket_start(num_buckets - 1);
+}
+
+void timing::stats::record(const ns_type ns_in)
+{
+    count.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(ns_in, std::memory_order_relaxed);
+    last_ns.store(ns_in, std::memory_order_relaxed);
+    distribution.record(ns_in);
+
+    auto old_max = max_ns.load(std::memory_order_relaxed);
+    while(ns_in > old_max && ! max_ns.compare_exchange_weak(old_max, ns_in, std::memory_order_relaxed));
+
+    auto old_min = min_ns.load(std::memory_order_relaxed);
+    while(ns_in < old_min && ! min_ns.compare_exchange_weak(old_min, ns_in, std::memory_order_relaxed));
+}
+
+void timing::stats::reset()
+{
+    count.store(0);
+    total_ns.store(0);
+    min_ns.store(UINT64_MAX);
+    max_ns.store(0);
+    last_ns.store(0);
+    distribution.reset();
+}
+
+std::map<std::string, double> timing::stats::get_summary()
+{
+    std::map<std::string, double> retval;
+    double runs = count.load();
+    auto max = max_ns.load();
+
+    // percentiles come from bucket midpoints so keep them inside the
+    // range that was really seen
+    auto clamp = [&](const ns_type value_in) -> double {
+        return std::min(std::max(value_in, min_ns.load()), max);
+    };
+
+    retval["count"] = runs;
+    retval["mean_ns"] = runs > 0 ? total_ns.load() / runs : 0;
+    retval["min_ns"] = runs > 0 ? min_ns.load() : 0;
+    retval["p50_ns"] = runs > 0 ? clamp(distribution.get_percentile(0.50)) : 0;
+    retval["p99_ns"] = runs > 0 ? clamp(distribution.get_percentile(0.99)) : 0;
+    retval["max_ns"] = max;
+    retval["last_ns"] = last_ns.load();
+
+    return retval;
+}
+
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <string>
+
+namespace modpro {
+
+struct timing {
+    using ns_type = uint64_t;
+
+    static ns_type now();
+
+    // Counts values in buckets that grow with the value: 8 buckets for
+    // every power of two so a percentile is never off by more than 12.5%
+    // no matter if it is 200ns or 20ms. Recording is a single relaxed
+    // atomic increment.
+    struct histogram {
+        static const unsigned int sub_bucket_bits = 3;
+        static const unsigned int sub_buckets = 1 << sub_bucket_bits;
+        static const unsigned int num_buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+        std::atomic<uint64_t> buckets[num_buckets];
+
+        histogram();
+        static unsigned int get_bucket(const ns_type value_in);
+        // the smallest value that goes in the bucket
+        static ns_type get_bucket_start(const unsigned int bucket_in);
+        void record(const ns_type value_in);
+        void reset();
+        // 0 < fraction_in <= 1
+        ns_type get_percentile(const double fraction_in);
+    };
+
+    // Recorded from inside the jack audio thread using only relaxed atomic
+    // operations and read or reset from any other thread.
+    struct stats {
+        std::atomic<uint64_t> count = ATOMIC_VAR_INIT(0);
+        std::atomic<ns_type> total_ns = ATOMIC_VAR_INIT(0);
+        std::atomic<ns_type> min_ns = ATOMIC_VAR_INIT(UINT64_MAX);
+        std::atomic<ns_type> max_ns = ATOMIC_VAR_INIT(0);
+        std::atomic<ns_type> last_ns = ATOMIC_VAR_INIT(0);
+        histogram distribution;
+
+        void record(const ns_type ns_in);
+        void reset();
+        std::map<std::string, double> get_summary();
+    };
+};
+
+}
@@ -0,0 +1,277 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "wavfile.h"
+
+namespace modpro {
+
+static const uint16_t wave_format_pcm = 1;
+static const uint16_t wave_format_float = 3;
+static const uint16_t wave_format_extensible = 0xFFFE;
+
+static uint32_t read_u32(const uint8_t * bytes_in)
+{
+    return bytes_in[0] | (bytes_in[1] << 8) | (bytes_in[2] << 16) | (uint32_t(bytes_in[3]) << 24);
+}
+
+static uint16_t read_u16(const uint8_t * bytes_in)
+{
+    return bytes_in[0] | (bytes_in[1] << 8);
+}
+
+static void put_u32(uint8_t * bytes_out, const uint32_t value_in)
+{
+    bytes_out[0] = value_in;
+    bytes_out[1] = value_in >> 8;
+    bytes_out[2] = value_in >> 16;
+    bytes_out[3] = value_in >> 24;
+}
+
+static void put_u16(uint8_t * bytes_out, const uint16_t value_in)
+{
+    bytes_out[0] = value_in;
+    bytes_out[1] = value_in >> 8;
+}
+
+bool wavfile::is_wav_path(const std::string path_in)
+{
+    auto dot_pos = path_in.rfind(".");
+
+    if (dot_pos == std::string::npos) {
+        return false;
+    }
+
+    auto extension = path_in.substr(dot_pos + 1);
+    return extension == "wav" || extension == "WAV";
+}
+
+wavfile::reader::reader(const std::string path_in, const unsigned int raw_channels_in, const unsigned int raw_sample_rate_in)
+: path(path_in), channels(raw_channels_in), sample_rate(raw_sample_rate_in)
+{
+    file_p = fopen(path.c_str(), "rb");
+
+    if (file_p == nullptr) {
+        throw std::runtime_error("could not open for reading: " + path);
+    }
+
+    if (is_wav_path(path)) {
+        read_header();
+    }
+}
+
+wavfile::reader::~reader()
+{
+    if (file_p != nullptr) {
+        fclose(file_p);
+        file_p = nullptr;
+    }
+}
+
+// leaves the file positioned at the start of the sample data
+void wavfile::reader::read_header()
+{
+    uint8_t riff[12];
+    bool found_format = false;
+    uint32_t data_size = 0;
+
+    if (fread(riff, sizeof(riff), 1, file_p) != 1 || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4)) {
+        throw std::runtime_error("not a RIFF WAVE file: " + path);
+    }
+
+    while(true) {
+        uint8_t chunk_header[8];
+
+        if (fread(chunk_header, sizeof(chunk_header), 1, file_p) != 1) {
+            throw std::runtime_error("no data chunk in " + path);
+        }
+
+        auto chunk_size = read_u32(chunk_header + 4);
+
+        if (! memcmp(chunk_header, "data", 4)) {
+            data_size = chunk_size;
+            break;
+        }
+
+        if (! memcmp(chunk_header, "fmt ", 4)) {
+            std::vector<uint8_t> format(chunk_size);
+
+            if (chunk_size < 16 || fread(format.data(), chunk_size, 1, file_p) != 1) {
+                throw std::runtime_error("bad format chunk in " + path);
+            }
+
+            auto format_tag = read_u16(&format[0]);
+            channels = read_u16(&format[2]);
+            sample_rate = read_u32(&format[4]);
+            bytes_per_sample = read_u16(&format[14]) / 8;
+
+            if (format_tag == wave_format_extensible && chunk_size >= 26) {
+                format_tag = read_u16(&format[24]);
+            }
+
+            if (format_tag == wave_format_float && bytes_per_sample == 4) {
+                is_float = true;
+            } else if (format_tag == wave_format_pcm && bytes_per_sample >= 2 && bytes_per_sample <= 4) {
+                is_float = false;
+            } else {
+                throw std::runtime_error("only 16, 24 and 32 bit PCM or 32 bit float WAV is supported: " + path);
+            }
+
+            if (chunk_size & 1) {
+                fseek(file_p, 1, SEEK_CUR);
+            }
+
+            found_format = true;
+            continue;
+        }
+
+        // chunks are padded to an even size
+        if (fseek(file_p, chunk_size + (chunk_size & 1), SEEK_CUR)) {
+            throw std::runtime_error("could not seek in " + path);
+        }
+    }
+
+    if (! found_format) {
+        throw std::runtime_error("no format chunk before the data in " + path);
+    }
+
+    if (channels == 0) {
+        throw std::runtime_error("WAV file has no channels: " + path);
+    }
+
+    // a recording that was never closed says 0 and a stream says the most
+    // it can so both are read to the end of the file
+    if (data_size != 0 && data_size != UINT32_MAX) {
+        frames_left = data_size / (bytes_per_sample * channels);
+    }
+}
+
+wavfile::size_type wavfile::reader::read(sample_type * interleaved_out, const size_type frames_in)
+{
+    auto wanted = std::min(frames_in, frames_left);
+    auto samples = wanted * channels;
+
+    if (is_float) {
+        auto frames = fread(interleaved_out, sizeof(sample_type) * channels, wanted, file_p);
+        frames_left -= frames;
+        return frames;
+    }
+
+    raw_buffer.resize(samples * bytes_per_sample);
+    auto frames = fread(raw_buffer.data(), bytes_per_sample * channels, wanted, file_p);
+    frames_left -= frames;
+    auto bytes = raw_buffer.data();
+    // scale so full scale of any width maps to -1.0 .. 1.0
+    const sample_type scale = 1.0 / 2147483648.0;
+
+    for (size_type i = 0; i < frames * channels; i++) {
+        int32_t value = 0;
+
+        switch(bytes_per_sample) {
+            case 2: value = int32_t(uint32_t(read_u16(bytes)) << 16); break;
+            case 3: value = int32_t((uint32_t(bytes[0]) << 8) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 24)); break;
+            case 4: value = int32_t(read_u32(bytes)); break;
+        }
+
+        interleaved_out[i] = value * scale;
+        bytes += bytes_per_sample;
+    }
+
+    return frames;
+}
+
+wavfile::writer::writer(const std::string path_in, const unsigned int channels_in, const unsigned int sample_rate_in)
+: is_wav(is_wav_path(path_in)), path(path_in), channels(channels_in), sample_rate(sample_rate_in)
+{
+    file_p = fopen(path.c_str(), "wb");
+
+    if (file_p == nullptr) {
+        throw std::runtime_error("could not open for writing: " + path);
+    }
+
+    if (is_wav) {
+        write_header();
+    }
+}
+
+// a writer that was not closed leaves the sizes in the header at zero
+wavfile::writer::~writer()
+{
+    if (file_p != nullptr) {
+        fclose(file_p);
+        file_p = nullptr;
+    }
+}
+
+// always 32 bit float so nothing the effects produce is lost
+void wavfile::make_header(uint8_t * header_out, const unsigned int channels_in, const unsigned int sample_rate_in, const size_type data_bytes_in)
+{
+    uint32_t bytes_per_frame = sizeof(sample_type) * channels_in;
+    uint32_t data_size = data_bytes_in > UINT32_MAX - 36 ? UINT32_MAX - 36 : data_bytes_in;
+
+    memcpy(header_out, "RIFF", 4);
+    put_u32(header_out + 4, 36 + data_size);
+    memcpy(header_out + 8, "WAVE", 4);
+    memcpy(header_out + 12, "fmt ", 4);
+    put_u32(header_out + 16, 16);
+    put_u16(header_out + 20, wave_format_float);
+    put_u16(header_out + 22, channels_in);
+    put_u32(header_out + 24, sample_rate_in);
+    put_u32(header_out + 28, sample_rate_in * bytes_per_frame);
+    put_u16(header_out + 32, bytes_per_frame);
+    put_u16(header_out + 34, sizeof(sample_type) * 8);
+    memcpy(header_out + 36, "data", 4);
+    put_u32(header_out + 40, data_size);
+}
+
+void wavfile::writer::write_header()
+{
+    uint8_t header[header_size];
+
+    make_header(header, channels, sample_rate, data_bytes);
+
+    if (fwrite(header, sizeof(header), 1, file_p) != 1) {
+        throw std::runtime_error("could not write WAV header: " + path);
+    }
+}
+
+void wavfile::writer::write(const sample_type * interleaved_in, const size_type frames_in)
+{
+    if (fwrite(interleaved_in, sizeof(sample_type) * channels, frames_in, file_p) != frames_in) {
+        throw std::runtime_error("could not write to " + path);
+    }
+
+    data_bytes += frames_in * channels * sizeof(sample_type);
+}
+
+void wavfile::writer::close()
+{
+    if (is_wav) {
+        rewind(file_p);
+        write_header();
+    }
+
+    auto result = fclose(file_p);
+    file_p = nullptr;
+
+    if (result) {
+        throw std::runtime_error("could not close " + path);
+    }
+}
+
+}
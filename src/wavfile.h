@@ -0,0 +1,80 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace modpro {
+
+// Reads and writes interleaved float samples. Files that end in .wav are
+// RIFF WAVE; anything else is headerless 32 bit float in host byte order
+// which needs the channel count and sample rate given to it.
+struct wavfile {
+    using sample_type = float;
+    using size_type = size_t;
+
+    static const size_type header_size = 44;
+
+    static bool is_wav_path(const std::string path_in);
+    // the header of a 32 bit float file holding data_bytes of samples
+    static void make_header(uint8_t * header_out, const unsigned int channels_in, const unsigned int sample_rate_in, const size_type data_bytes_in);
+
+    class reader {
+        FILE * file_p = nullptr;
+        bool is_float = true;
+        unsigned int bytes_per_sample = sizeof(sample_type);
+        // frames left in the data chunk; chunks after it are not audio
+        size_type frames_left = SIZE_MAX;
+        std::vector<uint8_t> raw_buffer;
+
+        void read_header();
+
+        public:
+        const std::string path;
+        unsigned int channels;
+        unsigned int sample_rate;
+
+        reader(const std::string path_in, const unsigned int raw_channels_in = 1, const unsigned int raw_sample_rate_in = 48000);
+        ~reader();
+        // returns the number of frames read which is less than frames_in
+        // only at the end of the file
+        size_type read(sample_type * interleaved_out, const size_type frames_in);
+    };
+
+    class writer {
+        FILE * file_p = nullptr;
+        bool is_wav;
+        size_type data_bytes = 0;
+
+        void write_header();
+
+        public:
+        const std::string path;
+        const unsigned int channels;
+        const unsigned int sample_rate;
+
+        writer(const std::string path_in, const unsigned int channels_in, const unsigned int sample_rate_in);
+        ~writer();
+        void write(const sample_type * interleaved_in, const size_type frames_in);
+        // fills in the sizes in the header and closes the file
+        void close();
+    };
+};
+
+}
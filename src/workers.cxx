@@ -0,0 +1,301 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "workers.h"
+
+namespace modpro {
+
+static void futex_wait(std::atomic<uint32_t> * word_in, const uint32_t expected_in)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word_in), FUTEX_WAIT_PRIVATE, expected_in, nullptr, nullptr, 0);
+}
+
+static void futex_wake_all(std::atomic<uint32_t> * word_in)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word_in), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+task_graph::task_type task_graph::add_task(const std::vector<task_type> & successors_in)
+{
+    task_type new_task = edges.size();
+
+    for (auto i : successors_in) {
+        if (i <= new_task) {
+            throw std::runtime_error("task successors must come after the task");
+        }
+    }
+
+    edges.push_back(successors_in);
+    return new_task;
+}
+
+void task_graph::finalize()
+{
+    auto count = edges.size();
+
+    dependency_counts = std::vector<task_type>(count, 0);
+    priorities = std::vector<task_type>(count, 1);
+    successor_begin.clear();
+    successors.clear();
+    roots.clear();
+
+    for (auto& i : edges) {
+        for (auto j : i) {
+            if (j >= count) {
+                throw std::runtime_error("task successor does not exist");
+            }
+
+            dependency_counts[j]++;
+        }
+    }
+
+    // task numbers are topologically sorted so walking them backwards
+    // visits every successor before the task itself
+    for (auto i = count; i > 0; i--) {
+        auto task = i - 1;
+
+        for (auto j : edges[task]) {
+            priorities[task] = std::max(priorities[task], task_type(priorities[j] + 1));
+        }
+    }
+
+    auto by_priority = [this](const task_type a_in, const task_type b_in) -> bool {
+        return priorities[a_in] > priorities[b_in];
+    };
+
+    for (task_type i = 0; i < count; i++) {
+        auto sorted = edges[i];
+        std::stable_sort(sorted.begin(), sorted.end(), by_priority);
+
+        successor_begin.push_back(successors.size());
+        successors.insert(successors.end(), sorted.begin(), sorted.end());
+
+        if (dependency_counts[i] == 0) {
+            roots.push_back(i);
+        }
+    }
+
+    successor_begin.push_back(successors.size());
+    std::stable_sort(roots.begin(), roots.end(), by_priority);
+
+    pending = std::unique_ptr<std::atomic<task_type>[]>(new std::atomic<task_type>[count]);
+}
+
+size_t task_graph::size()
+{
+    return edges.size();
+}
+
+task_graph::task_type task_graph::get_priority(const task_type task_in)
+{
+    return priorities[task_in];
+}
+
+const std::vector<task_graph::task_type> & task_graph::get_successors(const task_type task_in)
+{
+    return edges[task_in];
+}
+
+worker_pool::worker_pool(const size_t num_threads_in, const std::vector<int> cpus_in, const int priority_in)
+: num_threads(num_threads_in), cpus(cpus_in), priority(priority_in)
+{
+
+}
+
+worker_pool::~worker_pool()
+{
+    stop();
+}
+
+void worker_pool::start()
+{
+    assert(threads.size() == 0);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([this, i]() -> void { worker(i); });
+
+        auto handle = threads.back().native_handle();
+
+        if (priority > 0) {
+            sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = priority;
+
+            auto result = pthread_setschedparam(handle, SCHED_FIFO, &param);
+            if (result != 0) {
+                std::cout << "  could not set SCHED_FIFO priority " << priority << " on worker " << i << ": " << strerror(result) << std::endl;
+            }
+        }
+
+        if (cpus.size() > 0) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(cpus[i % cpus.size()], &cpu_set);
+
+            auto result = pthread_setaffinity_np(handle, sizeof(cpu_set), &cpu_set);
+            if (result != 0) {
+                std::cout << "  could not pin worker " << i << " to CPU " << cpus[i % cpus.size()] << ": " << strerror(result) << std::endl;
+            }
+        }
+    }
+}
+
+void worker_pool::stop()
+{
+    if (threads.size() == 0) {
+        return;
+    }
+
+    should_stop.store(true);
+    wakeup.fetch_add(1, std::memory_order_release);
+    futex_wake_all(&wakeup);
+
+    for (auto& i : threads) {
+        i.join();
+    }
+
+    threads.clear();
+}
+
+// Runs a task and then keeps running the most critical successor it made
+// ready. Tasks are only ever found through the ready ring or as a
+// continuation so the values read from current_tasks always belong to the
+// run() call that is in progress.
+void worker_pool::run_task(task_type task_in)
+{
+    auto tasks = current_tasks.load(std::memory_order_relaxed);
+    auto fn = current_fn.load(std::memory_order_relaxed);
+    auto arg = current_arg.load(std::memory_order_relaxed);
+    bool have_task = true;
+
+    while(have_task) {
+        fn(arg, task_in);
+
+        have_task = false;
+        task_type next_task = 0;
+
+        for (auto i = tasks->successor_begin[task_in]; i < tasks->successor_begin[task_in + 1]; i++) {
+            auto successor = tasks->successors[i];
+
+            if (tasks->pending[successor].fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                continue;
+            }
+
+            if (! have_task) {
+                next_task = successor;
+                have_task = true;
+            } else {
+                // the ring is as large as the biggest allowed task graph
+                ready.push(successor);
+            }
+        }
+
+        // must be the last access to anything from this run
+        remaining.fetch_sub(1, std::memory_order_release);
+        task_in = next_task;
+    }
+}
+
+void worker_pool::work()
+{
+    while(remaining.load(std::memory_order_acquire) != 0) {
+        task_type next_task;
+
+        if (ready.pop(next_task)) {
+            run_task(next_task);
+        } else {
+            cpu_relax();
+        }
+    }
+}
+
+void worker_pool::worker(const size_t worker_num_in)
+{
+    uint32_t seen = 0;
+
+    while(true) {
+        auto next = wakeup.load(std::memory_order_acquire);
+
+        while(next == seen) {
+            futex_wait(&wakeup, seen);
+            next = wakeup.load(std::memory_order_acquire);
+        }
+
+        seen = next;
+
+        if (should_stop.load()) {
+            return;
+        }
+
+        work();
+    }
+}
+
+// inside jack audio thread
+void worker_pool::run(task_graph & tasks_in, task_fn fn_in, void * arg_in)
+{
+    auto count = tasks_in.size();
+
+    if (threads.size() == 0 || count < 2 || count > max_tasks) {
+        for (size_t i = 0; i < count; i++) {
+            fn_in(arg_in, i);
+        }
+
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        tasks_in.pending[i].store(tasks_in.dependency_counts[i], std::memory_order_relaxed);
+    }
+
+    // nothing from the last run is outstanding because the previous call
+    // did not return until remaining hit zero
+    current_tasks.store(&tasks_in, std::memory_order_relaxed);
+    current_fn.store(fn_in, std::memory_order_relaxed);
+    current_arg.store(arg_in, std::memory_order_relaxed);
+    remaining.store(count, std::memory_order_release);
+
+    for (auto i : tasks_in.roots) {
+        ready.push(i);
+    }
+
+    wakeup.fetch_add(1, std::memory_order_release);
+    futex_wake_all(&wakeup);
+
+    work();
+}
+
+}
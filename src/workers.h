@@ -0,0 +1,95 @@
+// Copyright (C) 2018  Tyler Riddle <cardboardaardvark@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ring.h"
+
+namespace modpro {
+
+// A set of work items and the order they have to run in. Task numbers must
+// already be in a valid topological order so running them one after
+// another by number is always correct. Built outside of the jack audio
+// thread and then only read by it, except for the pending counters.
+struct task_graph {
+    using task_type = uint32_t;
+
+    private:
+    std::vector<std::vector<task_type>> edges;
+    std::vector<task_type> dependency_counts;
+    std::vector<task_type> priorities;
+    std::vector<task_type> successor_begin;
+    std::vector<task_type> successors;
+    std::vector<task_type> roots;
+    std::unique_ptr<std::atomic<task_type>[]> pending;
+
+    friend struct worker_pool;
+
+    public:
+    task_type add_task(const std::vector<task_type> & successors_in);
+    // computes the critical path priority of every task and orders roots
+    // and successors so the longest remaining path is always started first
+    void finalize();
+    size_t size();
+    task_type get_priority(const task_type task_in);
+    const std::vector<task_type> & get_successors(const task_type task_in);
+};
+
+// A pool of realtime threads the jack audio thread hands work to every
+// period. Workers sleep on a futex between periods. Ready tasks go through
+// a shared lock-free ring that every thread takes work from; a thread that
+// finishes a task keeps going with the most critical successor it made
+// ready and publishes the rest for the other threads. The calling thread
+// takes part in the work and does not return until every task is finished.
+struct worker_pool {
+    using task_fn = void (*)(void * arg_in, const size_t index_in);
+    using task_type = task_graph::task_type;
+
+    const size_t num_threads;
+    const std::vector<int> cpus;
+    const int priority;
+    static const size_t max_tasks = 4096;
+
+    private:
+    std::vector<std::thread> threads;
+    std::atomic<bool> should_stop = ATOMIC_VAR_INIT(false);
+    // futex word; bumped once per call to run()
+    std::atomic<uint32_t> wakeup = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> remaining = ATOMIC_VAR_INIT(0);
+    ring<task_type> ready = ring<task_type>(max_tasks);
+    std::atomic<task_graph *> current_tasks = ATOMIC_VAR_INIT(nullptr);
+    std::atomic<task_fn> current_fn = ATOMIC_VAR_INIT(nullptr);
+    std::atomic<void *> current_arg = ATOMIC_VAR_INIT(nullptr);
+
+    void worker(const size_t worker_num_in);
+    void work();
+    void run_task(task_type task_in);
+
+    public:
+    worker_pool(const size_t num_threads_in, const std::vector<int> cpus_in, const int priority_in);
+    ~worker_pool();
+    void start();
+    void stop();
+    // inside jack audio thread
+    void run(task_graph & tasks_in, task_fn fn_in, void * arg_in);
+};
+
+}